@@ -26,10 +26,30 @@
 #ifdef HAVE_ALSA
 
 #include "pcm.h"
+#include "metrics.h"
 #include <alsa/asoundlib.h>
 
-snd_pcm_format_t determine_pcm_format (pcm_data_info_t *info)
+static snd_pcm_format_t determine_pcm_format (pcm_data_info_t *info)
 {
+  if (info->floating)
+    {
+      if (info->bytes_per_sample != 4)
+        return SND_PCM_FORMAT_UNKNOWN;
+
+      return info->native_endian ? SND_PCM_FORMAT_FLOAT
+                                 : SND_PCM_FORMAT_FLOAT_LE;
+    }
+
+  /* Packed 24-bit samples, the other 24-bit formats use 4 bytes. */
+  if (info->bytes_per_sample == 3)
+    {
+#ifdef WORDS_BIGENDIAN
+      if (info->native_endian)
+        return info->sign ? SND_PCM_FORMAT_S24_3BE : SND_PCM_FORMAT_U24_3BE;
+#endif
+      return info->sign ? SND_PCM_FORMAT_S24_3LE : SND_PCM_FORMAT_U24_3LE;
+    }
+
   if (info->native_endian)
     {
       if (info->sign)
@@ -80,167 +100,369 @@ snd_pcm_format_t determine_pcm_format (pcm_data_info_t *info)
   return SND_PCM_FORMAT_UNKNOWN;
 }
 
-
-bool
-play_pcm_buffer (playable_pcm_buffer_t *buffer)
+static bool
+probe_alsa_device (pcm_data_info_t *info)
 {
-  int                 status;
-  snd_pcm_t          *handle;
-  snd_pcm_format_t    format;
-  snd_pcm_sframes_t   frames_wrote;
-  int                 frames_count;
-  size_t              bytes_handled;
-  size_t              bytes_to_write;
-
-
-  format = determine_pcm_format (&(buffer->info));
-  if (format == SND_PCM_FORMAT_UNKNOWN)
+  static const snd_pcm_format_t narrow_formats[] =
+    { SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S32,
+      SND_PCM_FORMAT_S24, SND_PCM_FORMAT_FLOAT };
+  static const snd_pcm_format_t wide_formats[] =
+    { SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S24,
+      SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S16 };
+  static const snd_pcm_format_t float_formats[] =
+    { SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S32,
+      SND_PCM_FORMAT_S24, SND_PCM_FORMAT_S16 };
+
+  const snd_pcm_format_t *candidates;
+  snd_pcm_format_t        format;
+  snd_pcm_t              *probe;
+  snd_pcm_hw_params_t    *params;
+  int                     status;
+  unsigned int            rate;
+  unsigned int            iter;
+
+
+  if (info->floating)
+    candidates = float_formats;
+  else if (info->bits_per_sample > 16)
+    candidates = wide_formats;
+  else
+    candidates = narrow_formats;
+
+  /**
+   * Without automatic conversions, plugin PCMs only offer the formats and
+   * rates supported by the device they lead to.
+   */
+  status = snd_pcm_open (&probe,
+                         (pcm_device_name != NULL) ? pcm_device_name
+                                                   : "default",
+                         SND_PCM_STREAM_PLAYBACK,
+                         SND_PCM_NO_AUTO_FORMAT | SND_PCM_NO_AUTO_RESAMPLE);
+  if (status < 0)
     {
-      fprintf (stderr, "%s: Unable to determine the beep's PCM data format.\n",
-               progname);
+      fprintf (stderr, "%s: Failed to open the playback device: %s\n",
+               progname, snd_strerror (status));
 
       return false;
     }
 
-  status = snd_pcm_open (&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
+  status = snd_pcm_hw_params_malloc (&params);
   if (status < 0)
     {
-      fprintf (stderr, "%s: Failed to open the playback device: %s\n",
+      fprintf (stderr, "%s: Failed to query the playback device: %s.\n",
                progname, snd_strerror (status));
 
+      snd_pcm_close (probe);
       return false;
     }
 
-  status = snd_pcm_set_params (handle, format, SND_PCM_ACCESS_RW_INTERLEAVED,
-                               buffer->info.channels, buffer->info.sample_rate,
-                               1,          /* soft_resample */
-                               0);         /* latency (us).*/
-  if (status < 0)
+  format = SND_PCM_FORMAT_UNKNOWN;
+  rate   = info->sample_rate;
+  if (snd_pcm_hw_params_any (probe, params) >= 0)
     {
-      fprintf (stderr, "%s: Failed to configure the playback device: %s.\n",
-               progname, snd_strerror (status));
+      for (iter = 0; iter < 4; iter++)
+        {
+          if (snd_pcm_hw_params_test_format (probe, params,
+                                             candidates[iter]) == 0)
+            {
+              format = candidates[iter];
+              break;
+            }
+        }
 
-      snd_pcm_close (handle);
-      return false;
+      /* The closest rate the device plays without resampling. */
+      if (format != SND_PCM_FORMAT_UNKNOWN
+          && snd_pcm_hw_params_set_rate_resample (probe, params, 0) == 0
+          && snd_pcm_hw_params_set_format (probe, params, format) == 0
+          && snd_pcm_hw_params_set_rate_near (probe, params, &rate, NULL) == 0)
+        info->sample_rate = rate;
     }
 
-  bytes_handled = 0;
-  while (bytes_handled < buffer->data_len)
+  snd_pcm_hw_params_free (params);
+  snd_pcm_close (probe);
+
+  info->native_endian = true;
+  info->sign          = true;
+  info->floating      = false;
+  switch (format)
     {
-      if (buffer->data_len - bytes_handled < BUFSIZ)
-        bytes_to_write = buffer->data_len - bytes_handled;
-      else
-        bytes_to_write = BUFSIZ;
+      case SND_PCM_FORMAT_S16:
+        info->bytes_per_sample = 2;
+        info->bits_per_sample  = 16;
+        break;
+      case SND_PCM_FORMAT_S24:
+        info->bytes_per_sample = 4;
+        info->bits_per_sample  = 24;
+        break;
+      case SND_PCM_FORMAT_S32:
+        info->bytes_per_sample = 4;
+        info->bits_per_sample  = 32;
+        break;
+      case SND_PCM_FORMAT_FLOAT:
+        info->floating         = true;
+        info->bytes_per_sample = 4;
+        info->bits_per_sample  = 32;
+        break;
+      default:
+        fprintf (stderr, "%s: The playback device supports none of the "
+                         "known sample formats.\n",
+                 progname);
+
+        return false;
+    }
 
-      frames_count = snd_pcm_bytes_to_frames (handle, bytes_to_write);
-      frames_wrote = snd_pcm_writei (handle, buffer->data + bytes_handled,
-                                     frames_count);
-      if (frames_wrote < 0)
-        frames_wrote = snd_pcm_recover (handle, frames_wrote, 0);
+  return true;
+}
 
-      if (frames_wrote < 0)
-        {
-          fprintf (stderr, "%s: Writing to the playback device failed: %s.\n",
-                   progname, snd_strerror (frames_wrote));
 
-          snd_pcm_close (handle);
-          return false;
-        }
+/* The playback device, and the format it's configured for. */
+static snd_pcm_t        *handle = NULL;
+static pcm_data_info_t   handle_info;
+static bool              mmap_access;
 
-      if (frames_wrote > 0 && frames_wrote < frames_count)
-        {
-          fprintf (stderr, "%s: Warning: Wrote only %ld frames instead of the "
-                   "expected %d to the playback device.\n",
-                   progname, frames_wrote, frames_count);
-        }
+static void close_alsa_device (void);
 
-      bytes_handled += bytes_to_write;
-    }
+/* Recovers the device from a failed write, counting the underruns. */
+static int
+recover_alsa_device (int error)
+{
+  if (error == -EPIPE)
+    count_metric (METRIC_XRUNS);
 
-  snd_pcm_drain (handle);
-  snd_pcm_close (handle);
+  return snd_pcm_recover (handle, error, 0);
+}
 
-  return true;
+/**
+ * Makes sure that a configured device is ready to accept data, recovering it
+ * from a finished drain, an xrun or a system suspend.
+ */
+static bool
+prepare_alsa_device (void)
+{
+  int status;
+
+  switch (snd_pcm_state (handle))
+    {
+      case SND_PCM_STATE_PREPARED:
+      case SND_PCM_STATE_RUNNING:
+        return true;
+
+      case SND_PCM_STATE_XRUN:
+        count_metric (METRIC_XRUNS);
+        status = snd_pcm_recover (handle, -EPIPE, 1);
+        break;
+
+      case SND_PCM_STATE_SUSPENDED:
+        status = snd_pcm_recover (handle, -ESTRPIPE, 1);
+        break;
+
+      case SND_PCM_STATE_DISCONNECTED:
+        return false;
+
+      default:
+        status = snd_pcm_prepare (handle);
+        break;
+    }
+
+  return (status >= 0);
 }
 
-bool
-play_pcm_file (playable_pcm_file_t *file)
+static bool
+open_alsa_device (pcm_data_info_t *info)
 {
   int                 status;
-  snd_pcm_t          *handle;
   snd_pcm_format_t    format;
-  snd_pcm_sframes_t   frames_wrote;
-  uint8_t             playback_buf[BUFSIZ];
-  int                 frames_count;
-  size_t              read_bytes;
 
 
-  format = determine_pcm_format (&(file->info));
-  if (format == SND_PCM_FORMAT_UNKNOWN)
+  if (handle != NULL)
     {
-      fprintf (stderr, "%s: Unable to determine the beep's PCM data format.\n",
-               progname);
+      if (same_pcm_format (&handle_info, info) && prepare_alsa_device ())
+        return true;
 
-      return false;
+      close_alsa_device ();
     }
 
-  if (fsetpos (file->stream, &(file->pcm_start_pos)) != 0)
+  format = determine_pcm_format (info);
+  if (format == SND_PCM_FORMAT_UNKNOWN)
     {
-      fprintf (stderr, "%s: Failed to seek to the PCM data of `%s': %s.\n",
-               progname, file->name, strerror (errno));
+      fprintf (stderr, "%s: Unable to determine the beep's PCM data format.\n",
+               progname);
 
       return false;
     }
 
-  status = snd_pcm_open (&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
+  status = snd_pcm_open (&handle,
+                         (pcm_device_name != NULL) ? pcm_device_name
+                                                   : "default",
+                         SND_PCM_STREAM_PLAYBACK, 0);
   if (status < 0)
     {
       fprintf (stderr, "%s: Failed to open the playback device: %s\n",
                progname, snd_strerror (status));
 
+      handle = NULL;
       return false;
     }
-
-  status = snd_pcm_set_params (handle, format, SND_PCM_ACCESS_RW_INTERLEAVED,
-                               file->info.channels, file->info.sample_rate,
-                               1,          /* soft_resample */
-                               0);         /* latency (us).*/
+  count_metric (METRIC_DEVICE_OPENS);
+
+  /**
+   * Prefer writing straight into the device's ring buffer, and fall back to
+   * the read/write interface when the device can't be mapped, unless either
+   * was asked for.
+   */
+  mmap_access = (pcm_device_access != PCM_ACCESS_RW);
+  if (mmap_access)
+    status = snd_pcm_set_params (handle, format,
+                                 SND_PCM_ACCESS_MMAP_INTERLEAVED,
+                                 info->channels, info->sample_rate,
+                                 1,        /* soft_resample */
+                                 pcm_device_latency);
+  if (! mmap_access
+      || (status < 0 && pcm_device_access == PCM_ACCESS_AUTO))
+    {
+      mmap_access = false;
+      status = snd_pcm_set_params (handle, format,
+                                   SND_PCM_ACCESS_RW_INTERLEAVED,
+                                   info->channels, info->sample_rate,
+                                   1,      /* soft_resample */
+                                   pcm_device_latency);
+    }
   if (status < 0)
     {
       fprintf (stderr, "%s: Failed to configure the playback device: %s.\n",
                progname, snd_strerror (status));
 
-      snd_pcm_close (handle);
+      close_alsa_device ();
       return false;
     }
 
-  while (true)
+  handle_info = *info;
+  return true;
+}
+
+/* Copies the data straight into the mapped ring buffer of the device. */
+static bool
+write_alsa_mmap (uint8_t *data, size_t len)
+{
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t             offset;
+  snd_pcm_uframes_t             frames;
+  snd_pcm_uframes_t             frames_left;
+  snd_pcm_sframes_t             avail;
+  snd_pcm_sframes_t             committed;
+  size_t                        frame_bytes;
+  int                           status;
+
+
+  frame_bytes = snd_pcm_frames_to_bytes (handle, 1);
+  frames_left = len / frame_bytes;
+  while (frames_left > 0)
     {
-      read_bytes = fread (playback_buf, 1, BUFSIZ, file->stream);
-      if (read_bytes == 0)
+      avail = snd_pcm_avail_update (handle);
+      if (avail < 0)
+        {
+          status = recover_alsa_device (avail);
+          if (status < 0)
+            {
+              fprintf (stderr, "%s: Writing to the playback device failed: %s.\n",
+                       progname, snd_strerror (status));
+
+              return false;
+            }
+          continue;
+        }
+
+      /* The ring buffer is full, wait until some of it has been played. */
+      if (avail == 0)
+        {
+          if (snd_pcm_state (handle) == SND_PCM_STATE_PREPARED)
+            snd_pcm_start (handle);
+
+          status = snd_pcm_wait (handle, -1);
+          if (status < 0 && recover_alsa_device (status) < 0)
+            {
+              fprintf (stderr, "%s: Writing to the playback device failed: %s.\n",
+                       progname, snd_strerror (status));
+
+              return false;
+            }
+          continue;
+        }
+
+      frames = frames_left;
+      if (frames > (snd_pcm_uframes_t) avail)
+        frames = avail;
+
+      status = snd_pcm_mmap_begin (handle, &areas, &offset, &frames);
+      if (status < 0)
         {
-          if (ferror (file->stream))
+          if (recover_alsa_device (status) < 0)
             {
-              fprintf (stderr, "%s: An error occured while reading from `%s': %s.\n",
-                       progname, file->name, strerror (errno));
+              fprintf (stderr, "%s: Writing to the playback device failed: %s.\n",
+                       progname, snd_strerror (status));
 
-              snd_pcm_close (handle);
               return false;
             }
+          continue;
+        }
+
+      /* Interleaved frames are contiguous, starting at the first channel. */
+      memcpy ((uint8_t *) areas[0].addr + (areas[0].first / 8)
+              + offset * (areas[0].step / 8),
+              data, frames * frame_bytes);
+
+      committed = snd_pcm_mmap_commit (handle, offset, frames);
+      if (committed < 0)
+        {
+          if (recover_alsa_device (committed) < 0)
+            {
+              fprintf (stderr, "%s: Writing to the playback device failed: %s.\n",
+                       progname, snd_strerror (committed));
 
-          break;
+              return false;
+            }
+          continue;
         }
-      frames_count = snd_pcm_bytes_to_frames (handle, read_bytes);
-      frames_wrote = snd_pcm_writei (handle, playback_buf, frames_count);
+
+      data        += committed * frame_bytes;
+      frames_left -= committed;
+      note_first_sample ();
+    }
+
+  return true;
+}
+
+static bool
+write_alsa_device (uint8_t *data, size_t len)
+{
+  snd_pcm_sframes_t   frames_wrote;
+  int                 frames_count;
+  size_t              bytes_handled;
+  size_t              bytes_to_write;
+
+
+  if (mmap_access)
+    return write_alsa_mmap (data, len);
+
+  bytes_handled = 0;
+  while (bytes_handled < len)
+    {
+      if (len - bytes_handled < BUFSIZ)
+        bytes_to_write = len - bytes_handled;
+      else
+        bytes_to_write = BUFSIZ;
+
+      frames_count = snd_pcm_bytes_to_frames (handle, bytes_to_write);
+      frames_wrote = snd_pcm_writei (handle, data + bytes_handled,
+                                     frames_count);
       if (frames_wrote < 0)
-        frames_wrote = snd_pcm_recover (handle, frames_wrote, 0);
+        frames_wrote = recover_alsa_device (frames_wrote);
 
       if (frames_wrote < 0)
         {
           fprintf (stderr, "%s: Writing to the playback device failed: %s.\n",
                    progname, snd_strerror (frames_wrote));
 
-          snd_pcm_close (handle);
           return false;
         }
 
@@ -250,12 +472,40 @@ play_pcm_file (playable_pcm_file_t *file)
                    "expected %d to the playback device.\n",
                    progname, frames_wrote, frames_count);
         }
-    }
 
-  snd_pcm_drain (handle);
-  snd_pcm_close (handle);
+      bytes_handled += bytes_to_write;
+      note_first_sample ();
+    }
 
   return true;
 }
 
-#endif /* HAVE_SOUNDIO */
+static void
+drain_alsa_device (void)
+{
+  if (handle != NULL)
+    snd_pcm_drain (handle);
+}
+
+static void
+close_alsa_device (void)
+{
+  if (handle == NULL)
+    return;
+
+  snd_pcm_close (handle);
+  handle = NULL;
+}
+
+const pcm_backend_t alsa_backend =
+{
+  .name      = "alsa",
+  .automatic = true,
+  .probe     = probe_alsa_device,
+  .open      = open_alsa_device,
+  .write     = write_alsa_device,
+  .drain     = drain_alsa_device,
+  .close     = close_alsa_device
+};
+
+#endif /* HAVE_ALSA */
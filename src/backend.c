@@ -0,0 +1,329 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "pcm.h"
+
+#ifdef HAVE_SOUND
+
+#include "metrics.h"
+#include <stdatomic.h>
+#include <time.h>
+
+/* The backends built in, in the order they're preferred in. */
+static const pcm_backend_t *const backends[] =
+{
+#ifdef HAVE_PULSE
+  &pulse_backend,
+#endif
+#ifdef HAVE_ALSA
+  &alsa_backend,
+#endif
+#ifdef HAVE_SOUNDIO
+  &soundio_backend,
+#endif
+#ifdef HAVE_OSS
+  &oss_backend,
+#endif
+#ifdef HAVE_NULL
+  &null_backend,
+#endif
+#ifdef HAVE_CAPTURE
+  &capture_backend,
+#endif
+};
+
+#define BACKEND_COUNT (sizeof (backends) / sizeof (backends[0]))
+
+/**
+ * The automatic backends, in the order they're failed over in: first those
+ * whose device could be opened when nxbelld started, fastest first, with
+ * how long that took in microseconds, then the others.
+ */
+static const pcm_backend_t *ranked[BACKEND_COUNT];
+static uint64_t             open_time[BACKEND_COUNT];
+static unsigned int         ranked_count = 0;
+static unsigned int         opened_count = 0;
+
+/* Set when the backend was chosen by name, which rules out failing over. */
+static bool                 named = false;
+
+/**
+ * Read by the main thread when probing a reloaded sound, replaced by the
+ * playback thread when failing over.
+ */
+static _Atomic (const pcm_backend_t *) selected = NULL;
+
+static uint64_t
+elapsed_us (const struct timespec *since)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) (now.tv_sec - since->tv_sec) * 1000000
+         + now.tv_nsec / 1000 - since->tv_nsec / 1000;
+}
+
+static void
+list_backends (void)
+{
+  unsigned int iter;
+
+  for (iter = 0; iter < BACKEND_COUNT; iter++)
+    fprintf (stderr, "%s%s", (iter > 0) ? ", " : "", backends[iter]->name);
+}
+
+/* Times opening the device of every automatic backend, as probing does. */
+static void
+rank_backends (void)
+{
+  const pcm_backend_t *failed[BACKEND_COUNT];
+  unsigned int         failed_count;
+  pcm_data_info_t      info;
+  struct timespec      start;
+  uint64_t             taken;
+  unsigned int         iter;
+  unsigned int         slot;
+
+
+  failed_count = 0;
+  for (iter = 0; iter < BACKEND_COUNT; iter++)
+    {
+      if (! backends[iter]->automatic)
+        continue;
+
+      info.native_endian    = true;
+      info.sign             = true;
+      info.floating         = false;
+      info.sample_rate      = 44100;
+      info.channels         = 1;
+      info.bytes_per_sample = 2;
+      info.bits_per_sample  = 16;
+
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      if (! backends[iter]->probe (&info))
+        {
+          failed[failed_count++] = backends[iter];
+          continue;
+        }
+      taken = elapsed_us (&start);
+
+      /* Equally fast backends stay in the order of preference. */
+      slot = opened_count;
+      while (slot > 0 && open_time[slot - 1] > taken)
+        {
+          ranked[slot]    = ranked[slot - 1];
+          open_time[slot] = open_time[slot - 1];
+          slot--;
+        }
+      ranked[slot]    = backends[iter];
+      open_time[slot] = taken;
+      opened_count++;
+    }
+
+  ranked_count = opened_count;
+  for (iter = 0; iter < failed_count; iter++)
+    ranked[ranked_count++] = failed[iter];
+}
+
+bool
+select_pcm_backend (const char *name)
+{
+  unsigned int iter;
+
+  if (name != NULL)
+    {
+      for (iter = 0; iter < BACKEND_COUNT; iter++)
+        {
+          if (strcmp (backends[iter]->name, name) == 0)
+            {
+              atomic_store (&selected, backends[iter]);
+              named = true;
+              return true;
+            }
+        }
+
+      fprintf (stderr, "%s: There's no `%s' sound backend, the ones built "
+                       "in are: ",
+               progname, name);
+      list_backends ();
+      fprintf (stderr, ".\n");
+
+      return false;
+    }
+
+  /* Without an automatic backend, there's only a simulated device. */
+  rank_backends ();
+  if (ranked_count == 0)
+    {
+      atomic_store (&selected, backends[0]);
+      return true;
+    }
+
+  if (opened_count == 0)
+    fprintf (stderr, "%s: Warning: None of the sound backends could be "
+                     "opened, trying %s for every bell.\n",
+             progname, ranked[0]->name);
+
+  atomic_store (&selected, ranked[0]);
+  return true;
+}
+
+void
+write_backend_metrics (FILE *out)
+{
+  const pcm_backend_t *backend;
+  unsigned int         iter;
+
+  backend = atomic_load (&selected);
+  if (backend == NULL)
+    return;
+
+  fprintf (out, "# TYPE nxbelld_sound_backend gauge\n"
+                "nxbelld_sound_backend{backend=\"%s\"} 1\n",
+           backend->name);
+
+  if (opened_count == 0)
+    return;
+
+  fprintf (out, "# TYPE nxbelld_sound_backend_open_seconds gauge\n");
+  for (iter = 0; iter < opened_count; iter++)
+    fprintf (out, "nxbelld_sound_backend_open_seconds{backend=\"%s\"} "
+                  "%.6f\n",
+             ranked[iter]->name, open_time[iter] / 1e6);
+}
+
+const char *
+pcm_backend_name (void)
+{
+  const pcm_backend_t *backend;
+
+  backend = atomic_load (&selected);
+  return backend == NULL ? NULL : backend->name;
+}
+
+
+bool
+upload_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  const pcm_backend_t *backend;
+
+  backend = atomic_load (&selected);
+  if (backend == NULL || backend->upload == NULL)
+    return true;
+
+  return backend->upload (buffer);
+}
+
+bool
+play_uploaded_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  const pcm_backend_t *backend;
+
+  backend = atomic_load (&selected);
+  if (backend == NULL || backend->play_uploaded == NULL)
+    return false;
+
+  return backend->play_uploaded (buffer);
+}
+
+/* The buffer may have been uploaded before failing over. */
+void
+forget_uploaded_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  unsigned int iter;
+
+  for (iter = 0; iter < BACKEND_COUNT; iter++)
+    if (backends[iter]->forget != NULL)
+      backends[iter]->forget (buffer);
+}
+
+
+bool
+open_pcm_device (pcm_data_info_t *info)
+{
+  const pcm_backend_t *backend;
+  unsigned int         iter;
+
+  backend = atomic_load (&selected);
+  if (backend == NULL)
+    return false;
+  if (backend->open (info))
+    return true;
+  if (named)
+    return false;
+
+  /* Fail over to the next fastest backend which opens. */
+  for (iter = 0; iter < ranked_count; iter++)
+    {
+      if (ranked[iter] == backend || ! ranked[iter]->open (info))
+        continue;
+
+      fprintf (stderr, "%s: Warning: Switched from the %s to the %s sound "
+                       "backend.\n",
+               progname, backend->name, ranked[iter]->name);
+
+      atomic_store (&selected, ranked[iter]);
+      count_metric (METRIC_BACKEND_FAILOVERS);
+      return true;
+    }
+
+  return false;
+}
+
+bool
+probe_pcm_device (pcm_data_info_t *info)
+{
+  const pcm_backend_t *backend;
+
+  backend = atomic_load (&selected);
+  if (backend == NULL)
+    return false;
+
+  return backend->probe (info);
+}
+
+bool
+write_pcm_device (uint8_t *data, size_t len)
+{
+  return atomic_load (&selected)->write (data, len);
+}
+
+void
+drain_pcm_device (void)
+{
+  const pcm_backend_t *backend;
+
+  backend = atomic_load (&selected);
+  if (backend != NULL)
+    backend->drain ();
+}
+
+void
+close_pcm_device (void)
+{
+  const pcm_backend_t *backend;
+
+  backend = atomic_load (&selected);
+  if (backend != NULL)
+    backend->close ();
+}
+
+#endif /* HAVE_SOUND */
@@ -24,29 +24,48 @@
 #include "common.h"
 #include "pcm.h"
 #include "beep.h"
-#include <math.h>
+#include "synth.h"
+#include "convert.h"
+#include "command.h"
 
 #ifdef HAVE_SOUND
 
-#define SAMPLE_RATE 44100
+#define DEFAULT_SAMPLE_RATE 44100
 
-playable_pcm_buffer_t *
-generate_sine_beep (unsigned int volume, unsigned int frequency,
-                    unsigned int duration)
+unsigned int beep_sample_rate = DEFAULT_SAMPLE_RATE;
+
+bool
+probe_beep_sample_rate (void)
+{
+  pcm_data_info_t info;
+
+  info.native_endian    = true;
+  info.sign             = true;
+  info.floating         = false;
+  info.sample_rate      = DEFAULT_SAMPLE_RATE;
+  info.channels         = 1;
+  info.bytes_per_sample = 2;
+  info.bits_per_sample  = 16;
+  if (! probe_pcm_device (&info))
+    return false;
+
+  beep_sample_rate = info.sample_rate;
+  return true;
+}
+
+static playable_pcm_buffer_t *
+generate_beep (unsigned int waveform, unsigned int volume,
+               unsigned int frequency, unsigned int duration)
 {
   playable_pcm_buffer_t *buffer;
-  int16_t               *samples;
+  synth_osc_t            osc;
   uint32_t               samples_count;
-  unsigned int           period_counter;
-  unsigned int           period_length;
-  unsigned int           iter;
 
 
   buffer = malloc (sizeof (playable_pcm_buffer_t));
   if (buffer == NULL)
     {
-      fprintf (stderr, "%s: generate_sine_beep (): Memory allocation "
-                       "failed: %s.\n",
+      fprintf (stderr, "%s: generate_beep (): Memory allocation failed: %s.\n",
                progname, strerror (errno));
 
       return NULL;
@@ -54,185 +73,247 @@ generate_sine_beep (unsigned int volume, unsigned int frequency,
 
   buffer->info.native_endian     = true;
   buffer->info.sign              = true;
-  buffer->info.sample_rate       = SAMPLE_RATE;
+  buffer->info.floating          = false;
+  buffer->info.sample_rate       = beep_sample_rate;
   buffer->info.channels          = 1;
   buffer->info.bytes_per_sample  = 2;
   buffer->info.bits_per_sample   = 16;
 
-  samples_count = (SAMPLE_RATE * duration) / 1000;
+  samples_count = ((uint64_t) beep_sample_rate * duration) / 1000;
   buffer->data_len = samples_count * sizeof (int16_t);
 
+  buffer->map  = NULL;
   buffer->data = malloc (buffer->data_len);
   if (buffer->data == NULL)
     {
-      fprintf (stderr, "%s: generate_sine_beep (): Failed to allocate a buffer "
+      fprintf (stderr, "%s: generate_beep (): Failed to allocate a buffer "
                        "for the PCM data: %s.\n",
                progname, strerror (errno));
 
       free (buffer);
       return NULL;
     }
-  samples = (int16_t *)(buffer->data);
 
-  period_length  = SAMPLE_RATE / frequency;
-  period_counter = period_length;
-  for (iter = 0; iter < samples_count; iter++)
+  if (! synth_init_osc (&osc, waveform, frequency, beep_sample_rate,
+                       volume))
     {
-      if (period_counter == period_length)
-        period_counter = 0;
-      else
-        period_counter++;
-
-      samples[iter] = INT16_MAX
-                      * sin (2 * M_PI * period_counter / period_length)
-                      * (volume / 100.0);
+      free (buffer->data);
+      free (buffer);
+      return NULL;
     }
+  synth_render (&osc, (int16_t *)(buffer->data), samples_count);
 
+  track_pcm_buffer (buffer);
   return buffer;
 }
 
+playable_pcm_buffer_t *
+generate_sine_beep (unsigned int volume, unsigned int frequency,
+                    unsigned int duration)
+{
+  return generate_beep (SYNTH_WAVE_SINE, volume, frequency, duration);
+}
+
 /**
- * This is sin(x) + sin(3x)/sqrt(3) + ... + sin(9x)/sqrt(9).
+ * This is sin(x) + sin(3x)/3^1.5 + ... + sin(9x)/9^1.5.
  *
  * After a little experimentation, this seems to be a nice mellow beep with
  * neither the piercing quality of a pure sine wave nor the loud harshness
  * of a square wave.
  */
-static double
-complex_wave (double param)
+playable_pcm_buffer_t *
+generate_complex_beep (unsigned int volume, unsigned int frequency,
+                       unsigned int duration)
 {
-  return (sin (param)
-          + (sin (3 * param) * 0.192450089729875254836382926833)
-          + (sin (5 * param) * 0.089442719099991587856366946749)
-          + (sin (7 * param) * 0.053994924715603889602073790890)
-          + (sin (9 * param) * 0.037037037037037037037037037037));
+  return generate_beep (SYNTH_WAVE_COMPLEX, volume, frequency, duration);
 }
 
 playable_pcm_buffer_t *
-generate_complex_beep (unsigned int volume, unsigned int frequency,
-                       unsigned int duration)
+generate_square_beep (unsigned int volume, unsigned int frequency,
+                      unsigned int duration)
 {
-  playable_pcm_buffer_t *buffer;
-  int16_t               *samples;
-  uint32_t               samples_count;
-  unsigned int           period_counter;
-  unsigned int           period_length;
-  unsigned int           iter;
+  return generate_beep (SYNTH_WAVE_SQUARE, volume, frequency, duration);
+}
 
 
-  buffer = malloc (sizeof (playable_pcm_buffer_t));
-  if (buffer == NULL)
+/* The state of a beep which is synthesized while it's being played. */
+typedef struct beep_stream beep_stream_t;
+
+struct beep_stream
+{
+  synth_osc_t osc;
+  uint32_t    samples_count;
+  uint32_t    samples_left;
+};
+
+static size_t
+render_beep_stream (void *state, uint8_t *data, size_t len)
+{
+  beep_stream_t *beep = state;
+  uint32_t       count;
+
+  count = len / sizeof (int16_t);
+  if (count > beep->samples_left)
+    count = beep->samples_left;
+
+  synth_render (&(beep->osc), (int16_t *) data, count);
+  beep->samples_left -= count;
+
+  return count * sizeof (int16_t);
+}
+
+static void
+rewind_beep_stream (void *state)
+{
+  beep_stream_t *beep = state;
+
+  beep->osc.phase    = 0;
+  beep->samples_left = beep->samples_count;
+}
+
+playable_pcm_stream_t *
+prepare_beep_stream (unsigned int waveform, unsigned int volume,
+                     unsigned int frequency, unsigned int duration)
+{
+  playable_pcm_stream_t *stream;
+  beep_stream_t         *beep;
+
+
+  stream = malloc (sizeof (playable_pcm_stream_t));
+  beep   = malloc (sizeof (beep_stream_t));
+  if (stream == NULL || beep == NULL)
     {
-      fprintf (stderr, "%s: generate_complex_beep (): Memory allocation "
+      fprintf (stderr, "%s: prepare_beep_stream (): Memory allocation "
                        "failed: %s.\n",
                progname, strerror (errno));
 
+      free (stream);
+      free (beep);
       return NULL;
     }
 
-  buffer->info.native_endian     = true;
-  buffer->info.sign              = true;
-  buffer->info.sample_rate       = SAMPLE_RATE;
-  buffer->info.channels          = 1;
-  buffer->info.bytes_per_sample  = 2;
-  buffer->info.bits_per_sample   = 16;
-
-  samples_count = (SAMPLE_RATE * duration) / 1000;
-  buffer->data_len = samples_count * sizeof (int16_t);
-
-  buffer->data = malloc (buffer->data_len);
-  if (buffer->data == NULL)
+  if (! synth_init_osc (&(beep->osc), waveform, frequency, beep_sample_rate,
+                        volume))
     {
-      fprintf (stderr, "%s: generate_complex_beep (): Failed to allocate a "
-                       "buffer for the PCM data: %s.\n",
-               progname, strerror (errno));
-
-      free (buffer);
+      free (stream);
+      free (beep);
       return NULL;
     }
-  samples = (int16_t *)(buffer->data);
+  beep->samples_count = ((uint64_t) beep_sample_rate * duration) / 1000;
+  beep->samples_left  = beep->samples_count;
+
+  stream->render = render_beep_stream;
+  stream->rewind = rewind_beep_stream;
+  stream->state  = beep;
+
+  stream->info.native_endian     = true;
+  stream->info.sign              = true;
+  stream->info.floating          = false;
+  stream->info.sample_rate       = beep_sample_rate;
+  stream->info.channels          = 1;
+  stream->info.bytes_per_sample  = 2;
+  stream->info.bits_per_sample   = 16;
+
+  return stream;
+}
+
+
+/* Bounds of the cache of per-bell beeps. */
+#define BEEP_CACHE_ENTRIES  32
+#define BEEP_CACHE_BYTES    (4 * 1024 * 1024)
+
+/**
+ * XKB allows bells of up to 65 s; per-bell beeps are cut to 2 s, so that the
+ * cache stays bounded.
+ */
+#define MAX_BELL_DURATION   2000
+
+bool
+enable_per_bell_beeps (beep_descriptor_t *beep, unsigned int waveform,
+                       unsigned int volume, unsigned int frequency,
+                       unsigned int duration,
+                       bool (*in_use) (playable_pcm_buffer_t *))
+{
+  beep->cache = create_beep_cache (BEEP_CACHE_ENTRIES, BEEP_CACHE_BYTES,
+                                   in_use);
+  if (beep->cache == NULL)
+    return false;
+
+  beep->requested.waveform  = waveform;
+  beep->requested.frequency = frequency;
+  beep->requested.duration  = duration;
+  beep->requested.volume    = volume;
+  beep->uncached            = NULL;
+
+  return true;
+}
 
-  period_length  = SAMPLE_RATE / frequency;
-  period_counter = period_length;
-  for (iter = 0; iter < samples_count; iter++)
+/**
+ * Keeps a beep which couldn't be cached, in place of the previous one.  If
+ * that one is still being played, the new one is dropped, and the beep's own
+ * sound is played instead, so that at most one uncached beep is in memory.
+ */
+static playable_pcm_buffer_t *
+keep_uncached_beep (beep_descriptor_t *beep, playable_pcm_buffer_t *buffer)
+{
+  if (beep->uncached != NULL)
     {
-      if (period_counter == period_length)
-        period_counter = 0;
-      else
-        period_counter++;
-
-      samples[iter] = INT16_MAX
-                      * complex_wave (2 * M_PI * period_counter / period_length)
-                      * (volume / 100.0);
+      if (beep->cache->in_use != NULL
+          && beep->cache->in_use (beep->uncached))
+        {
+          free_pcm_buffer (buffer);
+          return beep->buffer;
+        }
+
+      free_pcm_buffer (beep->uncached);
     }
 
+  beep->uncached = buffer;
   return buffer;
 }
 
 playable_pcm_buffer_t *
-generate_square_beep (unsigned int volume, unsigned int frequency,
-                      unsigned int duration)
+beep_sound_for_bell (beep_descriptor_t *beep, unsigned int frequency,
+                     unsigned int duration, unsigned int volume)
 {
   playable_pcm_buffer_t *buffer;
-  uint8_t               *samples;
-  uint32_t               samples_count;
-  uint8_t                current_sample;
-  unsigned int           halfperiod_counter;
-  unsigned int           halfperiod_length;
-  unsigned int           iter;
+  beep_cache_key_t       key;
 
 
-  buffer = malloc (sizeof (playable_pcm_buffer_t));
-  if (buffer == NULL)
-    {
-      fprintf (stderr, "%s: generate_square_beep (): Memory allocation "
-                       "failed: %s.\n",
-               progname, strerror (errno));
+  if (beep->cache == NULL)
+    return beep->buffer;
 
-      return NULL;
-    }
+  key = beep->requested;
+  if (frequency > 0)
+    key.frequency = (frequency < beep_sample_rate / 2)
+                    ? frequency : beep_sample_rate / 2 - 1;
+  if (duration > 0)
+    key.duration = (duration < MAX_BELL_DURATION) ? duration
+                                                  : MAX_BELL_DURATION;
+  if (volume > 0)
+    key.volume = (volume < 100) ? volume : 100;
 
-  buffer->info.native_endian     = true;
-  buffer->info.sign              = false;
-  buffer->info.sample_rate       = SAMPLE_RATE;
-  buffer->info.channels          = 1;
-  buffer->info.bytes_per_sample  = 1;
-  buffer->info.bits_per_sample   = 8;
+  if (memcmp (&key, &(beep->requested), sizeof (beep_cache_key_t)) == 0)
+    return beep->buffer;
 
-  samples_count = (SAMPLE_RATE * duration) / 1000;
-  buffer->data_len =  samples_count * sizeof (uint8_t);
+  buffer = lookup_cached_beep (beep->cache, &key);
+  if (buffer != NULL)
+    return buffer;
 
-  buffer->data = malloc (buffer->data_len);
-  if (buffer->data == NULL)
-    {
-      fprintf (stderr, "%s: generate_square_beep (): Failed to allocate a "
-                       "buffer for the PCM data: %s.\n",
-               progname, strerror (errno));
+  buffer = generate_beep (key.waveform, key.volume, key.frequency,
+                          key.duration);
+  if (buffer == NULL)
+    return NULL;
 
-      free (buffer);
+  /* Match the format of the main beep, to keep the device configured. */
+  if (! convert_pcm_buffer (buffer, &(beep->buffer->info)))
+    {
+      free_pcm_buffer (buffer);
       return NULL;
     }
-  samples = (uint8_t *)(buffer->data);
 
-  current_sample     = 0;
-  halfperiod_counter = 0;
-  halfperiod_length  = (SAMPLE_RATE / frequency) / 2;
-  for (iter = 0; iter < samples_count; iter++)
-    {
-      if (halfperiod_counter == 0)
-        {
-          if (current_sample == 0)
-            current_sample = 0xff;
-          else
-            current_sample = 0;
-
-          halfperiod_counter = halfperiod_length;
-        }
-      else
-        halfperiod_counter--;
-
-      samples[iter] = current_sample * (volume / 100.0);
-    }
+  if (! insert_cached_beep (beep->cache, &key, buffer))
+    return keep_uncached_beep (beep, buffer);
 
   return buffer;
 }
@@ -243,6 +324,8 @@ generate_square_beep (unsigned int volume, unsigned int frequency,
 bool
 perform_beep (beep_descriptor_t *beep)
 {
+  bell_event_t bell;
+
   switch (beep->type)
     {
 #ifdef HAVE_SOUND
@@ -253,10 +336,20 @@ perform_beep (beep_descriptor_t *beep)
       case BEEP_TYPE_FILE:
         return play_pcm_file (beep->file);
         break;
+
+      case BEEP_TYPE_STREAM:
+        return play_pcm_stream (beep->stream);
+        break;
 #endif
       case BEEP_TYPE_COMMAND:
-        system (beep->command);
-        return true;
+        return run_bell_command (beep->argv);
+        break;
+
+      case BEEP_TYPE_COPROCESS:
+        /* A bell without any parameters. */
+        memset (&bell, 0, sizeof (bell));
+        clock_gettime (CLOCK_MONOTONIC, &(bell.received));
+        return send_coprocess_bell (beep->coprocess, &bell);
         break;
 
       default:
@@ -268,6 +361,67 @@ perform_beep (beep_descriptor_t *beep)
     }
 }
 
+bool
+perform_bell (beep_descriptor_t *beep, const bell_event_t *bell)
+{
+#ifdef HAVE_SOUND
+  playable_pcm_buffer_t *buffer;
+#endif
+
+  if (beep->type == BEEP_TYPE_COPROCESS)
+    return send_coprocess_bell (beep->coprocess, bell);
+
+#ifdef HAVE_SOUND
+  if (beep->type == BEEP_TYPE_BUFFER && beep->cache != NULL)
+    {
+      buffer = beep_sound_for_bell (beep, bell->pitch, bell->duration,
+                                    bell->percent);
+      if (buffer == NULL)
+        return false;
+
+      return play_pcm_buffer (buffer);
+    }
+#endif
+
+  return perform_beep (beep);
+}
+
+bool
+open_beep_device (beep_descriptor_t *beep)
+{
+  switch (beep->type)
+    {
+#ifdef HAVE_SOUND
+      case BEEP_TYPE_BUFFER:
+        set_pcm_device_persistent (true);
+        return open_pcm_device (&(beep->buffer->info));
+        break;
+
+      case BEEP_TYPE_FILE:
+        set_pcm_device_persistent (true);
+        return open_pcm_device (&(beep->file->info));
+        break;
+
+      case BEEP_TYPE_STREAM:
+        set_pcm_device_persistent (true);
+        return open_pcm_device (&(beep->stream->info));
+        break;
+#endif
+      default:
+        return false;
+        break;
+    }
+}
+
+void
+close_beep_device (beep_descriptor_t *beep)
+{
+#ifdef HAVE_SOUND
+  if (beep->type != BEEP_TYPE_COMMAND && beep->type != BEEP_TYPE_COPROCESS)
+    close_pcm_device ();
+#endif
+}
+
 void
 free_beep_desc (beep_descriptor_t *beep)
 {
@@ -280,16 +434,31 @@ free_beep_desc (beep_descriptor_t *beep)
       case BEEP_TYPE_BUFFER:
         if (beep->buffer != NULL)
           free_pcm_buffer (beep->buffer);
+        if (beep->cache != NULL && beep->uncached != NULL)
+          free_pcm_buffer (beep->uncached);
+        free_beep_cache (beep->cache);
         break;
 
       case BEEP_TYPE_FILE:
         if (beep->file != NULL)
           close_pcm_file (beep->file);
         break;
+
+      case BEEP_TYPE_STREAM:
+        if (beep->stream != NULL)
+          free_pcm_stream (beep->stream);
+        break;
 #endif
       case BEEP_TYPE_COMMAND:
         if (beep->command != NULL)
           free (beep->command);
+        free (beep->argv);
+        break;
+
+      case BEEP_TYPE_COPROCESS:
+        stop_coprocess (beep->coprocess);
+        free (beep->command);
+        free (beep->argv);
         break;
     }
 
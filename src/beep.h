@@ -26,6 +26,9 @@
 
 #include "common.h"
 #include "pcm.h"
+#include "cache.h"
+#include "queue.h"
+#include "coprocess.h"
 
 
 /* Beep descriptor. */
@@ -39,20 +42,43 @@ struct beep_descriptor
 
   playable_pcm_buffer_t *buffer;
   playable_pcm_file_t   *file;
+  playable_pcm_stream_t *stream;
+
+  /**
+   * Set when generated beeps are played with the parameters requested for
+   * each bell; `requested' holds those of `buffer'.
+   */
+  beep_cache_t          *cache;
+  beep_cache_key_t       requested;
+
+  /* The last beep which didn't fit into the cache, kept while it plays. */
+  playable_pcm_buffer_t *uncached;
 
 #endif
 
   char                  *command;
+  char                 **argv;      /* `command' split into its arguments. */
+  coprocess_t           *coprocess;
 };
 enum
 {
   BEEP_TYPE_BUFFER,
   BEEP_TYPE_FILE,
-  BEEP_TYPE_COMMAND
+  BEEP_TYPE_STREAM,
+  BEEP_TYPE_COMMAND,
+  BEEP_TYPE_COPROCESS
 };
 
 #ifdef HAVE_SOUND
 
+/**
+ * The sampling rate beeps are generated at.  probe_beep_sample_rate () sets
+ * it to the playback device's native rate, so that they need no resampling.
+ */
+extern unsigned int beep_sample_rate;
+
+bool probe_beep_sample_rate (void);
+
 playable_pcm_buffer_t *generate_sine_beep (unsigned int volume,
                                            unsigned int frequency,
                                            unsigned int duration);
@@ -65,11 +91,57 @@ playable_pcm_buffer_t *generate_square_beep (unsigned int volume,
                                              unsigned int frequency,
                                              unsigned int duration);
 
+/**
+ * Prepares a beep of one of the SYNTH_WAVE_* waveforms which is synthesized
+ * while it's being played, so only the synthesizer state is kept in memory.
+ */
+playable_pcm_stream_t *prepare_beep_stream (unsigned int waveform,
+                                            unsigned int volume,
+                                            unsigned int frequency,
+                                            unsigned int duration);
+
 #endif /* HAVE_SOUND */
 
 
 bool perform_beep   (beep_descriptor_t *beep);
 void free_beep_desc (beep_descriptor_t *beep);
 
+#ifdef HAVE_SOUND
+
+/**
+ * Makes a generated beep follow the pitch, duration and volume requested
+ * for each bell.  The beeps are generated in the format of `beep->buffer',
+ * which has to be a beep of the given parameters, and are kept in a cache;
+ * `in_use' tells the cache which of them it can't evict yet.
+ */
+bool enable_per_bell_beeps (beep_descriptor_t *beep, unsigned int waveform,
+                            unsigned int volume, unsigned int frequency,
+                            unsigned int duration,
+                            bool (*in_use) (playable_pcm_buffer_t *));
+
+/**
+ * Returns the sound to play for a bell with the given parameters, where
+ * 0 selects the beep's own.  Without per-bell beeps, that's `beep->buffer'.
+ */
+playable_pcm_buffer_t *beep_sound_for_bell (beep_descriptor_t *beep,
+                                            unsigned int frequency,
+                                            unsigned int duration,
+                                            unsigned int volume);
+
+#endif /* HAVE_SOUND */
+
+/**
+ * Performs the beep for a bell, with the parameters requested for it if
+ * enabled, or hands the bell over to the bell handler.
+ */
+bool perform_bell (beep_descriptor_t *beep, const bell_event_t *bell);
+
+/**
+ * Opens the playback device ahead of the first bell, and keeps it open
+ * between bells until close_beep_device () is called.
+ */
+bool open_beep_device  (beep_descriptor_t *beep);
+void close_beep_device (beep_descriptor_t *beep);
+
 
 #endif /* _NXBELLD_BEEP_H_ */
@@ -0,0 +1,476 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The end-to-end benchmark driver, run by `make bench', in the top directory
+ * or in src/, on a virtual X server.
+ * It starts nxbelld with the given options and a metrics socket, rings the
+ * bell at the requested rate and in bursts of the requested size through
+ * XkbBell (), and reports:
+ *
+ *  - the latency from the bell request to the X server's bell notification,
+ *    as received by the driver itself, alongside nxbelld,
+ *  - nxbelld's own latency from receiving the bell to its first sample being
+ *    written to the playback device, and to the bell being drained,
+ *  - how many bells were played, throttled, dropped or failed,
+ *  - the CPU time nxbelld used.
+ */
+
+#include "common.h"
+
+#include <argp.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+
+extern char **environ;
+
+const char *progname                 = "bell-bench";
+const char *argp_program_version     = "bell-bench (" PACKAGE_STRING ")";
+const char *argp_program_bug_address = PACKAGE_BUGREPORT;
+
+/* How long nxbelld gets to start up, in ms. */
+#define BENCH_STARTUP_TIMEOUT  5000
+
+static char doc[] = "Rings the bell of the X display with nxbelld running on "
+                    "it, and reports how nxbelld kept up.\v"
+                    "The options after -- are passed to nxbelld.";
+
+static char args_doc[] = "[-- NXBELLD-OPTION...]";
+
+static struct argp_option options[] =
+{
+  {"nxbelld", 'N', "PATH",  0, "the nxbelld binary to run (default: nxbelld)" },
+  {"bells",   'n', "N",     0, "number of bells to ring (default: 1000)" },
+  {"rate",    'r', "N",     0, "bells per second (default: 100)" },
+  {"burst",   'B', "N",     0, "bells rung back to back at a time "
+                               "(default: 1)" },
+  {"settle",  'w', "MS",    0, "how long to wait for the last bells to be "
+                               "played (default: 2000)" },
+  { 0 }
+};
+
+struct bench_args
+{
+  const char   *nxbelld;
+  unsigned int  bells;
+  unsigned int  rate;
+  unsigned int  burst;
+  unsigned int  settle;
+  char        **daemon_args;
+  int           daemon_argc;
+};
+typedef struct bench_args bench_args_t;
+
+static error_t
+parse_option (int key, char *arg, struct argp_state *state)
+{
+  bench_args_t *args = state->input;
+  unsigned int *value;
+  char         *arg_endptr;
+
+  switch (key)
+    {
+      case 'N':
+        args->nxbelld = arg;
+        return 0;
+      case 'n':
+        value = &(args->bells);
+        break;
+      case 'r':
+        value = &(args->rate);
+        break;
+      case 'B':
+        value = &(args->burst);
+        break;
+      case 'w':
+        value = &(args->settle);
+        break;
+      case ARGP_KEY_ARGS:
+        args->daemon_args = state->argv + state->next;
+        args->daemon_argc = state->argc - state->next;
+        return 0;
+
+      default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+  *value = strtoul (arg, &arg_endptr, 10);
+  if (arg_endptr == NULL || arg_endptr[0] != '\0' || *value == 0)
+    argp_error (state, "The -%c option expects a positive integer argument.",
+                key);
+
+  return 0;
+}
+
+static struct argp argp = { options, parse_option, args_doc, doc };
+
+
+static int64_t
+monotonic_us (void)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int
+compare_latencies (const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *) a;
+  int64_t y = *(const int64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Fetches a dump of nxbelld's metrics, or returns NULL. */
+static char *
+fetch_metrics (const char *path)
+{
+  struct sockaddr_un address;
+  char              *text;
+  char              *larger;
+  size_t             len;
+  size_t             size;
+  ssize_t            got;
+  int                fd;
+
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strncpy (address.sun_path, path, sizeof (address.sun_path) - 1);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return NULL;
+  if (connect (fd, (struct sockaddr *) &address, sizeof (address)) == -1)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  len  = 0;
+  size = 4096;
+  text = malloc (size);
+  while (text != NULL)
+    {
+      got = read (fd, text + len, size - len - 1);
+      if (got <= 0)
+        break;
+
+      len += got;
+      if (size - len == 1)
+        {
+          size  *= 2;
+          larger = realloc (text, size);
+          if (larger == NULL)
+            break;
+          text = larger;
+        }
+    }
+  close (fd);
+
+  if (text != NULL)
+    text[len] = '\0';
+  return text;
+}
+
+/* The value of the named metric, labels included, or -1 if it's missing. */
+static double
+metric (const char *text, const char *name)
+{
+  const char *line;
+  size_t      len;
+
+  len  = strlen (name);
+  line = text;
+  while (line != NULL)
+    {
+      if (strncmp (line, name, len) == 0 && line[len] == ' ')
+        return strtod (line + len + 1, NULL);
+
+      line = strchr (line, '\n');
+      if (line != NULL)
+        line++;
+    }
+
+  return -1;
+}
+
+static void
+report_latencies (const char *what, const char *text, const char *name)
+{
+  char   key[128];
+  double p50;
+  double p99;
+  double max;
+
+  snprintf (key, sizeof (key), "%s{quantile=\"0.5\"}", name);
+  p50 = metric (text, key);
+  snprintf (key, sizeof (key), "%s{quantile=\"0.99\"}", name);
+  p99 = metric (text, key);
+  snprintf (key, sizeof (key), "%s{quantile=\"1\"}", name);
+  max = metric (text, key);
+
+  printf ("%-34s p50 %9.3f ms   p99 %9.3f ms   max %9.3f ms\n",
+          what, p50 * 1000, p99 * 1000, max * 1000);
+}
+
+/* Reads the bell notifications which arrived, matching them to the bells. */
+static void
+read_notifications (Display *display, int xkb_event, const int64_t *sent,
+                    int64_t *latencies, unsigned int *notified,
+                    unsigned int rung)
+{
+  XEvent    event;
+  XkbEvent *xkb;
+
+  while (XPending (display) > 0)
+    {
+      XNextEvent (display, &event);
+      xkb = (XkbEvent *) &event;
+      if (event.type != xkb_event || xkb->any.xkb_type != XkbBellNotify)
+        continue;
+
+      /* Notifications come in the order the bells were rung. */
+      if (*notified < rung)
+        {
+          latencies[*notified] = monotonic_us () - sent[*notified];
+          (*notified)++;
+        }
+    }
+}
+
+/* Waits until `deadline', reading the notifications meanwhile. */
+static void
+wait_for (Display *display, int xkb_event, int64_t deadline,
+          const int64_t *sent, int64_t *latencies, unsigned int *notified,
+          unsigned int rung)
+{
+  struct pollfd descriptor;
+  int64_t       now;
+
+  descriptor.fd     = ConnectionNumber (display);
+  descriptor.events = POLLIN;
+  for (;;)
+    {
+      read_notifications (display, xkb_event, sent, latencies, notified,
+                          rung);
+
+      now = monotonic_us ();
+      if (now >= deadline)
+        break;
+      poll (&descriptor, 1, (deadline - now + 999) / 1000);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  bench_args_t   args;
+  char           socket_path[64];
+  char           socket_option[96];
+  char         **daemon_argv;
+  char          *text;
+  pid_t          daemon;
+  int            status;
+  Display       *display;
+  int            xkb_event;
+  int            reason;
+  int            major;
+  int            minor;
+  int64_t       *sent;
+  int64_t       *latencies;
+  int64_t        start;
+  int64_t        next;
+  int64_t        deadline;
+  unsigned int   rung;
+  unsigned int   notified;
+  unsigned int   iter;
+  double         accounted;
+  struct rusage  usage;
+  double         cpu_user;
+  double         cpu_system;
+
+  args.nxbelld     = "nxbelld";
+  args.bells       = 1000;
+  args.rate        = 100;
+  args.burst       = 1;
+  args.settle      = 2000;
+  args.daemon_args = NULL;
+  args.daemon_argc = 0;
+  argp_parse (&argp, argc, argv, 0, 0, &args);
+
+  sent      = malloc (args.bells * sizeof (int64_t));
+  latencies = malloc (args.bells * sizeof (int64_t));
+  daemon_argv = malloc ((args.daemon_argc + 3) * sizeof (char *));
+  if (sent == NULL || latencies == NULL || daemon_argv == NULL)
+    {
+      fprintf (stderr, "%s: Memory allocation failed: %s.\n",
+               progname, strerror (errno));
+      return 1;
+    }
+
+  major = XkbMajorVersion;
+  minor = XkbMinorVersion;
+  display = XkbOpenDisplay (NULL, &xkb_event, NULL, &major, &minor, &reason);
+  if (display == NULL)
+    {
+      fprintf (stderr, "%s: Failed to open the display with XKB (reason %d).\n",
+               progname, reason);
+      return 1;
+    }
+  XkbSelectEvents (display, XkbUseCoreKbd, XkbBellNotifyMask,
+                   XkbBellNotifyMask);
+  XSync (display, False);
+
+  /* Start nxbelld, serving its metrics to us. */
+  snprintf (socket_path, sizeof (socket_path), "/tmp/bell-bench-%ld.sock",
+            (long) getpid ());
+  daemon_argv[0] = (char *) args.nxbelld;
+  for (iter = 0; iter < (unsigned int) args.daemon_argc; iter++)
+    daemon_argv[iter + 1] = args.daemon_args[iter];
+  snprintf (socket_option, sizeof (socket_option), "--metrics-socket=%s",
+            socket_path);
+  daemon_argv[iter + 1] = socket_option;
+  daemon_argv[iter + 2] = NULL;
+
+  status = posix_spawnp (&daemon, args.nxbelld, NULL, NULL, daemon_argv,
+                         environ);
+  if (status != 0)
+    {
+      fprintf (stderr, "%s: Failed to start `%s': %s.\n",
+               progname, args.nxbelld, strerror (status));
+      return 1;
+    }
+
+  deadline = monotonic_us () + BENCH_STARTUP_TIMEOUT * 1000;
+  while ((text = fetch_metrics (socket_path)) == NULL)
+    {
+      if (waitpid (daemon, &status, WNOHANG) == daemon
+          || monotonic_us () > deadline)
+        {
+          fprintf (stderr, "%s: nxbelld didn't start up.\n", progname);
+          return 1;
+        }
+      usleep (10000);
+    }
+  free (text);
+
+  printf ("Ringing %u bells at %u per second, in bursts of %u.\n",
+          args.bells, args.rate, args.burst);
+
+  /* Ring the bells, one burst every `burst / rate' seconds. */
+  rung     = 0;
+  notified = 0;
+  start    = monotonic_us ();
+  while (rung < args.bells)
+    {
+      for (iter = 0; iter < args.burst && rung < args.bells; iter++)
+        {
+          sent[rung++] = monotonic_us ();
+          XkbBell (display, None, 0, None);
+        }
+      XFlush (display);
+
+      next = start + (int64_t) rung * 1000000 / args.rate;
+      wait_for (display, xkb_event, next, sent, latencies, &notified, rung);
+    }
+
+  /* Give nxbelld time to play the rest. */
+  deadline = monotonic_us () + (int64_t) args.settle * 1000;
+  for (;;)
+    {
+      wait_for (display, xkb_event, monotonic_us () + 50000, sent, latencies,
+                &notified, rung);
+
+      text = fetch_metrics (socket_path);
+      if (text == NULL)
+        break;
+
+      accounted = metric (text, "nxbelld_bells_played_total")
+                  + metric (text, "nxbelld_bells_failed_total")
+                  + metric (text, "nxbelld_bells_throttled_total")
+                  + metric (text, "nxbelld_queue_bells_total{outcome=\"dropped_newest\"}")
+                  + metric (text, "nxbelld_queue_bells_total{outcome=\"dropped_oldest\"}")
+                  + metric (text, "nxbelld_queue_bells_total{outcome=\"coalesced\"}");
+      if (accounted >= rung || monotonic_us () > deadline)
+        break;
+      free (text);
+    }
+
+  kill (daemon, SIGTERM);
+  waitpid (daemon, &status, 0);
+  getrusage (RUSAGE_CHILDREN, &usage);
+  cpu_user   = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  cpu_system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+  if (text == NULL)
+    {
+      fprintf (stderr, "%s: Lost the connection to nxbelld.\n", progname);
+      return 1;
+    }
+
+  printf ("\n%-34s %u\n", "bells rung:", rung);
+  printf ("%-34s %.0f\n", "bells received:",
+          metric (text, "nxbelld_bells_received_total"));
+  printf ("%-34s %.0f\n", "bells played:",
+          metric (text, "nxbelld_bells_played_total"));
+  printf ("%-34s %.0f\n", "bells throttled:",
+          metric (text, "nxbelld_bells_throttled_total"));
+  printf ("%-34s %.0f\n", "bells dropped by the queue:",
+          metric (text, "nxbelld_queue_bells_total{outcome=\"dropped_newest\"}")
+          + metric (text, "nxbelld_queue_bells_total{outcome=\"dropped_oldest\"}"));
+  printf ("%-34s %.0f\n", "bells coalesced by the queue:",
+          metric (text, "nxbelld_queue_bells_total{outcome=\"coalesced\"}"));
+  printf ("%-34s %.0f\n\n", "bells failed:",
+          metric (text, "nxbelld_bells_failed_total"));
+
+  if (notified > 0)
+    {
+      qsort (latencies, notified, sizeof (int64_t), compare_latencies);
+      printf ("%-34s p50 %9.3f ms   p99 %9.3f ms   max %9.3f ms\n",
+              "request to X notification:",
+              latencies[(notified - 1) / 2] / 1000.0,
+              latencies[(notified * 99 + 99) / 100 - 1] / 1000.0,
+              latencies[notified - 1] / 1000.0);
+    }
+  report_latencies ("received to first sample:", text,
+                    "nxbelld_first_sample_latency_seconds");
+  report_latencies ("received to drained:", text,
+                    "nxbelld_drain_latency_seconds");
+
+  printf ("\n%-34s %.3f s user, %.3f s system, %.1f us per bell\n",
+          "nxbelld CPU time:", cpu_user, cpu_system,
+          (cpu_user + cpu_system) * 1e6 / rung);
+
+  free (text);
+  XCloseDisplay (display);
+  return 0;
+}
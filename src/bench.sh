@@ -0,0 +1,45 @@
+#! /bin/sh
+#
+# bench.sh - runs the bell-bench driver against nxbelld on a private Xvfb.
+#
+# Usage: bench.sh NXBELLD BELL-BENCH [BELL-BENCH-OPTION...] [-- NXBELLD-OPTION...]
+#
+# Exits with 77 when Xvfb is not available, like a skipped test.
+
+XVFB=${XVFB:-Xvfb}
+
+if test $# -lt 2; then
+  echo "Usage: $0 NXBELLD BELL-BENCH [OPTION...] [-- NXBELLD-OPTION...]" >&2
+  exit 2
+fi
+nxbelld=$1
+driver=$2
+shift 2
+
+if ! command -v "$XVFB" >/dev/null 2>&1; then
+  echo "$0: $XVFB was not found, not running the benchmark." >&2
+  exit 77
+fi
+
+# Find a display number nobody uses.
+display=99
+while test -e /tmp/.X11-unix/X$display || test -e /tmp/.X$display-lock; do
+  display=`expr $display + 1`
+done
+
+"$XVFB" :$display -nolisten tcp +extension XKEYBOARD >/dev/null 2>&1 &
+xvfb_pid=$!
+trap 'kill $xvfb_pid 2>/dev/null; wait $xvfb_pid 2>/dev/null' 0
+trap 'exit 1' 1 2 15
+
+tries=0
+while ! test -e /tmp/.X11-unix/X$display; do
+  tries=`expr $tries + 1`
+  if test $tries -gt 50 || ! kill -0 $xvfb_pid 2>/dev/null; then
+    echo "$0: $XVFB did not start on :$display." >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+DISPLAY=:$display "$driver" --nxbelld="$nxbelld" "$@"
@@ -0,0 +1,222 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+#include "cache.h"
+#include "metrics.h"
+
+struct beep_cache_entry
+{
+  beep_cache_key_t       key;
+  playable_pcm_buffer_t *buffer;
+
+  beep_cache_entry_t    *hash_next;
+  beep_cache_entry_t    *lru_prev;
+  beep_cache_entry_t    *lru_next;
+};
+
+
+static unsigned int
+hash_key (beep_cache_key_t *key)
+{
+  uint32_t hash;
+
+  /* FNV-1a over the fields. */
+  hash = 2166136261U;
+  hash = (hash ^ key->waveform)  * 16777619U;
+  hash = (hash ^ key->frequency) * 16777619U;
+  hash = (hash ^ key->duration)  * 16777619U;
+  hash = (hash ^ key->volume)    * 16777619U;
+
+  return (hash ^ (hash >> 16)) & (BEEP_CACHE_BUCKETS - 1);
+}
+
+static bool
+same_key (beep_cache_key_t *a, beep_cache_key_t *b)
+{
+  return (a->waveform     == b->waveform
+          && a->frequency == b->frequency
+          && a->duration  == b->duration
+          && a->volume    == b->volume);
+}
+
+static void
+lru_unlink (beep_cache_t *cache, beep_cache_entry_t *entry)
+{
+  if (entry->lru_prev != NULL)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    cache->lru_head = entry->lru_next;
+
+  if (entry->lru_next != NULL)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    cache->lru_tail = entry->lru_prev;
+}
+
+static void
+lru_push_front (beep_cache_t *cache, beep_cache_entry_t *entry)
+{
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head != NULL)
+    cache->lru_head->lru_prev = entry;
+  else
+    cache->lru_tail = entry;
+
+  cache->lru_head = entry;
+}
+
+static void
+remove_entry (beep_cache_t *cache, beep_cache_entry_t *entry)
+{
+  beep_cache_entry_t **link;
+
+  link = &(cache->buckets[hash_key (&(entry->key))]);
+  while (*link != entry)
+    link = &((*link)->hash_next);
+  *link = entry->hash_next;
+
+  lru_unlink (cache, entry);
+
+  cache->entries--;
+  cache->bytes -= entry->buffer->data_len;
+
+  free_pcm_buffer (entry->buffer);
+  free (entry);
+}
+
+
+beep_cache_t *
+create_beep_cache (unsigned int max_entries, size_t max_bytes,
+                   bool (*in_use) (playable_pcm_buffer_t *))
+{
+  beep_cache_t *cache;
+
+  cache = calloc (1, sizeof (beep_cache_t));
+  if (cache == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the beep cache: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+
+  cache->max_entries = max_entries;
+  cache->max_bytes   = max_bytes;
+  cache->in_use      = in_use;
+
+  return cache;
+}
+
+void
+free_beep_cache (beep_cache_t *cache)
+{
+  if (cache == NULL)
+    return;
+
+  while (cache->lru_head != NULL)
+    remove_entry (cache, cache->lru_head);
+
+  free (cache);
+}
+
+playable_pcm_buffer_t *
+lookup_cached_beep (beep_cache_t *cache, beep_cache_key_t *key)
+{
+  beep_cache_entry_t *entry;
+
+  for (entry = cache->buckets[hash_key (key)]; entry != NULL;
+       entry = entry->hash_next)
+    {
+      if (same_key (&(entry->key), key))
+        {
+          lru_unlink (cache, entry);
+          lru_push_front (cache, entry);
+
+          count_metric (METRIC_CACHE_HITS);
+          return entry->buffer;
+        }
+    }
+
+  count_metric (METRIC_CACHE_MISSES);
+  return NULL;
+}
+
+bool
+insert_cached_beep (beep_cache_t *cache, beep_cache_key_t *key,
+                    playable_pcm_buffer_t *buffer)
+{
+  beep_cache_entry_t *entry;
+  beep_cache_entry_t *victim;
+  beep_cache_entry_t *previous;
+  unsigned int        bucket;
+
+  if (buffer->data_len > cache->max_bytes || cache->max_entries == 0)
+    return false;
+
+  /* Make room, starting with the least recently used beeps. */
+  victim = cache->lru_tail;
+  while (victim != NULL
+         && (cache->entries + 1 > cache->max_entries
+             || cache->bytes + buffer->data_len > cache->max_bytes))
+    {
+      previous = victim->lru_prev;
+      if (cache->in_use == NULL || ! cache->in_use (victim->buffer))
+        {
+          remove_entry (cache, victim);
+          count_metric (METRIC_CACHE_EVICTIONS);
+        }
+      victim = previous;
+    }
+
+  /* The rest are still being played. */
+  if (cache->entries + 1 > cache->max_entries
+      || cache->bytes + buffer->data_len > cache->max_bytes)
+    return false;
+
+  entry = malloc (sizeof (beep_cache_entry_t));
+  if (entry == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate a beep cache entry: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+
+  entry->key    = *key;
+  entry->buffer = buffer;
+
+  bucket = hash_key (key);
+  entry->hash_next       = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
+  lru_push_front (cache, entry);
+
+  cache->entries++;
+  cache->bytes += buffer->data_len;
+
+  return true;
+}
+
+#endif /* HAVE_SOUND */
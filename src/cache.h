@@ -0,0 +1,88 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_CACHE_H_
+#define _NXBELLD_CACHE_H_ 1
+
+#include "common.h"
+
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+
+/**
+ * A bounded cache of generated beeps, keyed by their synthesis parameters.
+ * Lookups go through a hash table, and when the cache is full, the least
+ * recently used beeps are evicted to make room for a new one.
+ *
+ * Beeps for which `in_use' returns true are never evicted.  A beep which
+ * doesn't fit without evicting one of those, or at all, isn't cached, so the
+ * limits always hold.
+ *
+ * The cache isn't thread-safe, it belongs to the playback thread.
+ */
+typedef struct beep_cache       beep_cache_t;
+typedef struct beep_cache_key   beep_cache_key_t;
+typedef struct beep_cache_entry beep_cache_entry_t;
+
+struct beep_cache_key
+{
+  unsigned int waveform;
+  unsigned int frequency;
+  unsigned int duration;
+  unsigned int volume;
+};
+
+#define BEEP_CACHE_BUCKETS 64
+
+struct beep_cache
+{
+  beep_cache_entry_t *buckets[BEEP_CACHE_BUCKETS];
+
+  /* Most recently used first. */
+  beep_cache_entry_t *lru_head;
+  beep_cache_entry_t *lru_tail;
+
+  unsigned int        entries;
+  unsigned int        max_entries;
+  size_t              bytes;
+  size_t              max_bytes;
+
+  bool              (*in_use) (playable_pcm_buffer_t *buffer);
+};
+
+beep_cache_t *create_beep_cache (unsigned int max_entries, size_t max_bytes,
+                                 bool (*in_use) (playable_pcm_buffer_t *));
+void          free_beep_cache   (beep_cache_t *cache);
+
+/* Returns the cached beep, marking it as the most recently used, or NULL. */
+playable_pcm_buffer_t *lookup_cached_beep (beep_cache_t *cache,
+                                           beep_cache_key_t *key);
+
+/**
+ * Adds a beep which isn't cached yet; the cache takes ownership of it.  Fails
+ * if there's no room for it, leaving it to the caller.
+ */
+bool insert_cached_beep (beep_cache_t *cache, beep_cache_key_t *key,
+                         playable_pcm_buffer_t *buffer);
+
+#endif /* HAVE_SOUND */
+#endif /* _NXBELLD_CACHE_H_ */
@@ -0,0 +1,229 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_CAPTURE
+
+#include "pcm.h"
+#include "metrics.h"
+#include "simdevice.h"
+
+/**
+ * The capture backend plays to the simulated device, and writes everything
+ * played to the file named by pcm_device_name, so that the output can be
+ * checked, and its timing measured, without sound hardware.
+ *
+ * The file is a sequence of records, each a line of text; times are the
+ * CLOCK_MONOTONIC seconds at which things happened, or are to be heard:
+ *
+ *   open TIME rate=R channels=C bytes=B bits=b (signed|unsigned) (le|be)
+ *   bell TIME             - a bell received at TIME starts playing,
+ *   pcm TIME LENGTH       - followed by LENGTH bytes of PCM data to be
+ *                           heard from TIME on, and a newline,
+ *   drain TIME            - everything written has been played,
+ *   close TIME
+ *
+ * Bells mixed together by --mix are captured as the mix, without bell
+ * records.
+ */
+
+static FILE             *capture = NULL;
+
+/* Whether the device is open, and the format it's configured for. */
+static bool              device_open = false;
+static pcm_data_info_t   device_info;
+
+/* The reception time of the last bell recorded. */
+static struct timespec   last_bell;
+
+static void close_capture_device (void);
+
+static void
+write_record (const char *type, const struct timespec *time)
+{
+  struct timespec now;
+
+  if (time == NULL)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      time = &now;
+    }
+
+  fprintf (capture, "%s %lld.%06ld", type, (long long) time->tv_sec,
+           time->tv_nsec / 1000);
+}
+
+static bool
+open_capture_file (void)
+{
+  if (capture != NULL)
+    return true;
+
+  if (pcm_device_name == NULL)
+    {
+      fprintf (stderr, "%s: The capture backend needs a file to write to, "
+                       "given with --device.\n",
+               progname);
+
+      return false;
+    }
+
+  capture = fopen (pcm_device_name, "w");
+  if (capture == NULL)
+    {
+      fprintf (stderr, "%s: Failed to open `%s' for writing: %s.\n",
+               progname, pcm_device_name, strerror (errno));
+
+      return false;
+    }
+
+  return true;
+}
+
+static void
+flush_capture_file (void)
+{
+  if (fflush (capture) != 0)
+    fprintf (stderr, "%s: An error occured while writing to `%s': %s.\n",
+             progname, pcm_device_name, strerror (errno));
+}
+
+static bool
+probe_capture_device (pcm_data_info_t *info)
+{
+  probe_sim_device (info);
+  return true;
+}
+
+static bool
+open_capture_device (pcm_data_info_t *info)
+{
+  bool big_endian;
+
+  if (device_open)
+    {
+      if (same_pcm_format (&device_info, info))
+        return true;
+
+      close_capture_device ();
+    }
+
+  if (! open_capture_file ())
+    return false;
+
+#ifdef WORDS_BIGENDIAN
+  big_endian = info->native_endian;
+#else
+  big_endian = false;
+#endif
+
+  open_sim_device (info);
+  count_metric (METRIC_DEVICE_OPENS);
+
+  write_record ("open", NULL);
+  fprintf (capture, " rate=%u channels=%u bytes=%u bits=%u %s %s\n",
+           info->sample_rate, info->channels, info->bytes_per_sample,
+           info->bits_per_sample,
+           info->floating ? "float" : info->sign ? "signed" : "unsigned",
+           big_endian ? "be" : "le");
+
+  device_info = *info;
+  device_open = true;
+  return true;
+}
+
+static bool
+write_capture_device (uint8_t *data, size_t len)
+{
+  struct timespec received;
+  struct timespec starts;
+  size_t          already_wrote;
+  size_t          taken;
+
+
+  if (timed_bell_received (&received)
+      && (received.tv_sec != last_bell.tv_sec
+          || received.tv_nsec != last_bell.tv_nsec))
+    {
+      write_record ("bell", &received);
+      fputc ('\n', capture);
+      last_bell = received;
+    }
+
+  already_wrote = 0;
+  while (already_wrote < len)
+    {
+      taken = queue_sim_device (len - already_wrote, &starts);
+
+      write_record ("pcm", &starts);
+      fprintf (capture, " %lu\n", (unsigned long) taken);
+      if (fwrite (data + already_wrote, 1, taken, capture) != taken
+          || fputc ('\n', capture) == EOF)
+        {
+          fprintf (stderr, "%s: An error occured while writing to `%s': %s.\n",
+                   progname, pcm_device_name, strerror (errno));
+
+          return false;
+        }
+
+      already_wrote += taken;
+      note_first_sample ();
+    }
+
+  return true;
+}
+
+static void
+drain_capture_device (void)
+{
+  if (! device_open)
+    return;
+
+  drain_sim_device ();
+  write_record ("drain", NULL);
+  fputc ('\n', capture);
+  flush_capture_file ();
+}
+
+static void
+close_capture_device (void)
+{
+  if (! device_open)
+    return;
+
+  write_record ("close", NULL);
+  fputc ('\n', capture);
+  flush_capture_file ();
+  device_open = false;
+}
+
+const pcm_backend_t capture_backend =
+{
+  .name      = "capture",
+  .automatic = false,
+  .probe     = probe_capture_device,
+  .open      = open_capture_device,
+  .write     = write_capture_device,
+  .drain     = drain_capture_device,
+  .close     = close_capture_device
+};
+
+#endif /* HAVE_CAPTURE */
@@ -0,0 +1,309 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "command.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/* A command which exceeded its timeout gets this long to exit on SIGTERM. */
+#define COMMAND_KILL_GRACE_MS 1000
+
+typedef struct bell_child bell_child_t;
+
+struct bell_child
+{
+  pid_t            pid;
+  struct timespec  deadline;
+  bool             terminated;   /* SIGTERM was sent. */
+};
+
+/* The running commands, shared by the playback thread and the main loop. */
+static pthread_mutex_t  children_lock = PTHREAD_MUTEX_INITIALIZER;
+static bell_child_t    *children      = NULL;
+static unsigned int     children_max;
+static unsigned int     children_count;
+static unsigned int     command_timeout;
+
+static loop_timer_t    *timeout_timer = NULL;
+static bool             timeout_armed;
+
+
+char **
+split_command (const char *command)
+{
+  char        **argv;
+  char         *words;
+  const char   *in;
+  char         *out;
+  char          quote;
+  size_t        argc;
+  bool          in_word;
+
+
+  /**
+   * Room for the worst case: every character a word of its own, plus the
+   * copies of the words, which are never longer than the command.
+   */
+  argc = strlen (command) + 1;
+  argv = malloc ((argc + 1) * sizeof (char *) + argc + 1);
+  if (argv == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the command's arguments: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  words = (char *) (argv + argc + 1);
+
+  /* Anything a shell would expand or redirect needs a real shell. */
+  if (strpbrk (command, "|&;<>()$`*?[]{}~#=\n") != NULL)
+    goto use_shell;
+
+  argc    = 0;
+  out     = words;
+  quote   = '\0';
+  in_word = false;
+  for (in = command; *in != '\0'; in++)
+    {
+      if (quote == '\0' && (*in == ' ' || *in == '\t'))
+        {
+          if (in_word)
+            {
+              *out++  = '\0';
+              in_word = false;
+            }
+          continue;
+        }
+
+      if (! in_word)
+        {
+          argv[argc++] = out;
+          in_word      = true;
+        }
+
+      if (quote == '\0' && (*in == '\'' || *in == '"'))
+        quote = *in;
+      else if (quote != '\0' && *in == quote)
+        quote = '\0';
+      else if (quote != '\'' && *in == '\\')
+        {
+          if (in[1] == '\0')
+            goto use_shell;
+          *out++ = *++in;
+        }
+      else
+        *out++ = *in;
+    }
+  *out = '\0';
+
+  if (quote != '\0' || argc == 0)
+    goto use_shell;
+
+  argv[argc] = NULL;
+  return argv;
+
+use_shell:
+  strcpy (words, command);
+  argv[0] = "/bin/sh";
+  argv[1] = "-c";
+  argv[2] = words;
+  argv[3] = NULL;
+
+  return argv;
+}
+
+
+/* Reaps the children that exited; several SIGCHLDs may have been merged. */
+static void
+reap_bell_commands (int signal_number, void *unused)
+{
+  unsigned int iter;
+  pid_t        pid;
+  int          status;
+
+  pthread_mutex_lock (&children_lock);
+  while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    {
+      for (iter = 0; iter < children_count; iter++)
+        {
+          if (children[iter].pid == pid)
+            {
+              children[iter] = children[--children_count];
+              break;
+            }
+        }
+    }
+  pthread_mutex_unlock (&children_lock);
+}
+
+static long
+ms_until (struct timespec *deadline, struct timespec *now)
+{
+  return (deadline->tv_sec - now->tv_sec) * 1000
+         + (deadline->tv_nsec - now->tv_nsec) / 1000000;
+}
+
+/* Signals the commands past their deadline, and re-arms the timer. */
+static void
+enforce_command_timeouts (void *unused)
+{
+  struct timespec  now;
+  bell_child_t    *child;
+  unsigned int     iter;
+  long             remaining;
+  long             next;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  next = -1;
+
+  pthread_mutex_lock (&children_lock);
+  for (iter = 0; iter < children_count; iter++)
+    {
+      child     = &(children[iter]);
+      remaining = ms_until (&(child->deadline), &now);
+      if (remaining <= 0)
+        {
+          if (! child->terminated)
+            {
+              kill (child->pid, SIGTERM);
+              child->terminated = true;
+              count_metric (METRIC_COMMANDS_KILLED);
+
+              child->deadline.tv_sec  = now.tv_sec + COMMAND_KILL_GRACE_MS / 1000;
+              child->deadline.tv_nsec = now.tv_nsec;
+              remaining = COMMAND_KILL_GRACE_MS;
+            }
+          else
+            {
+              /* Reaped once its SIGCHLD arrives. */
+              kill (child->pid, SIGKILL);
+              continue;
+            }
+        }
+
+      if (next == -1 || remaining < next)
+        next = remaining;
+    }
+  timeout_armed = next != -1;
+  arm_loop_timer (timeout_timer, next);
+  pthread_mutex_unlock (&children_lock);
+}
+
+bool
+start_command_tracking (event_loop_t *loop, unsigned int max_in_flight,
+                        unsigned int timeout)
+{
+  if (max_in_flight == 0)
+    max_in_flight = 1;
+
+  children = calloc (max_in_flight, sizeof (bell_child_t));
+  if (children == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the command table: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+  children_max    = max_in_flight;
+  children_count  = 0;
+  command_timeout = timeout;
+
+  if (! watch_loop_signal (loop, SIGCHLD, reap_bell_commands, NULL))
+    return false;
+
+  if (command_timeout > 0)
+    {
+      timeout_timer = add_loop_timer (loop, enforce_command_timeouts, NULL);
+      if (timeout_timer == NULL)
+        return false;
+      timeout_armed = false;
+    }
+
+  return true;
+}
+
+bool
+run_bell_command (char **argv)
+{
+  posix_spawnattr_t  attributes;
+  sigset_t           empty_mask;
+  bell_child_t      *child;
+  pid_t              pid;
+  int                status;
+
+  pthread_mutex_lock (&children_lock);
+  if (children_count == children_max)
+    {
+      count_metric (METRIC_COMMANDS_DROPPED);
+      pthread_mutex_unlock (&children_lock);
+
+      return false;
+    }
+
+  /* Don't let the command inherit the blocked SIGCHLD. */
+  sigemptyset (&empty_mask);
+  posix_spawnattr_init (&attributes);
+  posix_spawnattr_setsigmask (&attributes, &empty_mask);
+  posix_spawnattr_setflags (&attributes, POSIX_SPAWN_SETSIGMASK);
+
+  status = posix_spawnp (&pid, argv[0], NULL, &attributes, argv, environ);
+  posix_spawnattr_destroy (&attributes);
+  if (status != 0)
+    {
+      pthread_mutex_unlock (&children_lock);
+      fprintf (stderr, "%s: Failed to run `%s': %s.\n",
+               progname, argv[0], strerror (status));
+
+      return false;
+    }
+
+  child = &(children[children_count++]);
+  child->pid        = pid;
+  child->terminated = false;
+  clock_gettime (CLOCK_MONOTONIC, &(child->deadline));
+  child->deadline.tv_sec  += command_timeout / 1000;
+  child->deadline.tv_nsec += (command_timeout % 1000) * 1000000;
+  if (child->deadline.tv_nsec >= 1000000000)
+    {
+      child->deadline.tv_sec++;
+      child->deadline.tv_nsec -= 1000000000;
+    }
+
+  /* Every command gets the same timeout, so an armed timer expires first. */
+  if (command_timeout > 0 && ! timeout_armed)
+    {
+      arm_loop_timer (timeout_timer, command_timeout);
+      timeout_armed = true;
+    }
+
+  count_metric (METRIC_COMMANDS_STARTED);
+  pthread_mutex_unlock (&children_lock);
+
+  return true;
+}
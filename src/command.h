@@ -0,0 +1,51 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_COMMAND_H_
+#define _NXBELLD_COMMAND_H_ 1
+
+#include "common.h"
+#include "loop.h"
+
+
+/**
+ * Splits a bell command into an argument vector, once, so that every bell
+ * can be run without a shell.  Commands using shell syntax beyond plain
+ * words and quoting are run by /bin/sh instead.  The vector is a single
+ * allocation, to be released with free ().
+ */
+char **split_command (const char *command);
+
+/**
+ * Bell commands run asynchronously: run_bell_command () spawns the command
+ * and returns right away.  At most `max_in_flight' commands run at once,
+ * further bells are dropped until one of them exits, and a command still
+ * running after `timeout' milliseconds (0 means never) is terminated.
+ *
+ * The commands are reaped, and their timeouts enforced, by `loop'.  As that
+ * blocks SIGCHLD, start_command_tracking () must be called before any other
+ * thread is started.
+ */
+bool start_command_tracking (event_loop_t *loop, unsigned int max_in_flight,
+                             unsigned int timeout);
+bool run_bell_command       (char **argv);
+
+
+#endif /* _NXBELLD_COMMAND_H_ */
@@ -35,29 +35,15 @@
 /* Program name global. */
 extern const char *progname;
 
-/* Sanity check. */
-#ifdef HAVE_ALSA
-# ifndef  HAVE_SOUND
-#  define HAVE_SOUND 1
-# else
-#  error You can compile nxbelld against only a single sound API at the moment.
-# endif
+/* Every sound API built in is a backend nxbelld may play through. */
+#if defined (HAVE_PULSE) || defined (HAVE_ALSA) || defined (HAVE_OSS) \
+    || defined (HAVE_SOUNDIO) || defined (HAVE_NULL) || defined (HAVE_CAPTURE)
+# define HAVE_SOUND 1
 #endif
 
-#ifdef HAVE_OSS
-# ifndef  HAVE_SOUND
-#  define HAVE_SOUND 1
-# else
-#  error You can compile nxbelld against only a single sound API at the moment.
-# endif
-#endif
-
-#ifdef HAVE_SOUNDIO
-# ifndef  HAVE_SOUND
-#  define HAVE_SOUND 1
-# else
-#  error You can compile nxbelld against only a single sound API at the moment.
-# endif
+/* The null and capture backends play to a simulated device. */
+#if defined (HAVE_NULL) || defined (HAVE_CAPTURE)
+# define HAVE_SIM_DEVICE 1
 #endif
 
 
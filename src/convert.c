@@ -0,0 +1,425 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+#include "convert.h"
+#include "resample.h"
+#include <byteswap.h>
+
+/**
+ * Samples are converted a block at a time: non-native data is byte-swapped
+ * first, then decoded into full-scale 32-bit samples, and finally encoded
+ * into the requested format.  The kernels are plain loops over restrict
+ * pointers, so that the compiler can vectorize them.
+ */
+#define CONVERT_BLOCK 1024
+
+typedef void (*decode_func_t) (const uint8_t *restrict in,
+                               int32_t *restrict out, size_t count);
+typedef void (*encode_func_t) (const int32_t *restrict in,
+                               uint8_t *restrict out, size_t count);
+
+
+/* Byte-swapping kernels. */
+static void
+swap_16 (uint8_t *data, size_t count)
+{
+  uint16_t *samples = (uint16_t *) data;
+  size_t    iter;
+
+  for (iter = 0; iter < count; iter++)
+    samples[iter] = bswap_16 (samples[iter]);
+}
+
+static void
+swap_24 (uint8_t *data, size_t count)
+{
+  uint8_t tmp;
+  size_t  iter;
+
+  for (iter = 0; iter < count; iter++)
+    {
+      tmp                  = data[3 * iter];
+      data[3 * iter]       = data[3 * iter + 2];
+      data[3 * iter + 2]   = tmp;
+    }
+}
+
+static void
+swap_32 (uint8_t *data, size_t count)
+{
+  uint32_t *samples = (uint32_t *) data;
+  size_t    iter;
+
+  for (iter = 0; iter < count; iter++)
+    samples[iter] = bswap_32 (samples[iter]);
+}
+
+
+/* Decoding kernels, native-endian samples to full-scale 32-bit samples. */
+static void
+decode_u8 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  size_t iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) ((uint32_t) (in[iter] ^ 0x80) << 24);
+}
+
+static void
+decode_s8 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  size_t iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) ((uint32_t) in[iter] << 24);
+}
+
+static void
+decode_u16 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  const uint16_t *samples = (const uint16_t *) in;
+  size_t          iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) ((uint32_t) (samples[iter] ^ 0x8000) << 16);
+}
+
+static void
+decode_s16 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  const uint16_t *samples = (const uint16_t *) in;
+  size_t          iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) ((uint32_t) samples[iter] << 16);
+}
+
+static void
+decode_s24_packed (const uint8_t *restrict in, int32_t *restrict out,
+                   size_t count)
+{
+  size_t iter;
+
+  for (iter = 0; iter < count; iter++)
+    {
+#ifdef WORDS_BIGENDIAN
+      out[iter] = (int32_t) (((uint32_t) in[3 * iter]     << 24)
+                             | ((uint32_t) in[3 * iter + 1] << 16)
+                             | ((uint32_t) in[3 * iter + 2] << 8));
+#else
+      out[iter] = (int32_t) (((uint32_t) in[3 * iter + 2] << 24)
+                             | ((uint32_t) in[3 * iter + 1] << 16)
+                             | ((uint32_t) in[3 * iter]     << 8));
+#endif
+    }
+}
+
+static void
+decode_u24_packed (const uint8_t *restrict in, int32_t *restrict out,
+                   size_t count)
+{
+  size_t iter;
+
+  decode_s24_packed (in, out, count);
+  for (iter = 0; iter < count; iter++)
+    out[iter] ^= INT32_MIN;
+}
+
+static void
+decode_s24 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  const uint32_t *samples = (const uint32_t *) in;
+  size_t          iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) (samples[iter] << 8);
+}
+
+static void
+decode_u24 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  const uint32_t *samples = (const uint32_t *) in;
+  size_t          iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) ((samples[iter] << 8) ^ 0x80000000);
+}
+
+static void
+decode_s32 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  memcpy (out, in, count * sizeof (int32_t));
+}
+
+static void
+decode_u32 (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  const uint32_t *samples = (const uint32_t *) in;
+  size_t          iter;
+
+  for (iter = 0; iter < count; iter++)
+    out[iter] = (int32_t) (samples[iter] ^ 0x80000000);
+}
+
+static void
+decode_float (const uint8_t *restrict in, int32_t *restrict out, size_t count)
+{
+  const float *samples = (const float *) in;
+  float        value;
+  size_t       iter;
+
+  for (iter = 0; iter < count; iter++)
+    {
+      value = samples[iter] * 2147483648.0f;
+      if (value >= 2147483647.0f)
+        out[iter] = INT32_MAX;
+      else if (value <= -2147483648.0f)
+        out[iter] = INT32_MIN;
+      else
+        out[iter] = (int32_t) value;
+    }
+}
+
+
+/* Encoding kernels, full-scale 32-bit samples to native-endian samples. */
+static void
+encode_s16 (const int32_t *restrict in, uint8_t *restrict out, size_t count)
+{
+  int16_t *samples = (int16_t *) out;
+  size_t   iter;
+
+  for (iter = 0; iter < count; iter++)
+    samples[iter] = in[iter] >> 16;
+}
+
+static void
+encode_s24_packed (const int32_t *restrict in, uint8_t *restrict out,
+                   size_t count)
+{
+  size_t iter;
+
+  for (iter = 0; iter < count; iter++)
+    {
+#ifdef WORDS_BIGENDIAN
+      out[3 * iter]     = (uint32_t) in[iter] >> 24;
+      out[3 * iter + 1] = (uint32_t) in[iter] >> 16;
+      out[3 * iter + 2] = (uint32_t) in[iter] >> 8;
+#else
+      out[3 * iter]     = (uint32_t) in[iter] >> 8;
+      out[3 * iter + 1] = (uint32_t) in[iter] >> 16;
+      out[3 * iter + 2] = (uint32_t) in[iter] >> 24;
+#endif
+    }
+}
+
+static void
+encode_s24 (const int32_t *restrict in, uint8_t *restrict out, size_t count)
+{
+  int32_t *samples = (int32_t *) out;
+  size_t   iter;
+
+  for (iter = 0; iter < count; iter++)
+    samples[iter] = in[iter] >> 8;
+}
+
+static void
+encode_s32 (const int32_t *restrict in, uint8_t *restrict out, size_t count)
+{
+  memcpy (out, in, count * sizeof (int32_t));
+}
+
+static void
+encode_float (const int32_t *restrict in, uint8_t *restrict out, size_t count)
+{
+  float  *samples = (float *) out;
+  size_t  iter;
+
+  for (iter = 0; iter < count; iter++)
+    samples[iter] = in[iter] * (1.0f / 2147483648.0f);
+}
+
+
+/* Non-native sample data is little-endian, as found in WAVE files. */
+static bool
+is_native_endian (pcm_data_info_t *info)
+{
+#ifdef WORDS_BIGENDIAN
+  return (info->native_endian || info->bytes_per_sample == 1);
+#else
+  return true;
+#endif
+}
+
+static decode_func_t
+find_decoder (pcm_data_info_t *info)
+{
+  if (info->floating)
+    return (info->bytes_per_sample == 4) ? decode_float : NULL;
+
+  switch (info->bytes_per_sample)
+    {
+      case 1:
+        return info->sign ? decode_s8 : decode_u8;
+      case 2:
+        return info->sign ? decode_s16 : decode_u16;
+      case 3:
+        return info->sign ? decode_s24_packed : decode_u24_packed;
+      case 4:
+        if (info->bits_per_sample == 24)
+          return info->sign ? decode_s24 : decode_u24;
+        return info->sign ? decode_s32 : decode_u32;
+    }
+
+  return NULL;
+}
+
+static encode_func_t
+find_encoder (pcm_data_info_t *info)
+{
+  if (! info->sign)
+    return NULL;
+  if (info->floating)
+    return (info->bytes_per_sample == 4) ? encode_float : NULL;
+
+  switch (info->bytes_per_sample)
+    {
+      case 2:
+        return encode_s16;
+      case 3:
+        return encode_s24_packed;
+      case 4:
+        return (info->bits_per_sample == 24) ? encode_s24 : encode_s32;
+    }
+
+  return NULL;
+}
+
+bool
+convert_pcm_buffer (playable_pcm_buffer_t *buffer, pcm_data_info_t *format)
+{
+  decode_func_t  decode;
+  encode_func_t  encode;
+  uint8_t        swapped[CONVERT_BLOCK * 4];
+  int32_t        decoded[CONVERT_BLOCK];
+  const uint8_t *in;
+  uint8_t       *out;
+  unsigned int   in_bytes;
+  unsigned int   out_bytes;
+  bool           swap;
+  size_t         samples_count;
+  size_t         done;
+  size_t         count;
+
+  swap = ! is_native_endian (&(buffer->info));
+
+  if (! swap
+      && buffer->info.sign             == format->sign
+      && buffer->info.floating         == format->floating
+      && buffer->info.bytes_per_sample == format->bytes_per_sample
+      && buffer->info.bits_per_sample  == format->bits_per_sample)
+    {
+      buffer->info.native_endian = true;
+      return true;
+    }
+
+  decode = find_decoder (&(buffer->info));
+  encode = find_encoder (format);
+  if (decode == NULL || encode == NULL)
+    {
+      fprintf (stderr, "%s: Converting %u-bit sound data to %u-bit sound data "
+                       "is not supported.\n",
+               progname, buffer->info.bits_per_sample, format->bits_per_sample);
+
+      return false;
+    }
+
+  in_bytes      = buffer->info.bytes_per_sample;
+  out_bytes     = format->bytes_per_sample;
+  samples_count = buffer->data_len / in_bytes;
+
+  out = malloc (samples_count * out_bytes);
+  if (out == NULL)
+    {
+      fprintf (stderr, "%s: Allocating a buffer for the converted sound "
+                       "data failed: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+
+  for (done = 0; done < samples_count; done += count)
+    {
+      count = samples_count - done;
+      if (count > CONVERT_BLOCK)
+        count = CONVERT_BLOCK;
+
+      in = buffer->data + done * in_bytes;
+      if (swap || (in_bytes != 3 && ((uintptr_t) in % in_bytes) != 0))
+        {
+          memcpy (swapped, in, count * in_bytes);
+          in = swapped;
+        }
+      if (swap)
+        {
+          switch (in_bytes)
+            {
+              case 2: swap_16 (swapped, count); break;
+              case 3: swap_24 (swapped, count); break;
+              case 4: swap_32 (swapped, count); break;
+            }
+        }
+
+      decode (in, decoded, count);
+      encode (decoded, out + done * out_bytes, count);
+    }
+
+  /* The original data may be a read-only file mapping. */
+  replace_pcm_buffer_data (buffer, out, samples_count * out_bytes);
+
+  buffer->info.native_endian    = true;
+  buffer->info.sign             = format->sign;
+  buffer->info.floating         = format->floating;
+  buffer->info.bytes_per_sample = format->bytes_per_sample;
+  buffer->info.bits_per_sample  = format->bits_per_sample;
+
+  return true;
+}
+
+bool
+convert_pcm_buffer_for_device (playable_pcm_buffer_t *buffer)
+{
+  pcm_data_info_t format;
+
+  format = buffer->info;
+  if (! probe_pcm_device (&format))
+    return false;
+
+  if (! resample_pcm_buffer (buffer, format.sample_rate))
+    return false;
+
+  return convert_pcm_buffer (buffer, &format);
+}
+
+#endif /* HAVE_SOUND */
@@ -0,0 +1,52 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_CONVERT_H_
+#define _NXBELLD_CONVERT_H_ 1
+
+#include "common.h"
+
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+
+/**
+ * Converts the buffer's samples into the sample format described by
+ * `format'; its channel count and sample rate are ignored.
+ *
+ * Supported are 8, 16, 24 (packed or in 4 bytes) and 32-bit integer samples,
+ * signed or unsigned, and 32-bit floating point samples.  Signed native-endian
+ * integer or floating point samples may be produced, of any of those sizes
+ * but 8 bits.
+ *
+ * When the data is already in the requested format, it is left untouched.
+ */
+bool convert_pcm_buffer (playable_pcm_buffer_t *buffer,
+                         pcm_data_info_t *format);
+
+/**
+ * Converts the buffer to the sample format and rate preferred by the
+ * playback device.
+ */
+bool convert_pcm_buffer_for_device (playable_pcm_buffer_t *buffer);
+
+#endif /* HAVE_SOUND */
+#endif /* _NXBELLD_CONVERT_H_ */
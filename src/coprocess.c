@@ -0,0 +1,287 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "coprocess.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/* Restart delays of a dying handler, in ms. */
+#define COPROCESS_MIN_BACKOFF   100
+#define COPROCESS_MAX_BACKOFF   30000
+
+/* A handler that ran this long (ms) before dying is restarted right away. */
+#define COPROCESS_STABLE_TIME   30000
+
+/* Room for the lines waiting for the handler to catch up. */
+#define COPROCESS_BACKLOG_SIZE  16384
+
+/* Longest line sent, with the name truncated as needed. */
+#define COPROCESS_LINE_MAX      192
+
+
+static long
+elapsed_ms (const struct timespec *since, const struct timespec *now)
+{
+  return (now->tv_sec - since->tv_sec) * 1000
+         + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static bool
+spawn_coprocess (coprocess_t *coprocess)
+{
+  posix_spawn_file_actions_t  actions;
+  posix_spawnattr_t           attributes;
+  sigset_t                    signals;
+  int                         pipe_fds[2];
+  int                         status;
+
+
+  if (pipe (pipe_fds) == -1)
+    {
+      fprintf (stderr, "%s: Failed to create a pipe: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+  fcntl (pipe_fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl (pipe_fds[1], F_SETFD, FD_CLOEXEC);
+  fcntl (pipe_fds[1], F_SETFL, O_NONBLOCK);
+
+  /* The read end becomes the handler's stdin, which dup2 () leaves open. */
+  posix_spawn_file_actions_init (&actions);
+  posix_spawn_file_actions_adddup2 (&actions, pipe_fds[0], STDIN_FILENO);
+
+  /* Don't pass on the dispositions and mask nxbelld set for itself. */
+  posix_spawnattr_init (&attributes);
+  sigemptyset (&signals);
+  posix_spawnattr_setsigmask (&attributes, &signals);
+  sigaddset (&signals, SIGPIPE);
+  sigaddset (&signals, SIGCHLD);
+  posix_spawnattr_setsigdefault (&attributes, &signals);
+  posix_spawnattr_setflags (&attributes,
+                            POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  status = posix_spawnp (&(coprocess->pid), coprocess->argv[0], &actions,
+                         &attributes, coprocess->argv, environ);
+  posix_spawn_file_actions_destroy (&actions);
+  posix_spawnattr_destroy (&attributes);
+  close (pipe_fds[0]);
+  clock_gettime (CLOCK_MONOTONIC, &(coprocess->started));
+
+  if (status != 0)
+    {
+      close (pipe_fds[1]);
+      fprintf (stderr, "%s: Failed to start `%s': %s.\n",
+               progname, coprocess->argv[0], strerror (status));
+
+      return false;
+    }
+
+  coprocess->fd = pipe_fds[1];
+  return true;
+}
+
+/**
+ * Called when writing to the handler fails for good.  The handler isn't
+ * waitpid()'d: SIGCHLD is ignored, so it doesn't linger as a zombie.
+ */
+static void
+lose_coprocess (coprocess_t *coprocess)
+{
+  struct timespec now;
+
+  close (coprocess->fd);
+  coprocess->fd = -1;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  if (elapsed_ms (&(coprocess->started), &now) >= COPROCESS_STABLE_TIME)
+    coprocess->backoff = COPROCESS_MIN_BACKOFF;
+  else if (coprocess->backoff < COPROCESS_MAX_BACKOFF / 2)
+    coprocess->backoff *= 2;
+  else
+    coprocess->backoff = COPROCESS_MAX_BACKOFF;
+
+  fprintf (stderr, "%s: Warning: The bell handler exited, restarting it "
+                   "in %u ms at the earliest.\n",
+           progname, coprocess->backoff);
+}
+
+/* Restarts a lost handler once its backoff has elapsed. */
+static bool
+revive_coprocess (coprocess_t *coprocess)
+{
+  struct timespec now;
+
+  if (coprocess->fd != -1)
+    return true;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  if (elapsed_ms (&(coprocess->started), &now) < coprocess->backoff)
+    return false;
+
+  count_metric (METRIC_COPROCESS_RESTARTS);
+  if (spawn_coprocess (coprocess))
+    return true;
+
+  if (coprocess->backoff < COPROCESS_MAX_BACKOFF / 2)
+    coprocess->backoff *= 2;
+  else
+    coprocess->backoff = COPROCESS_MAX_BACKOFF;
+  return false;
+}
+
+/**
+ * Writes as much of the backlog as the pipe takes.  Returns false if the
+ * handler is gone.
+ */
+static bool
+flush_coprocess (coprocess_t *coprocess)
+{
+  ssize_t written;
+
+  while (coprocess->backlog_len > 0)
+    {
+      written = write (coprocess->fd, coprocess->backlog,
+                       coprocess->backlog_len);
+      if (written == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+
+          /* EPIPE: the lines in the pipe were lost along with the handler. */
+          lose_coprocess (coprocess);
+          return false;
+        }
+
+      coprocess->backlog_len -= written;
+      memmove (coprocess->backlog, coprocess->backlog + written,
+               coprocess->backlog_len);
+    }
+
+  return true;
+}
+
+static size_t
+format_bell_line (char *line, const bell_event_t *bell)
+{
+  const char *name;
+  int         len;
+  int         iter;
+
+
+  name = (bell->name[0] != '\0') ? bell->name : "-";
+  len = snprintf (line, COPROCESS_LINE_MAX, "%lld.%06ld 0x%lx %u %u %u ",
+                  (long long) bell->received.tv_sec,
+                  bell->received.tv_nsec / 1000, bell->window, bell->pitch,
+                  bell->duration, bell->percent);
+
+  /* Keep the line parsable whatever the name contains. */
+  for (iter = 0; name[iter] != '\0' && len < COPROCESS_LINE_MAX - 1; iter++)
+    line[len++] = ((unsigned char) name[iter] > ' ') ? name[iter] : '_';
+  line[len++] = '\n';
+
+  return len;
+}
+
+bool
+send_coprocess_bell (coprocess_t *coprocess, const bell_event_t *bell)
+{
+  char    line[COPROCESS_LINE_MAX + 1];
+  size_t  len;
+
+
+  len = format_bell_line (line, bell);
+  if (coprocess->backlog_len + len > COPROCESS_BACKLOG_SIZE)
+    {
+      /* Make room, unless the handler is dead or stuck. */
+      if (! revive_coprocess (coprocess) || ! flush_coprocess (coprocess)
+          || coprocess->backlog_len + len > COPROCESS_BACKLOG_SIZE)
+        {
+          count_metric (METRIC_COPROCESS_DROPPED);
+          return false;
+        }
+    }
+
+  /* Queued behind the older lines, which have to go first. */
+  memcpy (coprocess->backlog + coprocess->backlog_len, line, len);
+  coprocess->backlog_len += len;
+  count_metric (METRIC_COPROCESS_SENT);
+
+  if (revive_coprocess (coprocess))
+    flush_coprocess (coprocess);
+
+  return true;
+}
+
+coprocess_t *
+start_coprocess (char **argv)
+{
+  coprocess_t      *coprocess;
+  struct sigaction  action;
+
+
+  coprocess = malloc (sizeof (coprocess_t) + COPROCESS_BACKLOG_SIZE);
+  if (coprocess == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the bell handler: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  coprocess->argv        = argv;
+  coprocess->fd          = -1;
+  coprocess->backoff     = COPROCESS_MIN_BACKOFF;
+  coprocess->backlog     = (char *) (coprocess + 1);
+  coprocess->backlog_len = 0;
+
+  /* A dead handler is noticed by write () failing with EPIPE. */
+  action.sa_flags   = 0;
+  action.sa_handler = SIG_IGN;
+  sigemptyset (&action.sa_mask);
+  sigaction (SIGPIPE, &action, NULL);
+
+  if (! spawn_coprocess (coprocess))
+    {
+      free (coprocess);
+      return NULL;
+    }
+
+  return coprocess;
+}
+
+void
+stop_coprocess (coprocess_t *coprocess)
+{
+  if (coprocess == NULL)
+    return;
+
+  if (coprocess->fd != -1)
+    close (coprocess->fd);
+  free (coprocess);
+}
@@ -0,0 +1,72 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_COPROCESS_H_
+#define _NXBELLD_COPROCESS_H_ 1
+
+#include "common.h"
+#include "queue.h"
+
+#include <time.h>
+#include <sys/types.h>
+
+
+/**
+ * A long-lived bell handler, which is sent one line per bell on its
+ * standard input:
+ *
+ *   <time> <window> <pitch> <duration> <percent> <name>
+ *
+ * where <time> is the CLOCK_MONOTONIC time the bell was received at, in
+ * seconds with a microsecond fraction, <window> is the hexadecimal X window
+ * ID, the parameters are 0 where the client didn't request any, and <name>
+ * is the bell's name, or `-' if it has none.
+ *
+ * Writes never block: lines the pipe can't take yet wait in a bounded
+ * backlog, and are sent ahead of the next bell.  A handler found dead is
+ * restarted, no sooner than an exponentially growing delay after it was
+ * last started.
+ */
+typedef struct coprocess coprocess_t;
+
+struct coprocess
+{
+  char           **argv;
+  pid_t            pid;
+  int              fd;           /* Write end of the handler's stdin, or -1. */
+
+  struct timespec  started;      /* When the handler was last started. */
+  unsigned int     backoff;      /* Current restart delay, in ms. */
+
+  char            *backlog;
+  size_t           backlog_len;
+};
+
+/* Starts the handler; `argv' remains owned by the caller. */
+coprocess_t *start_coprocess (char **argv);
+
+/* Sends a bell to the handler, restarting it if needed. */
+bool send_coprocess_bell (coprocess_t *coprocess, const bell_event_t *bell);
+
+/* Closes the handler's stdin, which tells it to exit. */
+void stop_coprocess (coprocess_t *coprocess);
+
+
+#endif /* _NXBELLD_COPROCESS_H_ */
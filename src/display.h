@@ -0,0 +1,64 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_DISPLAY_H_
+#define _NXBELLD_DISPLAY_H_ 1
+
+#include "common.h"
+#include "queue.h"
+
+
+/**
+ * The connection to the X server which bells are received from.  It is
+ * implemented with Xlib (xlib.c) or, when configured --with-xcb, with XCB
+ * (xcb.c), which skips Xlib's event queue and locking.
+ */
+typedef struct bell_display bell_display_t;
+
+/* Connects to the named display, or $DISPLAY, and sets up XKB. */
+bell_display_t *open_bell_display  (const char *name);
+void            close_bell_display (bell_display_t *display);
+
+/* The descriptor to wait on for bells. */
+int bell_display_fd (bell_display_t *display);
+
+/* The server's default bell volume (percent), pitch (Hz) and duration (ms). */
+bool get_bell_defaults (bell_display_t *display, unsigned int *percent,
+                        unsigned int *pitch, unsigned int *duration);
+
+/* Asks the server for bell notifications. */
+bool select_bell_events (bell_display_t *display);
+
+/* Reads and sets whether the server sounds the bell itself. */
+bool audible_bell_enabled (bell_display_t *display);
+bool set_audible_bell     (bell_display_t *display, bool enabled);
+
+/**
+ * Stamps and hands every bell already received on the connection over to
+ * `handler', without waiting for more.  Returns false if the connection to
+ * the server was lost.
+ */
+typedef void (*bell_handler_t) (const bell_event_t *bell, void *data);
+
+bool read_display_bells (bell_display_t *display, bell_handler_t handler,
+                         void *data);
+
+
+#endif /* _NXBELLD_DISPLAY_H_ */
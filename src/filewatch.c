@@ -0,0 +1,181 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "filewatch.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+/* How long the file has to stay unchanged before it's picked up. */
+#define FILE_WATCH_SETTLE_MS  250
+
+struct file_watch
+{
+  event_loop_t    *loop;
+  loop_timer_t    *timer;
+  int              fd;
+  char            *directory;
+  const char      *name;        /* Points into `directory''s allocation. */
+
+  loop_callback_t  changed;
+  void            *data;
+};
+
+static void
+report_file_change (void *data)
+{
+  file_watch_t *watch = data;
+
+  watch->changed (watch->data);
+}
+
+static void
+read_file_events (void *data)
+{
+  file_watch_t               *watch = data;
+  const struct inotify_event *event;
+  ssize_t                     len;
+  size_t                      pos;
+  bool                        changed;
+
+  char buffer[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+
+  changed = false;
+  while ((len = read (watch->fd, buffer, sizeof (buffer))) > 0)
+    {
+      for (pos = 0; pos < (size_t) len;
+           pos += sizeof (struct inotify_event) + event->len)
+        {
+          event = (const struct inotify_event *) (buffer + pos);
+          if (event->len > 0 && strcmp (event->name, watch->name) == 0)
+            changed = true;
+        }
+    }
+
+  /* Every further change pushes the reload back. */
+  if (changed)
+    arm_loop_timer (watch->timer, FILE_WATCH_SETTLE_MS);
+}
+
+file_watch_t *
+watch_file (event_loop_t *loop, const char *path, loop_callback_t changed,
+            void *data)
+{
+  file_watch_t *watch;
+  char         *slash;
+  size_t        len;
+
+  watch = malloc (sizeof (file_watch_t));
+  if (watch == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate a file watch: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  watch->loop    = loop;
+  watch->changed = changed;
+  watch->data    = data;
+
+  /* Room for "./" in front of a bare file name. */
+  len = strlen (path);
+  watch->directory = malloc (len + 3);
+  if (watch->directory == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate a file watch: %s.\n",
+               progname, strerror (errno));
+
+      free (watch);
+      return NULL;
+    }
+  slash = strrchr (path, '/');
+  if (slash == NULL)
+    {
+      strcpy (watch->directory, ".");
+      watch->name = strcpy (watch->directory + 2, path);
+    }
+  else
+    {
+      memcpy (watch->directory, path, len + 1);
+      slash = watch->directory + (slash - path);
+      watch->name = slash + 1;
+      if (slash == watch->directory)
+        {
+          /* The file is in the root directory, keep its slash. */
+          memmove (slash + 1, slash, len + 1);
+          watch->name = slash + 2;
+          slash++;
+        }
+      *slash = '\0';
+    }
+
+  watch->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd == -1)
+    {
+      fprintf (stderr, "%s: Failed to create an inotify instance: %s.\n",
+               progname, strerror (errno));
+
+      free (watch->directory);
+      free (watch);
+      return NULL;
+    }
+  if (inotify_add_watch (watch->fd, watch->directory,
+                         IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1)
+    {
+      fprintf (stderr, "%s: Failed to watch `%s': %s.\n",
+               progname, watch->directory, strerror (errno));
+
+      close (watch->fd);
+      free (watch->directory);
+      free (watch);
+      return NULL;
+    }
+
+  watch->timer = add_loop_timer (loop, report_file_change, watch);
+  if (watch->timer == NULL
+      || ! watch_loop_fd (loop, watch->fd, read_file_events, watch))
+    {
+      close (watch->fd);
+      free (watch->directory);
+      free (watch);
+      return NULL;
+    }
+
+  return watch;
+}
+
+void
+free_file_watch (file_watch_t *watch)
+{
+  if (watch == NULL)
+    return;
+
+  arm_loop_timer (watch->timer, -1);
+  unwatch_loop_fd (watch->loop, watch->fd);
+  close (watch->fd);
+  free (watch->directory);
+  free (watch);
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
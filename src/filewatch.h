@@ -0,0 +1,44 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_FILEWATCH_H_
+#define _NXBELLD_FILEWATCH_H_ 1
+
+#include "common.h"
+#include "loop.h"
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/**
+ * Watches a file for being rewritten or replaced, and calls `changed' from
+ * the event loop once the file has been left alone for a moment, so that a
+ * file still being written isn't picked up half-way.  The directory of the
+ * file is watched, so replacing it by renaming another file over it, as
+ * editors and package managers do, is noticed as well.
+ */
+typedef struct file_watch file_watch_t;
+
+file_watch_t *watch_file      (event_loop_t *loop, const char *path,
+                               loop_callback_t changed, void *data);
+void          free_file_watch (file_watch_t *watch);
+
+#endif /* HAVE_SYS_INOTIFY_H */
+#endif /* _NXBELLD_FILEWATCH_H_ */
@@ -0,0 +1,178 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Renders the synthesizer's wavetables as C source on the standard output.
+ * It's run on the build machine, so it only relies on the C library and
+ * libm, and not on the configuration of the host nxbelld is built for.
+ */
+
+#include "wavetable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define ENTRIES_PER_LINE  8
+
+
+static const char *progname = "gen-wavetables";
+
+static const char *const wave_names[SYNTH_WAVES] =
+{
+  [SYNTH_WAVE_SINE]    = "sine",
+  [SYNTH_WAVE_COMPLEX] = "complex",
+  [SYNTH_WAVE_SQUARE]  = "square"
+};
+
+static const char *const wave_enums[SYNTH_WAVES] =
+{
+  [SYNTH_WAVE_SINE]    = "SYNTH_WAVE_SINE",
+  [SYNTH_WAVE_COMPLEX] = "SYNTH_WAVE_COMPLEX",
+  [SYNTH_WAVE_SQUARE]  = "SYNTH_WAVE_SQUARE"
+};
+
+
+/* The amplitude of the n-th harmonic of a waveform. */
+static double
+harmonic_amplitude (unsigned int waveform, unsigned int n)
+{
+  switch (waveform)
+    {
+      case SYNTH_WAVE_SINE:
+        return (n == 1) ? 1.0 : 0.0;
+
+      /* sin(x) + sin(3x)/3^1.5 + ... + sin(9x)/9^1.5, see beep.c. */
+      case SYNTH_WAVE_COMPLEX:
+        return (n % 2 == 1 && n <= 9) ? 1.0 / (n * sqrt (n)) : 0.0;
+
+      case SYNTH_WAVE_SQUARE:
+        return (n % 2 == 1) ? 1.0 / n : 0.0;
+    }
+
+  return 0.0;
+}
+
+/* The highest level which differs from the ones below it. */
+static unsigned int
+max_level (unsigned int waveform)
+{
+  switch (waveform)
+    {
+      case SYNTH_WAVE_SINE:
+        return 0;
+      case SYNTH_WAVE_COMPLEX:
+        return 4;
+    }
+
+  return SYNTH_LEVELS - 1;
+}
+
+static void
+build_table (unsigned int waveform, unsigned int level,
+             int16_t table[SYNTH_TABLE_LEN + 1])
+{
+  static double sum[SYNTH_TABLE_LEN];
+  double        amplitude;
+  double        peak;
+  unsigned int  harmonics;
+  unsigned int  n;
+  unsigned int  iter;
+
+
+  for (iter = 0; iter < SYNTH_TABLE_LEN; iter++)
+    sum[iter] = 0.0;
+
+  harmonics = 1U << level;
+  for (n = 1; n <= harmonics; n++)
+    {
+      amplitude = harmonic_amplitude (waveform, n);
+      if (amplitude == 0.0)
+        continue;
+
+      for (iter = 0; iter < SYNTH_TABLE_LEN; iter++)
+        sum[iter] += amplitude * sin (2 * M_PI * n * iter / SYNTH_TABLE_LEN);
+    }
+
+  /* Normalize, so that the Gibbs overshoot of sharp waveforms can't clip. */
+  peak = 0.0;
+  for (iter = 0; iter < SYNTH_TABLE_LEN; iter++)
+    if (fabs (sum[iter]) > peak)
+      peak = fabs (sum[iter]);
+
+  for (iter = 0; iter < SYNTH_TABLE_LEN; iter++)
+    table[iter] = lrint (sum[iter] * INT16_MAX / peak);
+
+  /* A guard entry, for interpolating past the last one. */
+  table[SYNTH_TABLE_LEN] = table[0];
+}
+
+static void
+print_table (unsigned int waveform, unsigned int level)
+{
+  int16_t      table[SYNTH_TABLE_LEN + 1];
+  unsigned int iter;
+
+  build_table (waveform, level, table);
+
+  printf ("static const int16_t %s_%u[SYNTH_TABLE_LEN + 1] =\n{",
+          wave_names[waveform], level);
+  for (iter = 0; iter <= SYNTH_TABLE_LEN; iter++)
+    printf ("%s%6d%s", (iter % ENTRIES_PER_LINE == 0) ? "\n  " : " ",
+            table[iter], (iter < SYNTH_TABLE_LEN) ? "," : "");
+  printf ("\n};\n\n");
+}
+
+int
+main (void)
+{
+  unsigned int waveform;
+  unsigned int level;
+
+
+  printf ("/* Generated by %s, do not edit. */\n\n"
+          "#include \"wavetable.h\"\n\n",
+          progname);
+
+  for (waveform = 0; waveform < SYNTH_WAVES; waveform++)
+    for (level = 0; level <= max_level (waveform); level++)
+      print_table (waveform, level);
+
+  printf ("const int16_t *const synth_tables[SYNTH_WAVES][SYNTH_LEVELS] =\n"
+          "{\n");
+  for (waveform = 0; waveform < SYNTH_WAVES; waveform++)
+    {
+      printf ("  [%s] =\n    {", wave_enums[waveform]);
+      for (level = 0; level < SYNTH_LEVELS; level++)
+        printf ("%s%s_%u%s", (level % 4 == 0) ? "\n      " : " ",
+                wave_names[waveform],
+                (level < max_level (waveform)) ? level : max_level (waveform),
+                (level + 1 < SYNTH_LEVELS) ? "," : "");
+      printf ("\n    }%s\n", (waveform + 1 < SYNTH_WAVES) ? "," : "");
+    }
+  printf ("};\n");
+
+  if (fflush (stdout) != 0 || ferror (stdout))
+    {
+      fprintf (stderr, "%s: Failed to write the wavetables.\n", progname);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
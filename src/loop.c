@@ -0,0 +1,615 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "loop.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined HAVE_SYS_EPOLL_H && defined HAVE_SYS_SIGNALFD_H \
+    && defined HAVE_SYS_TIMERFD_H
+# define USE_EPOLL 1
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+# include <sys/timerfd.h>
+#else
+# include <poll.h>
+#endif
+
+#define LOOP_EPOLL_BATCH  16
+#define LOOP_MAX_TIMERS   4
+#define LOOP_MAX_SIGNALS  8
+
+typedef struct loop_watch loop_watch_t;
+
+struct loop_watch
+{
+  int              fd;
+  loop_callback_t  callback;
+  void            *data;
+};
+
+struct loop_timer
+{
+  event_loop_t    *loop;
+  loop_callback_t  callback;
+  void            *data;
+#ifdef USE_EPOLL
+  int              fd;
+#else
+  bool             armed;
+  struct timespec  deadline;
+#endif
+};
+
+typedef struct loop_signal loop_signal_t;
+
+struct loop_signal
+{
+  int                     signal_number;
+  loop_signal_callback_t  callback;
+  void                   *data;
+};
+
+struct event_loop
+{
+  /* Unused slots have an fd of -1, so that slots never move. */
+  loop_watch_t    *watches;
+  unsigned int     watch_count;
+  unsigned int     watch_size;
+  loop_timer_t     timers[LOOP_MAX_TIMERS];
+  unsigned int     timer_count;
+  loop_signal_t    signals[LOOP_MAX_SIGNALS];
+  unsigned int     signal_count;
+  atomic_bool      stopping;
+
+#ifdef USE_EPOLL
+  int              epoll_fd;
+  int              signal_fd;
+  sigset_t         signal_mask;
+#else
+  struct pollfd   *poll_fds;
+
+  /**
+   * Woken up by signal handlers, which write the signal number, and by
+   * arm_loop_timer (), which writes 0.
+   */
+  int              wake_fds[2];
+  pthread_mutex_t  timer_lock;
+#endif
+};
+
+#ifndef USE_EPOLL
+/* The write end of the wake-up pipe, for the signal handlers. */
+static int signal_pipe = -1;
+#endif
+
+
+static void
+dispatch_signal (event_loop_t *loop, int signal_number)
+{
+  unsigned int iter;
+
+  for (iter = 0; iter < loop->signal_count; iter++)
+    {
+      if (loop->signals[iter].signal_number == signal_number)
+        loop->signals[iter].callback (signal_number, loop->signals[iter].data);
+    }
+}
+
+#ifdef USE_EPOLL
+
+static void
+read_signals (void *data)
+{
+  event_loop_t            *loop = data;
+  struct signalfd_siginfo  info;
+
+  while (read (loop->signal_fd, &info, sizeof (info)) == sizeof (info))
+    dispatch_signal (loop, info.ssi_signo);
+}
+
+static void
+read_timer (void *data)
+{
+  loop_timer_t *timer = data;
+  uint64_t      expirations;
+
+  if (read (timer->fd, &expirations, sizeof (expirations)) > 0)
+    timer->callback (timer->data);
+}
+
+#else /* ! USE_EPOLL */
+
+static void
+signal_handler (int signal_number)
+{
+  int           saved_errno = errno;
+  unsigned char byte        = signal_number;
+
+  /* The pipe is non-blocking; if it's full, the loop is awake anyway. */
+  if (write (signal_pipe, &byte, 1) == -1)
+    {
+    }
+
+  errno = saved_errno;
+}
+
+static void
+read_wake_pipe (void *data)
+{
+  event_loop_t  *loop = data;
+  unsigned char  bytes[64];
+  ssize_t        len;
+  ssize_t        iter;
+
+  while ((len = read (loop->wake_fds[0], bytes, sizeof (bytes))) > 0)
+    {
+      for (iter = 0; iter < len; iter++)
+        {
+          if (bytes[iter] != 0)
+            dispatch_signal (loop, bytes[iter]);
+        }
+    }
+}
+
+static long
+ms_until (const struct timespec *deadline)
+{
+  struct timespec now;
+  long            ms;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  ms = (deadline->tv_sec - now.tv_sec) * 1000
+       + (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+
+  return (ms > 0) ? ms : 0;
+}
+
+#endif /* ! USE_EPOLL */
+
+event_loop_t *
+create_event_loop (void)
+{
+  event_loop_t *loop;
+
+  loop = calloc (1, sizeof (event_loop_t));
+  if (loop == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the event loop: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  atomic_init (&(loop->stopping), false);
+
+#ifdef USE_EPOLL
+  loop->signal_fd = -1;
+  sigemptyset (&(loop->signal_mask));
+  loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (loop->epoll_fd == -1)
+    {
+      fprintf (stderr, "%s: Failed to create an epoll instance: %s.\n",
+               progname, strerror (errno));
+
+      free (loop);
+      return NULL;
+    }
+#else
+  if (pipe (loop->wake_fds) == -1)
+    {
+      fprintf (stderr, "%s: Failed to create a pipe: %s.\n",
+               progname, strerror (errno));
+
+      free (loop);
+      return NULL;
+    }
+  fcntl (loop->wake_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl (loop->wake_fds[1], F_SETFL, O_NONBLOCK);
+  fcntl (loop->wake_fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl (loop->wake_fds[1], F_SETFD, FD_CLOEXEC);
+  signal_pipe = loop->wake_fds[1];
+  pthread_mutex_init (&(loop->timer_lock), NULL);
+
+  if (! watch_loop_fd (loop, loop->wake_fds[0], read_wake_pipe, loop))
+    {
+      free_event_loop (loop);
+      return NULL;
+    }
+#endif
+
+  return loop;
+}
+
+void
+free_event_loop (event_loop_t *loop)
+{
+  unsigned int iter;
+
+  if (loop == NULL)
+    return;
+
+#ifdef USE_EPOLL
+  for (iter = 0; iter < loop->timer_count; iter++)
+    close (loop->timers[iter].fd);
+  if (loop->signal_fd != -1)
+    close (loop->signal_fd);
+  close (loop->epoll_fd);
+#else
+  /* Leave the signals to their handlers, which write to a closed pipe. */
+  for (iter = 0; iter < loop->signal_count; iter++)
+    signal (loop->signals[iter].signal_number, SIG_DFL);
+  signal_pipe = -1;
+  close (loop->wake_fds[0]);
+  close (loop->wake_fds[1]);
+  pthread_mutex_destroy (&(loop->timer_lock));
+  free (loop->poll_fds);
+#endif
+
+  free (loop->watches);
+  free (loop);
+}
+
+bool
+watch_loop_fd (event_loop_t *loop, int fd, loop_callback_t callback,
+               void *data)
+{
+  loop_watch_t       *watches;
+  unsigned int        slot;
+#ifdef USE_EPOLL
+  struct epoll_event  event;
+#else
+  struct pollfd      *poll_fds;
+#endif
+
+  for (slot = 0; slot < loop->watch_count; slot++)
+    {
+      if (loop->watches[slot].fd == -1)
+        break;
+    }
+
+  if (slot == loop->watch_size)
+    {
+      watches = realloc (loop->watches,
+                         (slot + 8) * sizeof (loop_watch_t));
+      if (watches == NULL)
+        goto no_memory;
+      loop->watches = watches;
+#ifndef USE_EPOLL
+      poll_fds = realloc (loop->poll_fds, (slot + 8) * sizeof (struct pollfd));
+      if (poll_fds == NULL)
+        goto no_memory;
+      loop->poll_fds = poll_fds;
+#endif
+      loop->watch_size = slot + 8;
+    }
+
+#ifdef USE_EPOLL
+  /* The slot, unlike a pointer, stays valid when the array is moved. */
+  event.events   = EPOLLIN;
+  event.data.u32 = slot;
+  if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      fprintf (stderr, "%s: Failed to wait on a file descriptor: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+#endif
+
+  loop->watches[slot].fd       = fd;
+  loop->watches[slot].callback = callback;
+  loop->watches[slot].data     = data;
+  if (slot == loop->watch_count)
+    loop->watch_count++;
+
+  return true;
+
+no_memory:
+  fprintf (stderr, "%s: Failed to allocate the event loop's watches: %s.\n",
+           progname, strerror (errno));
+
+  return false;
+}
+
+void
+unwatch_loop_fd (event_loop_t *loop, int fd)
+{
+  unsigned int slot;
+
+  for (slot = 0; slot < loop->watch_count; slot++)
+    {
+      if (loop->watches[slot].fd == fd)
+        {
+#ifdef USE_EPOLL
+          epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+          loop->watches[slot].fd = -1;
+          break;
+        }
+    }
+}
+
+bool
+watch_loop_signal (event_loop_t *loop, int signal_number,
+                   loop_signal_callback_t callback, void *data)
+{
+#ifndef USE_EPOLL
+  struct sigaction  action;
+#endif
+  loop_signal_t    *watched;
+
+  if (loop->signal_count == LOOP_MAX_SIGNALS)
+    {
+      fprintf (stderr, "%s: Too many signals to wait for.\n", progname);
+
+      return false;
+    }
+
+#ifdef USE_EPOLL
+  sigaddset (&(loop->signal_mask), signal_number);
+  pthread_sigmask (SIG_BLOCK, &(loop->signal_mask), NULL);
+
+  if (loop->signal_fd == -1)
+    {
+      loop->signal_fd = signalfd (-1, &(loop->signal_mask),
+                                  SFD_NONBLOCK | SFD_CLOEXEC);
+      if (loop->signal_fd == -1)
+        {
+          fprintf (stderr, "%s: Failed to create a signal descriptor: %s.\n",
+                   progname, strerror (errno));
+
+          return false;
+        }
+      if (! watch_loop_fd (loop, loop->signal_fd, read_signals, loop))
+        return false;
+    }
+  else if (signalfd (loop->signal_fd, &(loop->signal_mask),
+                     SFD_NONBLOCK | SFD_CLOEXEC) == -1)
+    {
+      /* Passing the existing descriptor only changes its mask. */
+      fprintf (stderr, "%s: Failed to update the signal descriptor: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+#else
+  action.sa_flags   = SA_RESTART | SA_NOCLDSTOP;
+  action.sa_handler = signal_handler;
+  sigemptyset (&action.sa_mask);
+  if (sigaction (signal_number, &action, NULL) == -1)
+    {
+      fprintf (stderr, "%s: Failed to handle signal %d: %s.\n",
+               progname, signal_number, strerror (errno));
+
+      return false;
+    }
+#endif
+
+  watched = &(loop->signals[loop->signal_count++]);
+  watched->signal_number = signal_number;
+  watched->callback      = callback;
+  watched->data          = data;
+
+  return true;
+}
+
+loop_timer_t *
+add_loop_timer (event_loop_t *loop, loop_callback_t callback, void *data)
+{
+  loop_timer_t *timer;
+
+  if (loop->timer_count == LOOP_MAX_TIMERS)
+    {
+      fprintf (stderr, "%s: Too many timers.\n", progname);
+
+      return NULL;
+    }
+
+  timer = &(loop->timers[loop->timer_count]);
+  timer->loop     = loop;
+  timer->callback = callback;
+  timer->data     = data;
+
+#ifdef USE_EPOLL
+  timer->fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer->fd == -1)
+    {
+      fprintf (stderr, "%s: Failed to create a timer: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  if (! watch_loop_fd (loop, timer->fd, read_timer, timer))
+    {
+      close (timer->fd);
+      return NULL;
+    }
+#else
+  timer->armed = false;
+#endif
+
+  loop->timer_count++;
+  return timer;
+}
+
+void
+arm_loop_timer (loop_timer_t *timer, long delay)
+{
+#ifdef USE_EPOLL
+  struct itimerspec expiry;
+
+  memset (&expiry, 0, sizeof (expiry));
+  if (delay >= 0)
+    {
+      expiry.it_value.tv_sec  = delay / 1000;
+      expiry.it_value.tv_nsec = (delay % 1000) * 1000000;
+
+      /* An all-zero expiry would disarm the timer. */
+      if (delay == 0)
+        expiry.it_value.tv_nsec = 1;
+    }
+  timerfd_settime (timer->fd, 0, &expiry, NULL);
+#else
+  unsigned char wake = 0;
+
+  pthread_mutex_lock (&(timer->loop->timer_lock));
+  timer->armed = delay >= 0;
+  if (timer->armed)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &(timer->deadline));
+      timer->deadline.tv_sec  += delay / 1000;
+      timer->deadline.tv_nsec += (delay % 1000) * 1000000;
+      if (timer->deadline.tv_nsec >= 1000000000)
+        {
+          timer->deadline.tv_sec++;
+          timer->deadline.tv_nsec -= 1000000000;
+        }
+    }
+  pthread_mutex_unlock (&(timer->loop->timer_lock));
+
+  /* Have the loop recompute how long it may sleep. */
+  if (write (timer->loop->wake_fds[1], &wake, 1) == -1)
+    {
+    }
+#endif
+}
+
+#ifdef USE_EPOLL
+
+bool
+run_event_loop (event_loop_t *loop)
+{
+  struct epoll_event  events[LOOP_EPOLL_BATCH];
+  loop_watch_t       *watch;
+  int                 count;
+  int                 iter;
+
+  while (! atomic_load (&(loop->stopping)))
+    {
+      count = epoll_wait (loop->epoll_fd, events, LOOP_EPOLL_BATCH, -1);
+      if (count == -1)
+        {
+          if (errno == EINTR)
+            continue;
+
+          fprintf (stderr, "%s: Waiting for events failed: %s.\n",
+                   progname, strerror (errno));
+          return false;
+        }
+
+      for (iter = 0; iter < count; iter++)
+        {
+          /* An earlier callback may have removed the watch. */
+          watch = &(loop->watches[events[iter].data.u32]);
+          if (watch->fd != -1)
+            watch->callback (watch->data);
+        }
+    }
+
+  return true;
+}
+
+#else /* ! USE_EPOLL */
+
+bool
+run_event_loop (event_loop_t *loop)
+{
+  struct pollfd *fds;
+  loop_timer_t  *timer;
+  unsigned int   count;
+  unsigned int   iter;
+  long           timeout;
+  long           remaining;
+  bool           expired;
+
+  while (! atomic_load (&(loop->stopping)))
+    {
+      /* Unused slots are -1, which poll () skips. */
+      fds   = loop->poll_fds;
+      count = loop->watch_count;
+      for (iter = 0; iter < count; iter++)
+        {
+          fds[iter].fd     = loop->watches[iter].fd;
+          fds[iter].events = POLLIN;
+        }
+
+      timeout = -1;
+      pthread_mutex_lock (&(loop->timer_lock));
+      for (iter = 0; iter < loop->timer_count; iter++)
+        {
+          if (loop->timers[iter].armed)
+            {
+              remaining = ms_until (&(loop->timers[iter].deadline));
+              if (timeout == -1 || remaining < timeout)
+                timeout = remaining;
+            }
+        }
+      pthread_mutex_unlock (&(loop->timer_lock));
+
+      if (poll (fds, count, timeout) == -1)
+        {
+          if (errno == EINTR)
+            continue;
+
+          fprintf (stderr, "%s: Waiting for events failed: %s.\n",
+                   progname, strerror (errno));
+          return false;
+        }
+
+      /* Callbacks may add watches, which moves the arrays. */
+      for (iter = 0; iter < count; iter++)
+        {
+          if (loop->poll_fds[iter].revents != 0
+              && loop->watches[iter].fd != -1)
+            loop->watches[iter].callback (loop->watches[iter].data);
+        }
+
+      for (iter = 0; iter < loop->timer_count; iter++)
+        {
+          timer = &(loop->timers[iter]);
+
+          pthread_mutex_lock (&(loop->timer_lock));
+          expired = timer->armed && ms_until (&(timer->deadline)) == 0;
+          if (expired)
+            timer->armed = false;
+          pthread_mutex_unlock (&(loop->timer_lock));
+
+          if (expired)
+            timer->callback (timer->data);
+        }
+    }
+
+  return true;
+}
+
+#endif /* ! USE_EPOLL */
+
+void
+stop_event_loop (event_loop_t *loop)
+{
+  atomic_store (&(loop->stopping), true);
+}
@@ -0,0 +1,72 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_LOOP_H_
+#define _NXBELLD_LOOP_H_ 1
+
+#include "common.h"
+
+
+/**
+ * The main event loop, which waits on file descriptors, timers and signals
+ * at once.  It is built on epoll, signalfd and timerfd where available, and
+ * on poll and a self-pipe elsewhere.
+ *
+ * Callbacks run in the thread calling run_event_loop (), one at a time.
+ */
+typedef struct event_loop event_loop_t;
+typedef struct loop_timer loop_timer_t;
+
+typedef void (*loop_callback_t)        (void *data);
+typedef void (*loop_signal_callback_t) (int signal_number, void *data);
+
+event_loop_t *create_event_loop (void);
+void          free_event_loop   (event_loop_t *loop);
+
+/* Calls `callback' whenever `fd' is readable, until unwatch_loop_fd (). */
+bool watch_loop_fd   (event_loop_t *loop, int fd, loop_callback_t callback,
+                      void *data);
+void unwatch_loop_fd (event_loop_t *loop, int fd);
+
+/**
+ * Calls `callback' whenever the signal is received.  The signal is blocked,
+ * so this has to be done before any thread is started for them all to
+ * inherit the mask.
+ */
+bool watch_loop_signal (event_loop_t *loop, int signal_number,
+                        loop_signal_callback_t callback, void *data);
+
+/**
+ * One-shot timers.  arm_loop_timer () may be called from any thread; it
+ * replaces any pending expiry, and a negative delay disarms the timer.
+ */
+loop_timer_t *add_loop_timer (event_loop_t *loop, loop_callback_t callback,
+                              void *data);
+void          arm_loop_timer (loop_timer_t *timer, long delay);
+
+/**
+ * Runs the loop until a callback calls stop_event_loop ().  Returns false
+ * if waiting for events failed.
+ */
+bool run_event_loop  (event_loop_t *loop);
+void stop_event_loop (event_loop_t *loop);
+
+
+#endif /* _NXBELLD_LOOP_H_ */
@@ -25,13 +25,25 @@
 #include "pcm.h"
 #include "beep.h"
 #include "wave.h"
+#include "queue.h"
+#include "throttle.h"
+#include "player.h"
+#include "mixer.h"
+#include "convert.h"
+#include "synth.h"
+#include "share.h"
+#include "command.h"
+#include "loop.h"
+#include "session.h"
+#include "filewatch.h"
+#include "metrics.h"
 
 #include <argp.h>
 #include <unistd.h>
-#include <sys/time.h>
 #include <signal.h>
-
-#include <X11/XKBlib.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 
 #ifdef HAVE_SOUND
@@ -40,6 +52,18 @@
 #else
 # define DEFAULT_OP_MODE       COMMAND_OP_MODE
 #endif
+#define DEFAULT_IDLE_TIMEOUT   10000
+#define DEFAULT_QUEUE_LENGTH   8
+#define DEFAULT_OVERFLOW       OVERFLOW_COALESCE
+#define DEFAULT_MAX_COMMANDS   4
+
+/* The X server's own bell defaults, for when no display could be asked. */
+#define DEFAULT_BEEP_VOL       50
+#define DEFAULT_BEEP_FREQ      400
+#define DEFAULT_BEEP_DUR       100
+
+/* Marks the beep parameters to be taken from the X server. */
+#define UNSET_BEEP_PARAM       UINT_MAX
 
 const char *progname                 = PACKAGE_NAME;
 const char *argp_program_version     = PACKAGE_STRING;
@@ -54,7 +78,7 @@ static char doc[] = PACKAGE_STRING " -- the new X bell daemon.\v"
 
                     "The default mode is playing a generated sine wave beep, "
                     "and can be changed by the --sine, --complex, --square, "
-                    "--wave-file and --command options.\n\n"
+                    "--wave-file, --command and --coprocess options.\n\n"
 
                     "The --volume, --frequency and --duration options only "
                     "apply to generated beeps, and are ignored by other modes.";
@@ -65,8 +89,8 @@ static char doc[] = PACKAGE_STRING " -- the new X bell daemon.\v"
                     "beeps, or beeping by running an external command.\n\n"
 
                     "The default mode is playing a generated sine wave beep, "
-                    "and can be changed by the --sine, --complex, --square and "
-                    "--command options.\n\n"
+                    "and can be changed by the --sine, --complex, --square, "
+                    "--command and --coprocess options.\n\n"
 
                     "The --volume, --frequency and --duration options only "
                     "apply to generated beeps, and are ignored by other modes.";
@@ -76,7 +100,8 @@ static char doc[] = PACKAGE_STRING " -- the new X bell daemon.\v"
 
                     "Sound support was disabled at compile-time, therefore "
                     "you may only use " PACKAGE_NAME " to execute a command "
-                    "when the bell is rung (the --command option).";
+                    "when the bell is rung (the --command and --coprocess "
+                    "options).";
 
 #endif /* ! HAVE_SOUND */
 
@@ -87,7 +112,20 @@ static struct argp_option options[] =
   {"keep-abell", 'D', 0,      0,  "don't disable audio bell on startup" },
   {"throttle",   't', "N",    0,
    "Interval (ms) during which subsequent bells are throttled" },
+  {"burst",      'B', "N",    0,  "number of bells let through at once "
+                                  "before throttling starts (default: 1)" },
   {"test-bell",  'T', 0,      0,  "perform a bell sound as a test on startup" },
+  {"queue-length", 'Q', "N",  0,  "number of bells which may wait to be "
+                                  "played (default: 8)" },
+  {"overflow",   'O', "POLICY", 0, "what to do with a bell which can't be "
+                                  "queued: drop-newest, drop-oldest or "
+                                  "coalesce (default: coalesce)" },
+  {"display",    'x', "DISPLAY", 0, "receive bells from the given display; "
+                                  "may be given several times" },
+  {"all-displays", 'X', 0,    0,  "receive bells from every local display, "
+                                  "as they come and go" },
+  {"metrics-socket", 'S', "PATH", 0, "serve the metrics on a UNIX socket at "
+                                  "PATH" },
 
 #ifdef HAVE_SOUND
 
@@ -98,15 +136,43 @@ static struct argp_option options[] =
   {"duration",   'd', "DUR",  0,  "beep duration (ms)" },
   {"frequency",  'F', "FREQ", 0,  "beep frequency (hz)" },
   {"volume",     'v', "VOL",  0,  "beep volume (0 -- 100)" },
+  {"stream",     's', 0,      0,  "synthesize the beep while it plays, "
+                                  "instead of generating it in advance" },
+  {"per-bell",   'p', 0,      0,  "play each bell with the pitch, duration "
+                                  "and volume requested for it" },
+  {"backend",    'a', "NAME", 0,  "sound API to play through (default: "
+                                  "the fastest to open of those that work)" },
+  {"device",     'o', "DEV",  0,  "name of the playback device to use" },
+#ifdef HAVE_ALSA
+  {"alsa-access", 'A', "MODE", 0, "how to write to ALSA devices: auto, "
+                                  "mmap or rw (default: auto)" },
+#endif
+  {"keep-open",  'k', 0,      0,  "keep the playback device open and "
+                                  "configured between bells" },
+  {"mix",        'm', 0,      0,  "mix overlapping bells together instead "
+                                  "of playing them one after another" },
+  {"idle-timeout", 'I', "MS", 0,  "close a kept-open playback device after "
+                                  "MS milliseconds without a bell, 0 means "
+                                  "never (default: 10000)" },
 
 #ifdef HAVE_WAVE
   {"wave-file",  'f', "FILE", 0,  "use the given wave file for the bell" },
   {"cache",      'c', 0,      0,  "cache audio file in memory" },
 #endif
+  {"lock-memory", 'L', 0,     0,  "lock the cached sound in memory" },
+  {"share-dir",  'u', "DIR",  0,  "share the prepared sound with other "
+                                  "instances through files in DIR" },
 
 #endif /* HAVE_SOUND */
 
   {"command",    'e', "CMD",  0,  "run the given command for the bell" },
+  {"coprocess",  'P', "CMD",  0,  "start the given command once, and tell "
+                                  "it about each bell on its standard input" },
+  {"max-commands", 'M', "N",  0,  "number of commands which may run at "
+                                  "once (default: 4)" },
+  {"command-timeout", 'K', "MS", 0, "terminate a command still running "
+                                  "after MS milliseconds, 0 means never "
+                                  "(default: 0)" },
   { 0 }
 };
 
@@ -115,21 +181,39 @@ struct prog_args
   bool             background;
   bool             disable_abell;
   bool             test_bell;
+  const    char  **displays;
+  unsigned int     display_count;
+  bool             all_displays;
+  const    char   *metrics_socket;
   unsigned int     op_mode;
   unsigned int     gen_beep_type;
   unsigned int     gen_beep_vol;
   unsigned int     gen_beep_dur;
   unsigned int     gen_beep_freq;
+  bool             gen_beep_stream;
+  bool             per_bell;
+  const    char   *backend;
+  bool             keep_open;
+  bool             mix;
+  unsigned int     idle_timeout;
   unsigned int     throttle;
+  unsigned int     burst;
+  unsigned int     queue_length;
+  unsigned int     overflow;
   const    char   *wave_path;
   bool             cache_file;
+  bool             lock_memory;
+  const    char   *share_dir;
   const    char   *command;
+  unsigned int     max_commands;
+  unsigned int     command_timeout;
 };
 enum
 {
   GENERATED_BEEP_OP_MODE,
   WAVE_FILE_OP_MODE,
-  COMMAND_OP_MODE
+  COMMAND_OP_MODE,
+  COPROCESS_OP_MODE
 };
 enum
 {
@@ -139,35 +223,87 @@ enum
 };
 typedef struct prog_args prog_args_t;
 
-static void
-prog_args_set_default (prog_args_t *args, Display *display)
+/* What reloading the sound needs. */
+typedef struct reload_context reload_context_t;
+
+struct reload_context
+{
+  prog_args_t      args;       /* Before taking the X server's defaults. */
+  session_set_t   *sessions;
+  bool             mix;        /* Whether the mixer plays the sound. */
+};
+
+#ifdef HAVE_SOUND
+/* The synthesizer waveforms of the beep types. */
+static const unsigned int synth_waveform[] =
 {
-  XKeyboardState kbd_state;
+  [SINE_WAVE_BEEP]    = SYNTH_WAVE_SINE,
+  [COMPLEX_WAVE_BEEP] = SYNTH_WAVE_COMPLEX,
+  [SQUARE_WAVE_BEEP]  = SYNTH_WAVE_SQUARE
+};
+#endif
 
+static void
+prog_args_set_default (prog_args_t *args)
+{
   args->background      = false;
   args->disable_abell   = true;
   args->test_bell       = false;
+  args->displays        = NULL;
+  args->display_count   = 0;
+  args->all_displays    = false;
+  args->metrics_socket  = NULL;
   args->op_mode         = DEFAULT_OP_MODE;
 #ifdef HAVE_SOUND
   args->gen_beep_type   = DEFAULT_GEN_BEEP_TYPE;
-
-  /* Get the default bell parameters from X. */
-  if (XGetKeyboardControl (display, &kbd_state))
-    {
-      args->gen_beep_vol  = kbd_state.bell_percent;
-      args->gen_beep_dur  = kbd_state.bell_pitch;
-      args->gen_beep_freq = kbd_state.bell_duration;
-
-      if (args->gen_beep_vol == 0)
-        args->gen_beep_vol = 80;
-    }
+  args->gen_beep_vol    = UNSET_BEEP_PARAM;
+  args->gen_beep_dur    = UNSET_BEEP_PARAM;
+  args->gen_beep_freq   = UNSET_BEEP_PARAM;
+  args->gen_beep_stream = false;
+  args->per_bell        = false;
+  args->backend         = NULL;
 #endif
+  args->keep_open       = false;
+  args->mix             = false;
+  args->idle_timeout    = DEFAULT_IDLE_TIMEOUT;
   args->throttle        = 0;
+  args->burst           = 1;
+  args->queue_length    = DEFAULT_QUEUE_LENGTH;
+  args->overflow        = DEFAULT_OVERFLOW;
   args->wave_path       = NULL;
   args->cache_file      = false;
+  args->lock_memory     = false;
+  args->share_dir       = NULL;
   args->command         = NULL;
+  args->max_commands    = DEFAULT_MAX_COMMANDS;
+  args->command_timeout = 0;
 }
 
+#ifdef HAVE_SOUND
+/* Takes the beep parameters which weren't given from the X server. */
+static void
+prog_args_set_bell_defaults (prog_args_t *args, bell_display_t *display)
+{
+  unsigned int volume    = DEFAULT_BEEP_VOL;
+  unsigned int frequency = DEFAULT_BEEP_FREQ;
+  unsigned int duration  = DEFAULT_BEEP_DUR;
+
+  if (display != NULL
+      && get_bell_defaults (display, &volume, &frequency, &duration))
+    {
+      if (volume == 0)
+        volume = 80;
+    }
+
+  if (args->gen_beep_vol == UNSET_BEEP_PARAM)
+    args->gen_beep_vol = volume;
+  if (args->gen_beep_freq == UNSET_BEEP_PARAM)
+    args->gen_beep_freq = frequency;
+  if (args->gen_beep_dur == UNSET_BEEP_PARAM)
+    args->gen_beep_dur = duration;
+}
+#endif
+
 static error_t
 parse_option (int key, char *arg, struct argp_state *state)
 {
@@ -185,11 +321,39 @@ parse_option (int key, char *arg, struct argp_state *state)
       case 'T':
         args->test_bell = true;
         break;
+      case 'x':
+        args->displays = realloc (args->displays, (args->display_count + 1)
+                                                  * sizeof (const char *));
+        if (args->displays == NULL)
+          argp_failure (state, 1, errno, "Failed to allocate the display list");
+        args->displays[args->display_count++] = arg;
+        break;
+      case 'X':
+        args->all_displays = true;
+        break;
+      case 'S':
+        args->metrics_socket = arg;
+        break;
       case 't':
         args->throttle = strtoul (arg, &arg_endptr, 10);
         if (arg_endptr == NULL || arg_endptr[0] != '\0')
           argp_error (state, "The --throttle option expects an integer argument.");
         break;
+      case 'B':
+        args->burst = strtoul (arg, &arg_endptr, 10);
+        if (arg_endptr == NULL || arg_endptr[0] != '\0' || args->burst == 0)
+          argp_error (state, "The --burst option expects a positive integer argument.");
+        break;
+      case 'Q':
+        args->queue_length = strtoul (arg, &arg_endptr, 10);
+        if (arg_endptr == NULL || arg_endptr[0] != '\0'
+            || args->queue_length == 0)
+          argp_error (state, "The --queue-length option expects a positive integer argument.");
+        break;
+      case 'O':
+        if (! parse_overflow_policy (arg, &(args->overflow)))
+          argp_error (state, "The --overflow option expects one of drop-newest, drop-oldest or coalesce.");
+        break;
 #ifdef HAVE_SOUND
       case 'i':
         args->op_mode       = GENERATED_BEEP_OP_MODE;
@@ -219,6 +383,41 @@ parse_option (int key, char *arg, struct argp_state *state)
             || args->gen_beep_vol > 100)
           argp_error (state, "The --volume option expects an integer argument between 0 and 100.");
         break;
+      case 's':
+        args->gen_beep_stream = true;
+        break;
+      case 'p':
+        args->per_bell = true;
+        break;
+      case 'a':
+        args->backend = arg;
+        break;
+      case 'o':
+        pcm_device_name = arg;
+        break;
+#ifdef HAVE_ALSA
+      case 'A':
+        if (strcmp (arg, "auto") == 0)
+          pcm_device_access = PCM_ACCESS_AUTO;
+        else if (strcmp (arg, "mmap") == 0)
+          pcm_device_access = PCM_ACCESS_MMAP;
+        else if (strcmp (arg, "rw") == 0)
+          pcm_device_access = PCM_ACCESS_RW;
+        else
+          argp_error (state, "The --alsa-access option expects one of auto, mmap or rw.");
+        break;
+#endif
+      case 'k':
+        args->keep_open = true;
+        break;
+      case 'm':
+        args->mix = true;
+        break;
+      case 'I':
+        args->idle_timeout = strtoul (arg, &arg_endptr, 10);
+        if (arg_endptr == NULL || arg_endptr[0] != '\0')
+          argp_error (state, "The --idle-timeout option expects an integer argument.");
+        break;
 #ifdef HAVE_WAVE
       case 'f':
         args->op_mode    = WAVE_FILE_OP_MODE;
@@ -228,11 +427,32 @@ parse_option (int key, char *arg, struct argp_state *state)
         args->cache_file = true;
         break;
 #endif
+      case 'L':
+        args->lock_memory = true;
+        break;
+      case 'u':
+        args->share_dir = arg;
+        break;
 #endif /* HAVE_SOUND */
       case 'e':
         args->op_mode    = COMMAND_OP_MODE;
         args->command    = arg;
         break;
+      case 'P':
+        args->op_mode    = COPROCESS_OP_MODE;
+        args->command    = arg;
+        break;
+      case 'M':
+        args->max_commands = strtoul (arg, &arg_endptr, 10);
+        if (arg_endptr == NULL || arg_endptr[0] != '\0'
+            || args->max_commands == 0)
+          argp_error (state, "The --max-commands option expects a positive integer argument.");
+        break;
+      case 'K':
+        args->command_timeout = strtoul (arg, &arg_endptr, 10);
+        if (arg_endptr == NULL || arg_endptr[0] != '\0')
+          argp_error (state, "The --command-timeout option expects an integer argument.");
+        break;
 
       default:
         return ARGP_ERR_UNKNOWN;
@@ -244,6 +464,148 @@ parse_option (int key, char *arg, struct argp_state *state)
 
 static struct argp argp = { options, parse_option, 0, doc };
 
+#ifdef HAVE_SOUND
+/**
+ * Describes everything the cached sound is made from, for sharing it.  Fails
+ * if there's no such sound, or it can't be shared.
+ */
+static bool
+shared_sound_key (prog_args_t *args, char *key, size_t len)
+{
+  const char  *backend;
+  struct stat  file_stat;
+  int          written;
+
+
+  /* The mixer plays a private copy in its own format anyway. */
+  backend = pcm_backend_name ();
+  if (args->share_dir == NULL || backend == NULL || args->mix)
+    return false;
+
+  switch (args->op_mode)
+    {
+      case GENERATED_BEEP_OP_MODE:
+        if (args->gen_beep_stream)
+          return false;
+
+        /* Looked up before the device is probed, so without its rate. */
+        written = snprintf (key, len, "%s %s beep wave=%u vol=%u freq=%u "
+                                      "dur=%u",
+                            backend,
+                            pcm_device_name ? pcm_device_name : "-",
+                            synth_waveform[args->gen_beep_type],
+                            args->gen_beep_vol, args->gen_beep_freq,
+                            args->gen_beep_dur);
+        break;
+#ifdef HAVE_WAVE
+      case WAVE_FILE_OP_MODE:
+        if (! args->cache_file || stat (args->wave_path, &file_stat) != 0)
+          return false;
+
+        /* An edited file is a different sound. */
+        written = snprintf (key, len, "%s %s wave dev=%llu ino=%llu "
+                                      "size=%lld mtime=%lld.%09ld %s",
+                            backend,
+                            pcm_device_name ? pcm_device_name : "-",
+                            (unsigned long long) file_stat.st_dev,
+                            (unsigned long long) file_stat.st_ino,
+                            (long long) file_stat.st_size,
+                            (long long) file_stat.st_mtim.tv_sec,
+                            file_stat.st_mtim.tv_nsec, args->wave_path);
+        break;
+#endif
+      default:
+        return false;
+    }
+
+  return written > 0 && (size_t) written < len;
+}
+
+/**
+ * Swaps a private cached sound for the copy other instances share, which is
+ * published first if there's none yet.  Should anything fail, or the shared
+ * copy differ, the private sound stays.
+ */
+static void
+share_sound (prog_args_t *args, beep_descriptor_t *beep)
+{
+  playable_pcm_buffer_t *shared;
+  playable_pcm_buffer_t *private;
+  char                   key[PATH_MAX + 256];
+
+
+  if (beep->type != BEEP_TYPE_BUFFER || shared_pcm_buffer (beep->buffer)
+      || ! shared_sound_key (args, key, sizeof (key)))
+    return;
+
+  private = beep->buffer;
+  if (! publish_pcm_buffer (args->share_dir, key, private))
+    {
+      fprintf (stderr, "%s: Warning: The sound will not be shared.\n",
+               progname);
+      return;
+    }
+
+  /* Another instance may have published it for a differing device format. */
+  shared = map_shared_pcm_buffer (args->share_dir, key);
+  if (shared == NULL)
+    return;
+  if (shared->info.native_endian != private->info.native_endian
+      || shared->info.sign != private->info.sign
+      || shared->info.floating != private->info.floating
+      || shared->info.sample_rate != private->info.sample_rate
+      || shared->info.channels != private->info.channels
+      || shared->info.bytes_per_sample != private->info.bytes_per_sample
+      || shared->info.bits_per_sample != private->info.bits_per_sample
+      || shared->data_len != private->data_len)
+    {
+      free_pcm_buffer (shared);
+      return;
+    }
+
+  beep->buffer = shared;
+  free_pcm_buffer (private);
+}
+
+/**
+ * Maps the cached sound another instance has already shared, sparing this
+ * one from generating or loading, and converting it.  Returns NULL if there's
+ * none.
+ */
+static beep_descriptor_t *
+lookup_shared_beep (prog_args_t *args)
+{
+  beep_descriptor_t     *beep;
+  playable_pcm_buffer_t *buffer;
+  char                   key[PATH_MAX + 256];
+
+
+  if (! shared_sound_key (args, key, sizeof (key)))
+    return NULL;
+
+  buffer = map_shared_pcm_buffer (args->share_dir, key);
+  if (buffer == NULL)
+    return NULL;
+
+  beep = malloc (sizeof (beep_descriptor_t));
+  if (beep == NULL)
+    {
+      free_pcm_buffer (buffer);
+      return NULL;
+    }
+
+  beep->type   = BEEP_TYPE_BUFFER;
+  beep->buffer = buffer;
+  beep->cache  = NULL;
+
+  /* Per-bell beeps are generated at the same rate as the shared one. */
+  if (args->op_mode == GENERATED_BEEP_OP_MODE)
+    beep_sample_rate = buffer->info.sample_rate;
+
+  return beep;
+}
+#endif /* HAVE_SOUND */
+
 beep_descriptor_t *prepare_beep (prog_args_t *args)
 {
   beep_descriptor_t *beep;
@@ -256,10 +618,14 @@ beep_descriptor_t *prepare_beep (prog_args_t *args)
 
       return NULL;
     }
+#ifdef HAVE_SOUND
+  beep->cache = NULL;
+#endif
 
   switch (args->op_mode)
     {
       case COMMAND_OP_MODE:
+      case COPROCESS_OP_MODE:
         if (args->command == NULL)
           {
             fprintf (stderr, "%s: No external bell command specified.\n",
@@ -268,7 +634,8 @@ beep_descriptor_t *prepare_beep (prog_args_t *args)
             free (beep);
             return NULL;
           }
-        beep->type = BEEP_TYPE_COMMAND;
+        beep->type = (args->op_mode == COMMAND_OP_MODE) ? BEEP_TYPE_COMMAND
+                                                        : BEEP_TYPE_COPROCESS;
         beep->command = strdup (args->command);
         if (beep->command == NULL)
           {
@@ -278,9 +645,45 @@ beep_descriptor_t *prepare_beep (prog_args_t *args)
             free (beep);
             return NULL;
           }
+        beep->argv = split_command (beep->command);
+        if (beep->argv == NULL)
+          {
+            free (beep->command);
+            free (beep);
+            return NULL;
+          }
+        if (beep->type == BEEP_TYPE_COPROCESS)
+          {
+            beep->coprocess = start_coprocess (beep->argv);
+            if (beep->coprocess == NULL)
+              {
+                free (beep->argv);
+                free (beep->command);
+                free (beep);
+                return NULL;
+              }
+          }
         break;
 #ifdef HAVE_SOUND
       case GENERATED_BEEP_OP_MODE:
+        if (args->gen_beep_stream)
+          {
+            beep->type   = BEEP_TYPE_STREAM;
+            beep->stream = prepare_beep_stream (
+                             synth_waveform[args->gen_beep_type],
+                             args->gen_beep_vol, args->gen_beep_freq,
+                             args->gen_beep_dur);
+            if (beep->stream == NULL)
+              {
+                fprintf (stderr, "%s: Failed to prepare the beep.\n",
+                         progname);
+
+                free (beep);
+                return NULL;
+              }
+            break;
+          }
+
         beep->type = BEEP_TYPE_BUFFER;
         switch (args->gen_beep_type)
           {
@@ -356,44 +759,118 @@ beep_descriptor_t *prepare_beep (prog_args_t *args)
   return beep;
 }
 
+#ifdef HAVE_SOUND
+/* Sets up what was asked for on top of a prepared and converted sound. */
 static void
-bell_daemon (Display *display, int event_code, beep_descriptor_t *beep,
-             unsigned int suppress_interval)
+finish_sound_setup (prog_args_t *args, beep_descriptor_t *beep)
 {
-  XkbEvent           event;
-  struct timeval     now;
-  struct timeval     last_bell;
-  unsigned long      ms_since_last_bell;
+  if (args->per_bell)
+    {
+      if (args->op_mode != GENERATED_BEEP_OP_MODE
+          || beep->type != BEEP_TYPE_BUFFER)
+        fprintf (stderr, "%s: Warning: Only pre-generated beeps can follow "
+                         "the parameters requested for each bell.\n",
+                 progname);
+      else if (! enable_per_bell_beeps (beep,
+                                        synth_waveform[args->gen_beep_type],
+                                        args->gen_beep_vol,
+                                        args->gen_beep_freq,
+                                        args->gen_beep_dur,
+                                        args->mix ? mixer_uses_sound : NULL))
+        fprintf (stderr, "%s: Warning: Every bell will sound the same.\n",
+                 progname);
+    }
 
-  gettimeofday (&last_bell, NULL);
-  while (true)
+  if (args->lock_memory && beep->type == BEEP_TYPE_BUFFER)
     {
-      XNextEvent (display, &event.core);
-      if (event.type == event_code)
+      if (! lock_pcm_buffer (beep->buffer))
+        fprintf (stderr, "%s: Warning: The sound may have to be paged in "
+                         "when the bell is rung.\n",
+                 progname);
+    }
+
+  /* A sound server may keep the sound, so that bells only name it. */
+  if (! args->mix && beep->type == BEEP_TYPE_BUFFER
+      && ! upload_pcm_buffer (beep->buffer))
+    fprintf (stderr, "%s: Warning: The sound will be sent to the sound "
+                     "server for every bell.\n",
+             progname);
+}
+#endif
+
+/**
+ * Prepares the sound again, taking the bell parameters the X server has now,
+ * and hands it over to the player.  The whole work is done here, in the main
+ * loop, so the player only has to switch pointers; should anything fail, the
+ * current sound stays.
+ */
+static void
+reload_sound (void *data)
+{
+#ifdef HAVE_SOUND
+  reload_context_t  *context = data;
+  prog_args_t        args;
+  beep_descriptor_t *beep;
+
+  /* A bell command is run anew for every bell anyway. */
+  if (context->args.op_mode != GENERATED_BEEP_OP_MODE
+      && context->args.op_mode != WAVE_FILE_OP_MODE)
+    return;
+
+  args     = context->args;
+  args.mix = context->mix;
+  prog_args_set_bell_defaults (&args, any_session_display (context->sessions));
+
+  /* Another instance may have shared the new sound already. */
+  beep = lookup_shared_beep (&args);
+  if (beep == NULL)
+    beep = prepare_beep (&args);
+  if (beep == NULL)
+    {
+      fprintf (stderr, "%s: Warning: Keeping the current sound.\n",
+               progname);
+      return;
+    }
+
+  if (beep->type == BEEP_TYPE_BUFFER && ! shared_pcm_buffer (beep->buffer))
+    {
+      if (! convert_pcm_buffer_for_device (beep->buffer) && ! args.mix)
+        fprintf (stderr, "%s: Warning: The sound will be played in its "
+                         "original format.\n",
+                 progname);
+      share_sound (&args, beep);
+      if (args.mix && ! convert_for_mixer (beep->buffer))
         {
-          if (suppress_interval > 0)
-            {
-              gettimeofday (&now, NULL);
-              ms_since_last_bell = (1000 * (now.tv_sec - last_bell.tv_sec))
-                                 + ((now.tv_usec - last_bell.tv_usec) / 1000);
-
-              if (ms_since_last_bell > suppress_interval)
-                {
-                  if (! perform_beep (beep))
-                    fprintf (stderr, "%s: Warning: Performing a beep failed.\n",
-                             progname);
-
-                  gettimeofday (&last_bell, NULL);
-                }
-            }
-          else
-            {
-              if (! perform_beep (beep))
-                fprintf (stderr, "%s: Warning: Performing a beep failed.\n",
-                         progname);
-            }
+          fprintf (stderr, "%s: Warning: Keeping the current sound.\n",
+                   progname);
+          free_beep_desc (beep);
+          return;
         }
     }
+  finish_sound_setup (&args, beep);
+
+  replace_player_beep (beep);
+  fprintf (stderr, "%s: Reloaded the sound.\n", progname);
+#endif
+}
+
+static void
+reload_daemon (int signal_number, void *data)
+{
+  reload_sound (data);
+}
+
+static void
+dump_metrics (int signal_number, void *data)
+{
+  write_metrics (stderr);
+  fflush (stderr);
+}
+
+static void
+quit_daemon (int signal_number, void *data)
+{
+  stop_event_loop (data);
 }
 
 int
@@ -403,57 +880,46 @@ main (int argc, char **argv)
   beep_descriptor_t *beep;
 
   struct sigaction   action;
-  Display           *display;
-  int                major;
-  int                minor;
-  int                xkb_event_code;
-  int                xkb_error;
+  session_set_t     *sessions;
+  reload_context_t   context;
+#ifdef HAVE_SYS_INOTIFY_H
+  file_watch_t      *watch;
+#endif
+  unsigned int       iter;
+  bool               keep_open;
+  bool               clean_exit;
+  bell_queue_t      *queue;
+  event_loop_t      *loop;
+
+  prog_args_set_default (&args);
+  argp_parse (&argp, argc, argv, 0, 0, &args);
+  context.args = args;
 
   /**
-   * Set signal masks. Dead children are not waitpid()'d, so make sure they
-   * don't become zombies.
+   * Serving several displays, nxbelld keeps running while any of them is
+   * missing, and connects to it once it's back.
    */
-  action.sa_flags = SA_NOCLDWAIT;
-  action.sa_handler = SIG_IGN;
-  sigemptyset (&action.sa_mask);
-  sigaction (SIGCHLD, &action, NULL);
-
-  major = XkbMajorVersion;
-  minor = XkbMinorVersion;
-  display = XkbOpenDisplay (NULL, &xkb_event_code, NULL, &major, &minor,
-                            &xkb_error);
-  if (display == NULL)
+  sessions = create_session_set (args.throttle, args.burst, args.disable_abell,
+                                 args.display_count > 1 || args.all_displays);
+  if (sessions == NULL)
+    return 1;
+  if (args.display_count == 0 && ! args.all_displays)
     {
-      switch (xkb_error)
-        {
-          case XkbOD_BadLibraryVersion:
-            fprintf (stderr, "%s: Xkb version %d.%02d is required (got library "
-                             "%d.%02d).\n",
-                     progname, XkbMajorVersion, XkbMinorVersion, major, minor);
-            break;
-          case XkbOD_ConnectionRefused:
-            fprintf (stderr, "%s: Cannot open the display: connection refused.\n",
-                     progname);
-            break;
-          case XkbOD_NonXkbServer:
-            fprintf (stderr, "%s: XKB extension not present.\n", progname);
-            break;
-          case XkbOD_BadServerVersion:
-            fprintf (stderr, "%s: Xkb version %d.%02d is required (got server "
-                             "%d.%02d).\n",
-                     progname, XkbMajorVersion, XkbMinorVersion, major, minor);
-            break;
-          default:
-            fprintf (stderr, "%s: Unknown error %d from XkbOpenDisplay",
-                     progname, xkb_error);
-            break;
-        }
-
-      return 1;
+      if (! add_session (sessions, NULL))
+        return 1;
+    }
+  for (iter = 0; iter < args.display_count; iter++)
+    {
+      if (! add_session (sessions, args.displays[iter]))
+        return 1;
     }
+  if (args.all_displays)
+    discover_sessions (sessions);
+  context.sessions = sessions;
 
-  prog_args_set_default (&args, display);
-  argp_parse (&argp, argc, argv, 0, 0, &args);
+#ifdef HAVE_SOUND
+  prog_args_set_bell_defaults (&args, any_session_display (sessions));
+#endif
 
   if (args.background)
     {
@@ -472,36 +938,158 @@ main (int argc, char **argv)
         }
     }
 
-  beep = prepare_beep (&args);
+  /* Signals are blocked from here on, so no thread may be started before. */
+  loop = create_event_loop ();
+  if (loop == NULL
+      || ! watch_loop_signal (loop, SIGTERM, quit_daemon, loop)
+      || ! watch_loop_signal (loop, SIGINT,  quit_daemon, loop)
+      || ! watch_loop_signal (loop, SIGHUP,  reload_daemon, &context)
+      || ! watch_loop_signal (loop, SIGUSR1, dump_metrics, NULL))
+    return 1;
+
+#ifdef HAVE_SOUND
+  if ((args.op_mode == GENERATED_BEEP_OP_MODE
+       || args.op_mode == WAVE_FILE_OP_MODE)
+      && ! select_pcm_backend (args.backend))
+    return 1;
+
+  /* Another instance may have made the very same sound already. */
+  beep = lookup_shared_beep (&args);
+
+  /* Generate beeps at the playback device's own rate. */
+  if (beep == NULL && args.op_mode == GENERATED_BEEP_OP_MODE
+      && ! probe_beep_sample_rate ())
+    fprintf (stderr, "%s: Warning: Failed to query the playback device's "
+                     "sampling rate.\n",
+             progname);
+#else
+  beep = NULL;
+#endif
+
+  if (beep == NULL)
+    beep = prepare_beep (&args);
   if (beep == NULL)
     {
       fprintf (stderr, "%s: Preparing the beeping mechanism failed.\n",
                progname);
       return 1;
     }
-  if (args.test_bell)
+
+  /**
+   * Bell commands are reaped by the event loop.  Nothing else is run, so
+   * in the other modes dead children are simply not waitpid()'d; make sure
+   * they don't become zombies.
+   */
+  if (beep->type == BEEP_TYPE_COMMAND)
     {
-      if (! perform_beep (beep))
-        fprintf (stderr, "%s: Warning: Failed to perform the test beep.\n",
+      if (! start_command_tracking (loop, args.max_commands,
+                                    args.command_timeout))
+        return 1;
+    }
+  else
+    {
+      action.sa_flags = SA_NOCLDWAIT;
+      action.sa_handler = SIG_IGN;
+      sigemptyset (&action.sa_mask);
+      sigaction (SIGCHLD, &action, NULL);
+    }
+
+#ifdef HAVE_SOUND
+  /* Spare the sound API from converting the sound on every bell. */
+  if (beep->type == BEEP_TYPE_BUFFER && ! shared_pcm_buffer (beep->buffer))
+    {
+      if (! convert_pcm_buffer_for_device (beep->buffer))
+        fprintf (stderr, "%s: Warning: The sound will be played in its "
+                         "original format.\n",
                  progname);
+      share_sound (&args, beep);
     }
 
-  XkbSelectEvents (display, XkbUseCoreKbd, XkbBellNotifyMask, XkbBellNotifyMask);
-  if (args.disable_abell)
+  /* The mixer needs a cached sound, and keeps its output device open. */
+  if (args.mix)
     {
-      if (! XkbChangeEnabledControls (display, XkbUseCoreKbd,
-                                      XkbAudibleBellMask, 0))
+      if (beep->type != BEEP_TYPE_BUFFER)
         {
-          fprintf (stderr, "%s: Couldn't disable the system's audible bell.\n",
+          fprintf (stderr, "%s: Warning: Mixing is only possible with "
+                           "pre-generated or cached sounds.\n",
                    progname);
-          return 1;
+          args.mix = false;
         }
+      else if (! start_mixer (beep->buffer))
+        {
+          fprintf (stderr, "%s: Warning: Failed to start the mixer, bells "
+                           "will be played one after another.\n",
+                   progname);
+          args.mix = false;
+        }
+      else
+        args.keep_open = true;
+    }
+
+  finish_sound_setup (&args, beep);
+#endif
+  context.mix = args.mix;
+
+  /* Have the device ready before the first bell is rung. */
+  keep_open = args.keep_open && beep->type != BEEP_TYPE_COMMAND
+              && beep->type != BEEP_TYPE_COPROCESS;
+  if (keep_open)
+    {
+      if (! open_beep_device (beep))
+        fprintf (stderr, "%s: Warning: Failed to open the playback device "
+                         "ahead of time.\n",
+                 progname);
+    }
+  if (args.test_bell)
+    {
+      if (! perform_beep (beep))
+        fprintf (stderr, "%s: Warning: Failed to perform the test beep.\n",
+                 progname);
     }
 
-  bell_daemon (display, xkb_event_code, beep, args.throttle);
+  queue = create_bell_queue (args.queue_length, args.overflow);
+  if (queue == NULL)
+    {
+      fprintf (stderr, "%s: Failed to create the bell queue.\n", progname);
+      return 1;
+    }
+  if (! start_player (queue, beep, keep_open, args.idle_timeout, args.mix))
+    return 1;
 
-  XCloseDisplay (display);
+#ifdef HAVE_SYS_INOTIFY_H
+  /* Pick up a sound file which was edited or replaced. */
+  watch = NULL;
+  if (args.op_mode == WAVE_FILE_OP_MODE)
+    {
+      watch = watch_file (loop, args.wave_path, reload_sound, &context);
+      if (watch == NULL)
+        fprintf (stderr, "%s: Warning: Changes to `%s' will only be picked "
+                         "up on SIGHUP.\n",
+                 progname, args.wave_path);
+    }
+#endif
+
+  set_metrics_sources (queue, sessions);
+  if (args.metrics_socket != NULL
+      && ! serve_metrics (loop, args.metrics_socket))
+    return 1;
+
+  if (! start_sessions (sessions, loop, queue))
+    return 1;
+  clean_exit = run_event_loop (loop) && ! sessions->lost;
+
+  stop_serving_metrics ();
+  set_metrics_sources (NULL, NULL);
+  close_session_set (sessions);
+#ifdef HAVE_SYS_INOTIFY_H
+  free_file_watch (watch);
+#endif
+  stop_player ();
+  beep = current_player_beep ();
+  close_beep_device (beep);
   free_beep_desc (beep);
+  free_bell_queue (queue);
+  free_event_loop (loop);
 
-  return 0;
+  return clean_exit ? 0 : 1;
 }
@@ -0,0 +1,424 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "metrics.h"
+#include "pcm.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * Values below 2 * LATENCY_SUB_BUCKETS microseconds get a bucket each,
+ * every power of two above that is split into LATENCY_SUB_BUCKETS buckets.
+ * Latencies are kept up to 2^32 us, a little over an hour.
+ */
+#define LATENCY_SUB_BITS     4
+#define LATENCY_SUB_BUCKETS  (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS     32
+#define LATENCY_BUCKETS      ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) \
+                              * LATENCY_SUB_BUCKETS)
+
+typedef struct latency_histogram latency_histogram_t;
+
+struct latency_histogram
+{
+  atomic_ulong  buckets[LATENCY_BUCKETS];
+  atomic_ullong sum;         /* In microseconds. */
+  atomic_ullong max;
+};
+
+static const char *counter_names[METRIC_COUNTERS] =
+{
+  [METRIC_BELLS_RECEIVED]     = "bells_received_total",
+  [METRIC_BELLS_THROTTLED]    = "bells_throttled_total",
+  [METRIC_BELLS_PLAYED]       = "bells_played_total",
+  [METRIC_BELLS_FAILED]       = "bells_failed_total",
+  [METRIC_XRUNS]              = "xruns_total",
+  [METRIC_DEVICE_OPENS]       = "device_opens_total",
+  [METRIC_BACKEND_FAILOVERS]  = "sound_backend_failovers_total",
+  [METRIC_VOICES_STOLEN]      = "mixer_voices_stolen_total",
+  [METRIC_CACHE_HITS]         = "beep_cache_hits_total",
+  [METRIC_CACHE_MISSES]       = "beep_cache_misses_total",
+  [METRIC_CACHE_EVICTIONS]    = "beep_cache_evictions_total",
+  [METRIC_COMMANDS_STARTED]   = "commands_started_total",
+  [METRIC_COMMANDS_DROPPED]   = "commands_dropped_total",
+  [METRIC_COMMANDS_KILLED]    = "commands_killed_total",
+  [METRIC_COPROCESS_SENT]     = "coprocess_bells_sent_total",
+  [METRIC_COPROCESS_DROPPED]  = "coprocess_bells_dropped_total",
+  [METRIC_COPROCESS_RESTARTS] = "coprocess_restarts_total"
+};
+
+static const char *histogram_names[LATENCY_HISTOGRAMS] =
+{
+  [LATENCY_FIRST_SAMPLE] = "first_sample_latency_seconds",
+  [LATENCY_DRAIN]        = "drain_latency_seconds"
+};
+
+/* The quantiles reported of every histogram; 1 is the maximum. */
+static const double latency_quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1 };
+
+static atomic_ulong        counters[METRIC_COUNTERS];
+static latency_histogram_t histograms[LATENCY_HISTOGRAMS];
+
+/* The bell being timed by the playback thread. */
+static struct timespec     timed_bell;
+static bool                timing  = false;
+static bool                sounded = false;
+
+static bell_queue_t       *source_queue    = NULL;
+static session_set_t      *source_sessions = NULL;
+
+static event_loop_t       *server_loop  = NULL;
+static int                 server_fd    = -1;
+static char               *server_path  = NULL;
+static bool                server_bound = false;
+
+
+void
+count_metric (unsigned int counter)
+{
+  atomic_fetch_add_explicit (&(counters[counter]), 1, memory_order_relaxed);
+}
+
+unsigned long
+metric_value (unsigned int counter)
+{
+  return atomic_load_explicit (&(counters[counter]), memory_order_relaxed);
+}
+
+static unsigned int
+latency_bucket (uint64_t value)
+{
+  unsigned int shift;
+
+  if (value >= (UINT64_C (1) << LATENCY_MAX_BITS))
+    value = (UINT64_C (1) << LATENCY_MAX_BITS) - 1;
+
+  shift = 0;
+  while ((value >> shift) >= 2 * LATENCY_SUB_BUCKETS)
+    shift++;
+
+  if (shift == 0)
+    return value;
+
+  return (shift + 1) * LATENCY_SUB_BUCKETS
+         + (value >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/* The highest value which falls into the bucket. */
+static uint64_t
+latency_bucket_limit (unsigned int bucket)
+{
+  unsigned int shift;
+
+  if (bucket < 2 * LATENCY_SUB_BUCKETS)
+    return bucket;
+
+  shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return (((uint64_t) (bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS + 1))
+          << shift) - 1;
+}
+
+void
+record_latency (unsigned int histogram, const struct timespec *since)
+{
+  latency_histogram_t *target = &(histograms[histogram]);
+  struct timespec      now;
+  int64_t              elapsed;
+  uint64_t             value;
+  unsigned long long   max;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  elapsed = (int64_t) (now.tv_sec - since->tv_sec) * 1000000
+            + (now.tv_nsec - since->tv_nsec) / 1000;
+  value = (elapsed > 0) ? elapsed : 0;
+
+  atomic_fetch_add_explicit (&(target->buckets[latency_bucket (value)]), 1,
+                             memory_order_relaxed);
+  atomic_fetch_add_explicit (&(target->sum), value, memory_order_relaxed);
+
+  max = atomic_load_explicit (&(target->max), memory_order_relaxed);
+  while (value > max
+         && ! atomic_compare_exchange_weak_explicit (&(target->max), &max,
+                                                     value,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+    ;
+}
+
+void
+start_bell_timing (const struct timespec *received)
+{
+  timed_bell = *received;
+  timing     = true;
+  sounded    = false;
+}
+
+void
+note_first_sample (void)
+{
+  if (! timing || sounded)
+    return;
+
+  record_latency (LATENCY_FIRST_SAMPLE, &timed_bell);
+  sounded = true;
+}
+
+void
+finish_bell_timing (bool drained)
+{
+  if (timing && sounded && drained)
+    record_latency (LATENCY_DRAIN, &timed_bell);
+
+  timing = false;
+}
+
+bool
+timed_bell_received (struct timespec *received)
+{
+  if (timing)
+    *received = timed_bell;
+
+  return timing;
+}
+
+void
+set_metrics_sources (bell_queue_t *queue, session_set_t *sessions)
+{
+  source_queue    = queue;
+  source_sessions = sessions;
+}
+
+static void
+write_histogram (FILE *out, unsigned int histogram)
+{
+  latency_histogram_t *source = &(histograms[histogram]);
+  unsigned long        counts[LATENCY_BUCKETS];
+  unsigned long        total;
+  unsigned long        rank;
+  unsigned long        seen;
+  uint64_t             max;
+  uint64_t             value;
+  unsigned int         bucket;
+  unsigned int         iter;
+
+  /* Work on a snapshot, so the quantiles agree with each other. */
+  total = 0;
+  for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+      counts[bucket] = atomic_load_explicit (&(source->buckets[bucket]),
+                                             memory_order_relaxed);
+      total += counts[bucket];
+    }
+  max = atomic_load_explicit (&(source->max), memory_order_relaxed);
+
+  fprintf (out, "# TYPE nxbelld_%s summary\n", histogram_names[histogram]);
+  for (iter = 0; iter < sizeof (latency_quantiles) / sizeof (double); iter++)
+    {
+      if (total == 0)
+        {
+          fprintf (out, "nxbelld_%s{quantile=\"%g\"} NaN\n",
+                   histogram_names[histogram], latency_quantiles[iter]);
+          continue;
+        }
+
+      rank = total - (unsigned long) ((1 - latency_quantiles[iter]) * total);
+      seen = 0;
+      for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        {
+          seen += counts[bucket];
+          if (seen >= rank)
+            break;
+        }
+      value = latency_bucket_limit (bucket);
+      if (value > max)
+        value = max;
+
+      fprintf (out, "nxbelld_%s{quantile=\"%g\"} %.6f\n",
+               histogram_names[histogram], latency_quantiles[iter],
+               value / 1e6);
+    }
+  fprintf (out, "nxbelld_%s_sum %.6f\n", histogram_names[histogram],
+           atomic_load_explicit (&(source->sum), memory_order_relaxed) / 1e6);
+  fprintf (out, "nxbelld_%s_count %lu\n", histogram_names[histogram], total);
+}
+
+void
+write_metrics (FILE *out)
+{
+  unsigned int iter;
+
+#ifdef HAVE_SOUND
+  size_t       bytes;
+  size_t       resident;
+#endif
+
+  for (iter = 0; iter < METRIC_COUNTERS; iter++)
+    fprintf (out, "# TYPE nxbelld_%s counter\n"
+                  "nxbelld_%s %lu\n",
+             counter_names[iter], counter_names[iter], metric_value (iter));
+
+  if (source_queue != NULL)
+    {
+      fprintf (out, "# TYPE nxbelld_queue_bells_total counter\n"
+                    "nxbelld_queue_bells_total{outcome=\"enqueued\"} %lu\n"
+                    "nxbelld_queue_bells_total{outcome=\"dropped_newest\"} %lu\n"
+                    "nxbelld_queue_bells_total{outcome=\"dropped_oldest\"} %lu\n"
+                    "nxbelld_queue_bells_total{outcome=\"coalesced\"} %lu\n",
+               atomic_load (&(source_queue->enqueued)),
+               atomic_load (&(source_queue->dropped_newest)),
+               atomic_load (&(source_queue->dropped_oldest)),
+               atomic_load (&(source_queue->coalesced)));
+    }
+
+  for (iter = 0; iter < LATENCY_HISTOGRAMS; iter++)
+    write_histogram (out, iter);
+
+#ifdef HAVE_SOUND
+  measure_pcm_buffers (&bytes, &resident);
+  fprintf (out, "# TYPE nxbelld_pcm_bytes gauge\n"
+                "nxbelld_pcm_bytes %zu\n"
+                "# TYPE nxbelld_pcm_resident_bytes gauge\n"
+                "nxbelld_pcm_resident_bytes %zu\n",
+           bytes, resident);
+
+  write_backend_metrics (out);
+#endif
+
+  if (source_sessions != NULL)
+    write_session_metrics (source_sessions, out);
+}
+
+static void
+answer_metrics_clients (void *unused)
+{
+  FILE   *stream;
+  char   *text;
+  size_t  len;
+  int     client;
+
+  while ((client = accept (server_fd, NULL, NULL)) != -1)
+    {
+      text   = NULL;
+      len    = 0;
+      stream = open_memstream (&text, &len);
+      if (stream != NULL)
+        {
+          write_metrics (stream);
+          if (fclose (stream) == 0)
+            {
+              /* The dump is small enough for the socket buffer. */
+              if (send (client, text, len, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+                fprintf (stderr, "%s: Failed to send the metrics: %s.\n",
+                         progname, strerror (errno));
+            }
+          free (text);
+        }
+      close (client);
+    }
+}
+
+bool
+serve_metrics (event_loop_t *loop, const char *path)
+{
+  struct sockaddr_un address;
+  struct stat        status;
+
+  if (strlen (path) >= sizeof (address.sun_path))
+    {
+      fprintf (stderr, "%s: The metrics socket path `%s' is too long.\n",
+               progname, path);
+
+      return false;
+    }
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strcpy (address.sun_path, path);
+
+  server_path = strdup (path);
+  if (server_path == NULL)
+    {
+      fprintf (stderr, "%s: Failed to copy the metrics socket path: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+
+  server_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (server_fd == -1)
+    {
+      fprintf (stderr, "%s: Failed to create the metrics socket: %s.\n",
+               progname, strerror (errno));
+
+      stop_serving_metrics ();
+      return false;
+    }
+  fcntl (server_fd, F_SETFD, FD_CLOEXEC);
+  fcntl (server_fd, F_SETFL, O_NONBLOCK);
+
+  if (lstat (path, &status) == 0 && S_ISSOCK (status.st_mode))
+    unlink (path);
+  server_bound = (bind (server_fd, (struct sockaddr *) &address,
+                        sizeof (address)) == 0);
+  if (! server_bound
+      || chmod (path, S_IRUSR | S_IWUSR) == -1
+      || listen (server_fd, 4) == -1)
+    {
+      fprintf (stderr, "%s: Failed to listen on `%s': %s.\n",
+               progname, path, strerror (errno));
+
+      stop_serving_metrics ();
+      return false;
+    }
+
+  if (! watch_loop_fd (loop, server_fd, answer_metrics_clients, NULL))
+    {
+      stop_serving_metrics ();
+      return false;
+    }
+  server_loop = loop;
+
+  return true;
+}
+
+void
+stop_serving_metrics (void)
+{
+  if (server_loop != NULL)
+    unwatch_loop_fd (server_loop, server_fd);
+  if (server_fd != -1)
+    close (server_fd);
+  if (server_bound)
+    unlink (server_path);
+
+  free (server_path);
+  server_path  = NULL;
+  server_fd    = -1;
+  server_bound = false;
+  server_loop  = NULL;
+}
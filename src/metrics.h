@@ -0,0 +1,106 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_METRICS_H_
+#define _NXBELLD_METRICS_H_ 1
+
+#include "common.h"
+#include "queue.h"
+#include "session.h"
+#include "loop.h"
+
+#include <time.h>
+
+
+/**
+ * Counters of what nxbelld did, kept with relaxed atomic increments so that
+ * any thread may count, and any other may read them at any time.
+ */
+enum
+{
+  METRIC_BELLS_RECEIVED,
+  METRIC_BELLS_THROTTLED,
+  METRIC_BELLS_PLAYED,
+  METRIC_BELLS_FAILED,
+  METRIC_XRUNS,
+  METRIC_DEVICE_OPENS,
+  METRIC_BACKEND_FAILOVERS,
+  METRIC_VOICES_STOLEN,
+  METRIC_CACHE_HITS,
+  METRIC_CACHE_MISSES,
+  METRIC_CACHE_EVICTIONS,
+  METRIC_COMMANDS_STARTED,
+  METRIC_COMMANDS_DROPPED,
+  METRIC_COMMANDS_KILLED,
+  METRIC_COPROCESS_SENT,
+  METRIC_COPROCESS_DROPPED,
+  METRIC_COPROCESS_RESTARTS,
+  METRIC_COUNTERS
+};
+
+void          count_metric (unsigned int counter);
+unsigned long metric_value (unsigned int counter);
+
+/**
+ * Latency histograms, from the moment a bell was received to its first
+ * sample being handed to the playback device, and to the device having
+ * played it all.  They are log-linear: every power of two is split into
+ * 16 buckets, so a recorded latency is off by at most 1/16th.
+ */
+enum
+{
+  LATENCY_FIRST_SAMPLE,
+  LATENCY_DRAIN,
+  LATENCY_HISTOGRAMS
+};
+
+/* Records the time elapsed since the CLOCK_MONOTONIC time `since'. */
+void record_latency (unsigned int histogram, const struct timespec *since);
+
+/**
+ * Timing of a bell played on its own.  The playback thread starts timing
+ * the bell, the sound API backends note its first sample being written,
+ * and the playback thread finishes the timing once the device has drained
+ * the bell, or playing it failed.  Bells which produce no sound, such as
+ * commands, record no latencies.
+ */
+void start_bell_timing  (const struct timespec *received);
+void note_first_sample  (void);
+void finish_bell_timing (bool drained);
+
+/* Gives the reception time of the bell being timed, if there is one. */
+bool timed_bell_received (struct timespec *received);
+
+/* Where the queue and display counters are taken from, either may be NULL. */
+void set_metrics_sources (bell_queue_t *queue, session_set_t *sessions);
+
+/* Writes all of the metrics in the Prometheus text exposition format. */
+void write_metrics (FILE *out);
+
+/**
+ * Serves the metrics on a UNIX socket at `path': every client which connects
+ * is sent a dump, and disconnected.  A stale socket left at `path' is
+ * replaced.
+ */
+bool serve_metrics        (event_loop_t *loop, const char *path);
+void stop_serving_metrics (void);
+
+
+#endif /* _NXBELLD_METRICS_H_ */
@@ -0,0 +1,289 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+#include "mixer.h"
+#include "convert.h"
+#include "metrics.h"
+
+#if defined (__SSE2__)
+# include <emmintrin.h>
+#elif defined (__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+/* The device is asked to buffer this many periods. */
+#define MIXER_PERIODS 3
+
+typedef struct mixer_voice mixer_voice_t;
+
+struct mixer_voice
+{
+  const int16_t   *samples;
+  uint32_t         position;
+  uint32_t         length;
+
+  struct timespec  received;   /* When its bell was received. */
+};
+
+static mixer_voice_t    voices[MIXER_VOICES];
+static unsigned int     active_voices = 0;
+static pcm_data_info_t  mixer_info;
+static int16_t         *period       = NULL;
+static uint32_t         period_len;   /* In samples. */
+static bool             device_ready = false;
+
+
+/* Adds `in' to `out', saturating at the limits of a 16-bit sample. */
+static void
+mix_samples (int16_t *restrict out, const int16_t *restrict in, uint32_t count)
+{
+  uint32_t iter = 0;
+  int32_t  sum;
+
+#if defined (__SSE2__)
+  for (; iter + 8 <= count; iter += 8)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i *)(out + iter));
+      __m128i b = _mm_loadu_si128 ((const __m128i *)(in + iter));
+
+      _mm_storeu_si128 ((__m128i *)(out + iter), _mm_adds_epi16 (a, b));
+    }
+#elif defined (__ARM_NEON)
+  for (; iter + 8 <= count; iter += 8)
+    vst1q_s16 (out + iter, vqaddq_s16 (vld1q_s16 (out + iter),
+                                       vld1q_s16 (in + iter)));
+#endif
+
+  for (; iter < count; iter++)
+    {
+      sum = out[iter] + in[iter];
+      if (sum > INT16_MAX)
+        sum = INT16_MAX;
+      else if (sum < INT16_MIN)
+        sum = INT16_MIN;
+
+      out[iter] = sum;
+    }
+}
+
+
+bool
+start_mixer (playable_pcm_buffer_t *sound)
+{
+  pcm_data_info_t s16_format;
+
+  /* Voices are mixed as signed 16-bit native-endian samples. */
+  s16_format                  = sound->info;
+  s16_format.native_endian    = true;
+  s16_format.sign             = true;
+  s16_format.floating         = false;
+  s16_format.bytes_per_sample = 2;
+  s16_format.bits_per_sample  = 16;
+  if (! convert_pcm_buffer (sound, &s16_format))
+    return false;
+
+  mixer_info = sound->info;
+  period_len = ((mixer_info.sample_rate * MIXER_PERIOD_MS) / 1000)
+               * mixer_info.channels;
+
+  period = malloc (period_len * sizeof (int16_t));
+  if (period == NULL)
+    {
+      fprintf (stderr, "%s: start_mixer (): Failed to allocate the mixing "
+                       "buffer: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+
+  set_pcm_device_latency (MIXER_PERIODS * MIXER_PERIOD_MS * 1000);
+  set_pcm_device_persistent (true);
+
+  active_voices = 0;
+  device_ready  = false;
+
+  return true;
+}
+
+bool
+convert_for_mixer (playable_pcm_buffer_t *sound)
+{
+  if (sound->info.sample_rate != mixer_info.sample_rate
+      || sound->info.channels != mixer_info.channels)
+    {
+      fprintf (stderr, "%s: The sound has %u channel(s) at %u Hz, while the "
+                       "mixer plays %u channel(s) at %u Hz.\n",
+               progname, sound->info.channels, sound->info.sample_rate,
+               mixer_info.channels, mixer_info.sample_rate);
+
+      return false;
+    }
+
+  return convert_pcm_buffer (sound, &mixer_info);
+}
+
+void
+stop_mixer (void)
+{
+  if (period == NULL)
+    return;
+
+  if (active_voices > 0)
+    drain_pcm_device ();
+
+  free (period);
+  period        = NULL;
+  active_voices = 0;
+}
+
+void
+add_mixer_voice (playable_pcm_buffer_t *sound,
+                 const struct timespec *received)
+{
+  mixer_voice_t *voice;
+  unsigned int   iter;
+
+  /* When all voices are busy, restart the one that has played the longest. */
+  if (active_voices == MIXER_VOICES)
+    {
+      voice = &(voices[0]);
+      for (iter = 1; iter < MIXER_VOICES; iter++)
+        if (voices[iter].position > voice->position)
+          voice = &(voices[iter]);
+
+      count_metric (METRIC_VOICES_STOLEN);
+    }
+  else
+    voice = &(voices[active_voices++]);
+
+  voice->samples  = (const int16_t *) sound->data;
+  voice->position = 0;
+  voice->length   = (sound->data_len / (sizeof (int16_t) * mixer_info.channels))
+                    * mixer_info.channels;
+  voice->received = *received;
+}
+
+bool
+mixer_active (void)
+{
+  return (active_voices > 0);
+}
+
+bool
+mixer_uses_sound (playable_pcm_buffer_t *sound)
+{
+  unsigned int iter;
+
+  for (iter = 0; iter < active_voices; iter++)
+    if (voices[iter].samples == (const int16_t *) sound->data)
+      return true;
+
+  return false;
+}
+
+bool
+mix_period (void)
+{
+  mixer_voice_t   *voice;
+  uint32_t         count;
+  uint32_t         rendered;
+  unsigned int     iter;
+
+  /* The bells which start or end in this period, for their latencies. */
+  struct timespec  started[MIXER_VOICES];
+  struct timespec  ended[MIXER_VOICES];
+  unsigned int     started_count;
+  unsigned int     ended_count;
+
+  if (! device_ready)
+    {
+      if (! open_pcm_device (&mixer_info))
+        {
+          active_voices = 0;
+          return false;
+        }
+      device_ready = true;
+    }
+
+  memset (period, 0, period_len * sizeof (int16_t));
+  rendered      = 0;
+  started_count = 0;
+  ended_count   = 0;
+
+  iter = 0;
+  while (iter < active_voices)
+    {
+      voice = &(voices[iter]);
+      if (voice->position == 0)
+        started[started_count++] = voice->received;
+
+      count = voice->length - voice->position;
+      if (count > period_len)
+        count = period_len;
+
+      mix_samples (period, voice->samples + voice->position, count);
+      voice->position += count;
+      if (count > rendered)
+        rendered = count;
+
+      /* Finished voices are replaced by the last active one. */
+      if (voice->position == voice->length)
+        {
+          ended[ended_count++] = voice->received;
+          *voice = voices[--active_voices];
+        }
+      else
+        iter++;
+    }
+
+  if (rendered > 0
+      && ! write_pcm_device ((uint8_t *) period, rendered * sizeof (int16_t)))
+    {
+      close_pcm_device ();
+      active_voices = 0;
+      device_ready  = false;
+      return false;
+    }
+
+  for (iter = 0; iter < started_count; iter++)
+    record_latency (LATENCY_FIRST_SAMPLE, &(started[iter]));
+
+  if (active_voices == 0)
+    {
+      drain_pcm_device ();
+      device_ready = false;
+    }
+
+  /**
+   * While other bells keep playing, a bell counts as drained once its last
+   * samples are written; the last one of a mix, once the device is drained.
+   */
+  for (iter = 0; iter < ended_count; iter++)
+    record_latency (LATENCY_DRAIN, &(ended[iter]));
+
+  return true;
+}
+
+#endif /* HAVE_SOUND */
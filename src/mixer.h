@@ -0,0 +1,74 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_MIXER_H_
+#define _NXBELLD_MIXER_H_ 1
+
+#include "common.h"
+
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+
+#include <time.h>
+
+/**
+ * The mixer plays overlapping bells at the same time, instead of one after
+ * another.  Every bell gets a voice, which is a read cursor into a cached
+ * sound; the active voices are summed one period at a time, and the periods
+ * are streamed to a single, long-lived playback device.  A new bell thus
+ * starts sounding within a period, no matter how many others are playing.
+ *
+ * The mixer works with signed 16-bit native-endian samples; start_mixer ()
+ * converts the given sound to that format if needed.  Sounds passed to
+ * add_mixer_voice () must be in the same format.
+ *
+ * All of the routines are to be called from the playback thread only.
+ */
+#define MIXER_VOICES     8
+#define MIXER_PERIOD_MS  10
+
+bool start_mixer (playable_pcm_buffer_t *sound);
+void stop_mixer  (void);
+
+/**
+ * Converts a sound for add_mixer_voice (), which fails if its sample rate or
+ * channel count differ from the mixer's.  Unlike the rest, it may be called
+ * from any thread once the mixer is started.
+ */
+bool convert_for_mixer (playable_pcm_buffer_t *sound);
+
+/* Adds a voice for a bell received at the given CLOCK_MONOTONIC time. */
+void add_mixer_voice (playable_pcm_buffer_t *sound,
+                      const struct timespec *received);
+bool mixer_active    (void);
+
+/* Whether an active voice is still reading from the sound. */
+bool mixer_uses_sound (playable_pcm_buffer_t *sound);
+
+/**
+ * Renders one period from the active voices and writes it to the device.
+ * Once the last voice ends, the device is drained.
+ */
+bool mix_period (void);
+
+#endif /* HAVE_SOUND */
+#endif /* _NXBELLD_MIXER_H_ */
@@ -0,0 +1,108 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_NULL
+
+#include "pcm.h"
+#include "metrics.h"
+#include "simdevice.h"
+
+/**
+ * The null backend plays to no sound card: the PCM data is discarded at the
+ * pace the simulated device would play it, so that nxbelld can be measured
+ * on machines without sound hardware.
+ */
+
+/* Whether the device is open, and the format it's configured for. */
+static bool              device_open = false;
+static pcm_data_info_t   device_info;
+
+static void close_null_device (void);
+
+static bool
+probe_null_device (pcm_data_info_t *info)
+{
+  probe_sim_device (info);
+  return true;
+}
+
+static bool
+open_null_device (pcm_data_info_t *info)
+{
+  if (device_open)
+    {
+      if (same_pcm_format (&device_info, info))
+        return true;
+
+      close_null_device ();
+    }
+
+  open_sim_device (info);
+  count_metric (METRIC_DEVICE_OPENS);
+
+  device_info = *info;
+  device_open = true;
+  return true;
+}
+
+static bool
+write_null_device (uint8_t *data, size_t len)
+{
+  struct timespec starts;
+  size_t          already_wrote;
+
+
+  already_wrote = 0;
+  while (already_wrote < len)
+    {
+      already_wrote += queue_sim_device (len - already_wrote, &starts);
+      note_first_sample ();
+    }
+
+  return true;
+}
+
+static void
+drain_null_device (void)
+{
+  if (device_open)
+    drain_sim_device ();
+}
+
+static void
+close_null_device (void)
+{
+  device_open = false;
+}
+
+const pcm_backend_t null_backend =
+{
+  .name      = "null",
+  .automatic = false,
+  .probe     = probe_null_device,
+  .open      = open_null_device,
+  .write     = write_null_device,
+  .drain     = drain_null_device,
+  .close     = close_null_device
+};
+
+#endif /* HAVE_NULL */
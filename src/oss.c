@@ -23,6 +23,7 @@
 #ifdef HAVE_OSS
 
 #include "pcm.h"
+#include "metrics.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -31,9 +32,41 @@
 #define BUF_SIZE    4096 /* Recommended buffer size for "normal use" of OSS. */
 #define DEVICE_NAME "/dev/dsp"
 
+#ifdef AFMT_FLOAT
+/* Non-native data is little-endian, as found in WAVE files. */
+static bool
+is_native_float (pcm_data_info_t *info)
+{
+#ifdef WORDS_BIGENDIAN
+  return info->native_endian;
+#else
+  return true;
+#endif
+}
+#endif
+
 static int
 determine_pcm_format (pcm_data_info_t *info)
 {
+  if (info->floating)
+    {
+#ifdef AFMT_FLOAT
+      if (info->bytes_per_sample == 4 && is_native_float (info))
+        return AFMT_FLOAT;
+#endif
+      return -1;
+    }
+
+  /* Packed 24-bit samples, the other 24-bit formats use 4 bytes. */
+  if (info->bytes_per_sample == 3)
+    {
+#ifdef AFMT_S24_PACKED
+      if (info->sign && ! info->native_endian)
+        return AFMT_S24_PACKED;
+#endif
+      return -1;
+    }
+
   if (info->native_endian)
     {
       if (info->sign)
@@ -42,8 +75,12 @@ determine_pcm_format (pcm_data_info_t *info)
             {
               case 8:  return AFMT_S8;
               case 16: return AFMT_S16_NE;
+#ifdef AFMT_S24_NE
               case 24: return AFMT_S24_NE;
+#endif
+#ifdef AFMT_S32_NE
               case 32: return AFMT_S32_NE;
+#endif
             }
         }
       else
@@ -51,9 +88,15 @@ determine_pcm_format (pcm_data_info_t *info)
           switch (info->bits_per_sample)
             {
               case 8:  return AFMT_U8;
+#ifdef AFMT_U16_NE
               case 16: return AFMT_U16_NE;
+#endif
+#ifdef AFMT_U24_NE
               case 24: return AFMT_U24_NE;
+#endif
+#ifdef AFMT_U32_NE
               case 32: return AFMT_U32_NE;
+#endif
             }
         }
     }
@@ -65,8 +108,12 @@ determine_pcm_format (pcm_data_info_t *info)
             {
               case 8:  return AFMT_S8;
               case 16: return AFMT_S16_LE;
+#ifdef AFMT_S24_LE
               case 24: return AFMT_S24_LE;
+#endif
+#ifdef AFMT_S32_LE
               case 32: return AFMT_S32_LE;
+#endif
             }
         }
       else
@@ -75,8 +122,12 @@ determine_pcm_format (pcm_data_info_t *info)
             {
               case 8:  return AFMT_U8;
               case 16: return AFMT_U16_LE;
+#ifdef AFMT_U24_LE
               case 24: return AFMT_U24_LE;
+#endif
+#ifdef AFMT_U32_LE
               case 32: return AFMT_U32_LE;
+#endif
             }
         }
     }
@@ -90,8 +141,27 @@ configure_oss_device (int device, pcm_data_info_t *info)
   int               status;
   int               format;
   int               ioctl_ret;
+  uint64_t          fragment_len;
+  int               fragment_shift;
 
 
+  /**
+   * Split the requested latency into four fragments.  This has to be done
+   * before the format is set, and is only a hint to the driver.
+   */
+  if (pcm_device_latency > 0)
+    {
+      fragment_len = ((uint64_t) info->sample_rate * info->channels
+                      * info->bytes_per_sample * pcm_device_latency)
+                     / (4 * 1000000);
+      fragment_shift = 4;
+      while (fragment_shift < 16 && (1 << fragment_shift) < fragment_len)
+        fragment_shift++;
+
+      ioctl_ret = (4 << 16) | fragment_shift;
+      ioctl (device, SNDCTL_DSP_SETFRAGMENT, &ioctl_ret);
+    }
+
   format = determine_pcm_format (info);
   if (format == -1)
     {
@@ -156,137 +226,227 @@ configure_oss_device (int device, pcm_data_info_t *info)
 }
 
 
-bool
-play_pcm_buffer (playable_pcm_buffer_t *buffer)
+/* The playback device, and the format it's configured for. */
+static int               device = -1;
+static pcm_data_info_t   device_info;
+
+static void close_oss_device (void);
+
+static bool
+probe_oss_device (pcm_data_info_t *info)
 {
-  int               status;
-  int               format;
-  int               ioctl_ret;
-  int               device;
-  size_t            to_write;
-  size_t            already_wrote;
-  ssize_t           wrote_bytes;
+  /* Linux's OSS emulation only knows of 16-bit samples. */
+  static const int narrow_formats[] =
+    {
+      AFMT_S16_NE,
+#ifdef AFMT_S32_NE
+      AFMT_S32_NE,
+#endif
+#ifdef AFMT_S24_NE
+      AFMT_S24_NE,
+#endif
+    };
+  static const int wide_formats[] =
+    {
+#ifdef AFMT_S32_NE
+      AFMT_S32_NE,
+#endif
+#ifdef AFMT_S24_NE
+      AFMT_S24_NE,
+#endif
+      AFMT_S16_NE
+    };
+  const unsigned int format_count = sizeof (narrow_formats)
+                                    / sizeof (narrow_formats[0]);
+
+  const int   *candidates;
+  const char  *name;
+  int          probe;
+  int          formats;
+  int          format;
+  int          rate;
+  int          status;
+  unsigned int iter;
+
+
+  if (device != -1)
+    probe = device;
+  else
+    {
+      name = (pcm_device_name != NULL) ? pcm_device_name : DEVICE_NAME;
 
+      probe = open (name, O_WRONLY, 0);
+      if (probe == -1)
+        {
+          fprintf (stderr, "%s: Failed to open `%s' for writing: %s.\n",
+                   progname, name, strerror (errno));
 
-  device = open (DEVICE_NAME, O_WRONLY, 0);
-  if (device == -1)
+          return false;
+        }
+    }
+
+  status = ioctl (probe, SNDCTL_DSP_GETFMTS, &formats);
+  if (status == -1)
     {
-      fprintf (stderr, "%s: Failed to open `%s' for writing: %s.\n",
-               progname, DEVICE_NAME, strerror (errno));
+      fprintf (stderr, "%s: Failed to query the playback device's sound formats: %s.\n",
+               progname, strerror (errno));
 
+      if (probe != device)
+        close (probe);
       return false;
     }
 
-  if (! configure_oss_device (device, &(buffer->info)))
+  candidates = (info->floating || info->bits_per_sample > 16) ? wide_formats
+                                                              : narrow_formats;
+  for (iter = 0; iter < format_count; iter++)
+    if (formats & candidates[iter])
+      break;
+
+  if (iter == format_count)
     {
-      fprintf (stderr, "%s: Failed to configure the playback device.\n",
+      fprintf (stderr, "%s: The playback device supports none of the "
+                       "known sample formats.\n",
                progname);
 
-      close (device);
+      if (probe != device)
+        close (probe);
       return false;
     }
 
-  already_wrote  = 0;
-  while (already_wrote < buffer->data_len)
+  /* An already open device is configured for playback, leave it be. */
+  if (probe != device)
     {
-      if (buffer->data_len - already_wrote < BUF_SIZE)
-        to_write = buffer->data_len - already_wrote;
-      else
-        to_write = BUF_SIZE;
-
-      wrote_bytes = write (device, buffer->data + already_wrote, to_write);
-
-      if (wrote_bytes == -1)
-        {
-          fprintf (stderr, "%s: An error occured while writing to the playback device: %s.\n",
-                   progname, strerror (errno));
+      format = candidates[iter];
+      rate   = info->sample_rate;
+      if (ioctl (probe, SNDCTL_DSP_SETFMT, &format) != -1
+          && ioctl (probe, SNDCTL_DSP_SPEED, &rate) != -1 && rate > 0)
+        info->sample_rate = rate;
 
-          close (device);
-          return false;
-        }
+      close (probe);
+    }
 
-      already_wrote += wrote_bytes;
-      if (wrote_bytes != to_write)
-        fprintf (stderr, "%s: Warning: Wrote only %ld bytes instead of the "
-                         "expected %lu to the playback device.\n",
-                 progname, wrote_bytes, to_write);
+  info->native_endian = true;
+  info->sign          = true;
+  info->floating      = false;
+  if (candidates[iter] == AFMT_S16_NE)
+    {
+      info->bytes_per_sample = 2;
+      info->bits_per_sample  = 16;
+    }
+  else
+    {
+      info->bytes_per_sample = 4;
+#ifdef AFMT_S24_NE
+      info->bits_per_sample  = (candidates[iter] == AFMT_S24_NE) ? 24 : 32;
+#else
+      info->bits_per_sample  = 32;
+#endif
     }
 
-  close (device);
   return true;
 }
 
-bool
-play_pcm_file (playable_pcm_file_t *file)
+static bool
+open_oss_device (pcm_data_info_t *info)
 {
-  int               status;
-  int               device;
-  uint8_t           playback_buf[BUF_SIZE];
-  size_t            read_bytes;
-  ssize_t           wrote_bytes;
+  const char *name;
 
-  if (fsetpos (file->stream, &(file->pcm_start_pos)) != 0)
+  if (device != -1)
     {
-      fprintf (stderr, "%s: Failed to seek to the PCM data of `%s': %s.\n",
-               progname, file->name, strerror (errno));
+      if (same_pcm_format (&device_info, info))
+        return true;
 
-      return false;
+      close_oss_device ();
     }
 
-  device = open (DEVICE_NAME, O_WRONLY, 0);
+  name = (pcm_device_name != NULL) ? pcm_device_name : DEVICE_NAME;
+
+  device = open (name, O_WRONLY, 0);
   if (device == -1)
     {
       fprintf (stderr, "%s: Failed to open `%s' for writing: %s.\n",
-               progname, DEVICE_NAME, strerror (errno));
+               progname, name, strerror (errno));
 
       return false;
     }
+  count_metric (METRIC_DEVICE_OPENS);
 
-  if (! configure_oss_device (device, &(file->info)))
+  if (! configure_oss_device (device, info))
     {
       fprintf (stderr, "%s: Failed to configure the playback device.\n",
                progname);
 
-      close (device);
+      close_oss_device ();
       return false;
     }
 
+  device_info = *info;
+  return true;
+}
 
-  while (true)
-    {
-      read_bytes = fread (playback_buf, 1, BUF_SIZE, file->stream);
-      if (read_bytes == 0)
-        {
-          if (ferror (file->stream))
-            {
-              fprintf (stderr, "%s: An error occured while reading from `%s': %s.\n",
-                       progname, file->name, strerror (errno));
+static bool
+write_oss_device (uint8_t *data, size_t len)
+{
+  size_t            to_write;
+  size_t            already_wrote;
+  ssize_t           wrote_bytes;
 
-              close (device);
-              return false;
-            }
 
-          break;
-        }
+  already_wrote  = 0;
+  while (already_wrote < len)
+    {
+      if (len - already_wrote < BUF_SIZE)
+        to_write = len - already_wrote;
+      else
+        to_write = BUF_SIZE;
 
-      wrote_bytes = write (device, playback_buf, read_bytes);
+      wrote_bytes = write (device, data + already_wrote, to_write);
 
       if (wrote_bytes == -1)
         {
           fprintf (stderr, "%s: An error occured while writing to the playback device: %s.\n",
                    progname, strerror (errno));
 
-          close (device);
           return false;
         }
 
-      if (wrote_bytes != read_bytes)
-        fprintf (stderr, "%s: Warning: Read %lu bytes, but wrote only %ld.\n",
-                 progname, read_bytes, wrote_bytes);
+      already_wrote += wrote_bytes;
+      note_first_sample ();
+      if (wrote_bytes != to_write)
+        fprintf (stderr, "%s: Warning: Wrote only %ld bytes instead of the "
+                         "expected %lu to the playback device.\n",
+                 progname, wrote_bytes, to_write);
     }
 
-  close (device);
   return true;
 }
 
+static void
+drain_oss_device (void)
+{
+  if (device != -1)
+    ioctl (device, SNDCTL_DSP_SYNC, NULL);
+}
+
+static void
+close_oss_device (void)
+{
+  if (device == -1)
+    return;
+
+  close (device);
+  device = -1;
+}
+
+const pcm_backend_t oss_backend =
+{
+  .name      = "oss",
+  .automatic = true,
+  .probe     = probe_oss_device,
+  .open      = open_oss_device,
+  .write     = write_oss_device,
+  .drain     = drain_oss_device,
+  .close     = close_oss_device
+};
+
 #endif /* HAVE_OSS */
@@ -23,18 +23,180 @@
 
 #ifdef HAVE_SOUND
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Files are played from a resident head of PCM_FILE_HEAD_LEN bytes, then
+ * in chunks of PCM_FILE_CHUNK_LEN bytes, while the kernel is asked to read
+ * PCM_FILE_READ_AHEAD bytes ahead of the chunk being played.
+ */
+#define PCM_FILE_HEAD_LEN    (64 * 1024)
+#define PCM_FILE_CHUNK_LEN   (32 * 1024)
+#define PCM_FILE_READ_AHEAD  (4 * PCM_FILE_CHUNK_LEN)
+
+static bool keep_device_open = false;
+
+/* Buffers are made and freed by both the main and the playback thread. */
+static pthread_mutex_t        buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static playable_pcm_buffer_t *buffers      = NULL;
+
+unsigned int pcm_device_latency = 0;
+const char  *pcm_device_name    = NULL;
+unsigned int pcm_device_access  = PCM_ACCESS_AUTO;
+
+void
+track_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  pthread_mutex_lock (&buffers_lock);
+  buffer->prev = NULL;
+  buffer->next = buffers;
+  if (buffers != NULL)
+    buffers->prev = buffer;
+  buffers = buffer;
+  pthread_mutex_unlock (&buffers_lock);
+}
+
+#ifdef HAVE_MINCORE
+/* The number of bytes of the given range which are in memory. */
+static size_t
+resident_bytes (const uint8_t *data, size_t len)
+{
+  unsigned char *pages;
+  uintptr_t      start;
+  uintptr_t      end;
+  uintptr_t      page_start;
+  uintptr_t      page_end;
+  size_t         page_size;
+  size_t         count;
+  size_t         iter;
+  size_t         resident;
+
+  if (len == 0)
+    return 0;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  start     = (uintptr_t) data;
+  end       = start + len;
+  count     = (end - (start & ~(page_size - 1)) + page_size - 1) / page_size;
+
+  pages = malloc (count);
+  if (pages == NULL)
+    return 0;
+
+  /* The vector is a char * on some systems, and an unsigned char * on others. */
+  if (mincore ((void *) (start & ~(page_size - 1)), count * page_size,
+               (void *) pages) != 0)
+    {
+      free (pages);
+      return 0;
+    }
+
+  resident = 0;
+  for (iter = 0; iter < count; iter++)
+    {
+      if (! (pages[iter] & 1))
+        continue;
+
+      page_start = (start & ~(page_size - 1)) + iter * page_size;
+      page_end   = page_start + page_size;
+      resident += ((page_end < end) ? page_end : end)
+                  - ((page_start > start) ? page_start : start);
+    }
+
+  free (pages);
+  return resident;
+}
+#endif
+
+void
+measure_pcm_buffers (size_t *bytes, size_t *resident)
+{
+  playable_pcm_buffer_t *buffer;
+
+  *bytes    = 0;
+  *resident = 0;
+
+  pthread_mutex_lock (&buffers_lock);
+  for (buffer = buffers; buffer != NULL; buffer = buffer->next)
+    {
+      *bytes += buffer->data_len;
+#ifdef HAVE_MINCORE
+      *resident += resident_bytes (buffer->data, buffer->data_len);
+#else
+      *resident += buffer->data_len;
+#endif
+    }
+  pthread_mutex_unlock (&buffers_lock);
+}
+
 void
 free_pcm_buffer (playable_pcm_buffer_t *buffer)
 {
   if (buffer == NULL)
     return;
 
-  if (buffer->data != NULL)
+  forget_uploaded_pcm_buffer (buffer);
+
+  pthread_mutex_lock (&buffers_lock);
+  if (buffer->prev != NULL)
+    buffer->prev->next = buffer->next;
+  else
+    buffers = buffer->next;
+  if (buffer->next != NULL)
+    buffer->next->prev = buffer->prev;
+  pthread_mutex_unlock (&buffers_lock);
+
+  if (buffer->map != NULL)
+    munmap (buffer->map, buffer->map_len);
+  else if (buffer->data != NULL)
     free (buffer->data);
 
   free (buffer);
 }
 
+void
+replace_pcm_buffer_data (playable_pcm_buffer_t *buffer, uint8_t *data,
+                         uint32_t data_len)
+{
+  uint8_t *old_data;
+  void    *old_map;
+  size_t   old_map_len;
+
+  /* The buffer may be being measured meanwhile. */
+  pthread_mutex_lock (&buffers_lock);
+  old_data         = buffer->data;
+  old_map          = buffer->map;
+  old_map_len      = buffer->map_len;
+  buffer->data     = data;
+  buffer->data_len = data_len;
+  buffer->map      = NULL;
+  buffer->map_len  = 0;
+  pthread_mutex_unlock (&buffers_lock);
+
+  if (old_map != NULL)
+    munmap (old_map, old_map_len);
+  else if (old_data != NULL)
+    free (old_data);
+}
+
+bool
+lock_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  if (mlock (buffer->data, buffer->data_len) != 0)
+    {
+      fprintf (stderr, "%s: Failed to lock the sound data in memory: %s.\n",
+               progname, strerror (errno));
+
+      return false;
+    }
+
+  return true;
+}
+
 void
 close_pcm_file (playable_pcm_file_t *file)
 {
@@ -43,10 +205,253 @@ close_pcm_file (playable_pcm_file_t *file)
 
   if (file->name != NULL)
     free (file->name);
-  if (file->stream != NULL)
-    fclose (file->stream);
+  if (file->fd != -1)
+    close (file->fd);
+  free (file->head);
 
   free (file);
 }
 
+/* Reads exactly `len' bytes at `offset', unless the file ends first. */
+static ssize_t
+pread_fully (int fd, uint8_t *data, size_t len, off_t offset)
+{
+  size_t  done;
+  ssize_t status;
+
+  for (done = 0; done < len; done += status)
+    {
+      status = pread (fd, data + done, len - done, offset + done);
+      if (status == -1 && errno == EINTR)
+        status = 0;
+      else if (status == -1)
+        return -1;
+      else if (status == 0)
+        break;
+    }
+
+  return done;
+}
+
+bool
+read_pcm_file_head (playable_pcm_file_t *file)
+{
+  struct stat file_stat;
+  ssize_t     read_bytes;
+
+  if (fstat (file->fd, &file_stat) == -1)
+    {
+      fprintf (stderr, "%s: Failed to query the size of `%s': %s.\n",
+               progname, file->name, strerror (errno));
+
+      return false;
+    }
+
+  if (file->data_offset + file->data_len > file_stat.st_size)
+    {
+      fprintf (stderr, "%s: Warning: The PCM data of `%s' is truncated.\n",
+               progname, file->name);
+
+      file->data_len = file_stat.st_size - file->data_offset;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise (file->fd, file->data_offset, file->data_len,
+                 POSIX_FADV_SEQUENTIAL);
+#endif
+
+  file->head_len = (file->data_len < PCM_FILE_HEAD_LEN) ? file->data_len
+                                                        : PCM_FILE_HEAD_LEN;
+  file->head = malloc (file->head_len);
+  if (file->head == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate a buffer for the start of `%s': %s.\n",
+               progname, file->name, strerror (errno));
+
+      return false;
+    }
+
+  read_bytes = pread_fully (file->fd, file->head, file->head_len,
+                            file->data_offset);
+  if (read_bytes == -1)
+    {
+      fprintf (stderr, "%s: An error occured while reading from `%s': %s.\n",
+               progname, file->name, strerror (errno));
+
+      return false;
+    }
+  file->head_len = read_bytes;
+
+  return true;
+}
+
+/* Asks the kernel to start reading the data that follows `position'. */
+static void
+read_ahead_pcm_file (playable_pcm_file_t *file, off_t position, off_t *hinted)
+{
+  off_t end;
+
+  end = position + PCM_FILE_READ_AHEAD;
+  if (end > file->data_len)
+    end = file->data_len;
+  if (end <= *hinted)
+    return;
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise (file->fd, file->data_offset + *hinted, end - *hinted,
+                 POSIX_FADV_WILLNEED);
+#endif
+  *hinted = end;
+}
+
+void
+free_pcm_stream (playable_pcm_stream_t *stream)
+{
+  free (stream->state);
+  free (stream);
+}
+
+bool
+same_pcm_format (pcm_data_info_t *a, pcm_data_info_t *b)
+{
+  return (a->native_endian       == b->native_endian
+          && a->sign             == b->sign
+          && a->floating         == b->floating
+          && a->sample_rate      == b->sample_rate
+          && a->channels         == b->channels
+          && a->bytes_per_sample == b->bytes_per_sample
+          && a->bits_per_sample  == b->bits_per_sample);
+}
+
+void
+set_pcm_device_persistent (bool persistent)
+{
+  keep_device_open = persistent;
+
+  if (! keep_device_open)
+    close_pcm_device ();
+}
+
+void
+set_pcm_device_latency (unsigned int latency)
+{
+  /* The device has to be configured again for the new latency. */
+  if (latency != pcm_device_latency)
+    close_pcm_device ();
+
+  pcm_device_latency = latency;
+}
+
+
+bool
+play_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  /* A sound kept by the sound server only has to be named. */
+  if (play_uploaded_pcm_buffer (buffer))
+    return true;
+
+  if (! open_pcm_device (&(buffer->info)))
+    return false;
+
+  if (! write_pcm_device (buffer->data, buffer->data_len))
+    {
+      close_pcm_device ();
+      return false;
+    }
+
+  drain_pcm_device ();
+  if (! keep_device_open)
+    close_pcm_device ();
+
+  return true;
+}
+
+bool
+play_pcm_file (playable_pcm_file_t *file)
+{
+  uint8_t  chunk[PCM_FILE_CHUNK_LEN];
+  off_t    position;
+  off_t    hinted;
+  size_t   to_read;
+  ssize_t  read_bytes;
+
+  if (! open_pcm_device (&(file->info)))
+    return false;
+
+  /* The head plays while the first chunk is being fetched. */
+  position = file->head_len;
+  hinted   = position;
+  read_ahead_pcm_file (file, position, &hinted);
+
+  if (! write_pcm_device (file->head, file->head_len))
+    {
+      close_pcm_device ();
+      return false;
+    }
+
+  while (position < file->data_len)
+    {
+      to_read = file->data_len - position;
+      if (to_read > PCM_FILE_CHUNK_LEN)
+        to_read = PCM_FILE_CHUNK_LEN;
+
+      read_bytes = pread_fully (file->fd, chunk, to_read,
+                                file->data_offset + position);
+      if (read_bytes == -1)
+        {
+          fprintf (stderr, "%s: An error occured while reading from `%s': %s.\n",
+                   progname, file->name, strerror (errno));
+
+          close_pcm_device ();
+          return false;
+        }
+      if (read_bytes == 0)      /* The file was truncated meanwhile. */
+        break;
+
+      position += read_bytes;
+      read_ahead_pcm_file (file, position, &hinted);
+
+      if (! write_pcm_device (chunk, read_bytes))
+        {
+          close_pcm_device ();
+          return false;
+        }
+    }
+
+  drain_pcm_device ();
+  if (! keep_device_open)
+    close_pcm_device ();
+
+  return true;
+}
+
+bool
+play_pcm_stream (playable_pcm_stream_t *stream)
+{
+  /* Aligned for any sample type. */
+  uint64_t playback_buf[BUFSIZ / sizeof (uint64_t)];
+  size_t   rendered_bytes;
+
+  if (! open_pcm_device (&(stream->info)))
+    return false;
+
+  stream->rewind (stream->state);
+  while ((rendered_bytes = stream->render (stream->state,
+                                           (uint8_t *) playback_buf,
+                                           sizeof (playback_buf))) > 0)
+    {
+      if (! write_pcm_device ((uint8_t *) playback_buf, rendered_bytes))
+        {
+          close_pcm_device ();
+          return false;
+        }
+    }
+
+  drain_pcm_device ();
+  if (! keep_device_open)
+    close_pcm_device ();
+
+  return true;
+}
+
 #endif /* HAVE_SOUND */
@@ -26,14 +26,22 @@
 
 #ifdef HAVE_SOUND
 
+#include <sys/types.h>
+
 typedef struct pcm_data_info       pcm_data_info_t;
 typedef struct playable_pcm_buffer playable_pcm_buffer_t;
 typedef struct playable_pcm_file   playable_pcm_file_t;
+typedef struct playable_pcm_stream playable_pcm_stream_t;
 
+/**
+ * Samples are stored in `bytes_per_sample' bytes.  24-bit samples are either
+ * packed into 3 bytes, or stored in the low bits of 4 bytes.
+ */
 struct pcm_data_info
 {
   bool native_endian;
   bool sign;
+  bool floating;
 
   unsigned int sample_rate;
   unsigned int channels;
@@ -46,24 +54,199 @@ struct playable_pcm_buffer
   uint8_t        *data;
   uint32_t        data_len;
 
+  /* Set when `data' points into a read-only mapping of a file. */
+  void           *map;
+  size_t          map_len;
+
   pcm_data_info_t info;
+
+  /* The list of buffers in memory, see track_pcm_buffer (). */
+  playable_pcm_buffer_t *prev;
+  playable_pcm_buffer_t *next;
 };
 
 struct playable_pcm_file
 {
   char    *name;
-  FILE    *stream;
-  fpos_t   pcm_start_pos;
+  int      fd;
+  off_t    data_offset;   /* Where the PCM data starts in the file. */
+  off_t    data_len;
+
+  /* The start of the PCM data, kept in memory so playback starts at once. */
+  uint8_t *head;
+  size_t   head_len;
 
   pcm_data_info_t info;
 };
 
+/* PCM data produced while it's being played, a chunk at a time. */
+struct playable_pcm_stream
+{
+  /**
+   * Fills at most `len' bytes of `data', returning the number of bytes
+   * produced; 0 marks the end of the stream.
+   */
+  size_t (*render) (void *state, uint8_t *data, size_t len);
+
+  /* Restarts the stream from its beginning. */
+  void   (*rewind) (void *state);
+
+  void           *state;
+  pcm_data_info_t info;
+};
+
 void free_pcm_buffer (playable_pcm_buffer_t *buffer);
+
+/**
+ * Every newly made buffer is to be passed to track_pcm_buffer (), so that
+ * measure_pcm_buffers () can tell how many bytes of PCM data are kept in
+ * memory, and how many of them are resident, as opposed to swapped out or
+ * not read from their file yet.
+ */
+void track_pcm_buffer    (playable_pcm_buffer_t *buffer);
+void measure_pcm_buffers (size_t *bytes, size_t *resident);
 void close_pcm_file (playable_pcm_file_t *file);
 
-/* Note: These two routines are implemented outside of pcm.c: */
+/**
+ * Reads the start of the file's PCM data into memory, once `fd',
+ * `data_offset' and `data_len' are set, and checks the latter against the
+ * size of the file.
+ */
+bool read_pcm_file_head (playable_pcm_file_t *file);
+void free_pcm_stream (playable_pcm_stream_t *stream);
+
+bool same_pcm_format (pcm_data_info_t *a, pcm_data_info_t *b);
+
+/**
+ * Replaces the buffer's PCM data by the given malloc ()'d data, releasing
+ * the previous data or file mapping.
+ */
+void replace_pcm_buffer_data (playable_pcm_buffer_t *buffer, uint8_t *data,
+                              uint32_t data_len);
+
+/* Locks the buffer's PCM data in memory, so it never has to be paged in. */
+bool lock_pcm_buffer (playable_pcm_buffer_t *buffer);
+
 bool play_pcm_buffer (playable_pcm_buffer_t *buffer);
 bool play_pcm_file (playable_pcm_file_t *file);
+bool play_pcm_stream (playable_pcm_stream_t *stream);
+
+/**
+ * When the playback device is kept open, it stays configured between bells,
+ * and is only re-opened when the format of the played data changes.
+ */
+void set_pcm_device_persistent (bool persistent);
+
+/**
+ * The requested playback latency (the amount of buffered audio) in
+ * microseconds, 0 leaves the choice to the sound API.
+ */
+extern unsigned int pcm_device_latency;
+
+void set_pcm_device_latency (unsigned int latency);
+
+/* The name of the playback device, NULL selects the sound API's default. */
+extern const char *pcm_device_name;
+
+/**
+ * How sound data is written to devices which can be mapped, so far ALSA's:
+ * straight into the mapped ring buffer, through the read/write interface, or
+ * by default the former where the device allows it.
+ */
+enum
+{
+  PCM_ACCESS_AUTO,
+  PCM_ACCESS_MMAP,
+  PCM_ACCESS_RW
+};
+
+extern unsigned int pcm_device_access;
+
+/**
+ * A sound API nxbelld can play through.  Every one built in has a backend
+ * (pulse.c, alsa.c, oss.c, soundio.c, null.c and capture.c), and one of
+ * them is selected when nxbelld starts.
+ *
+ * open () configures the device for the given format, re-using it if it's
+ * already open and configured so, and makes sure it's ready to accept data.
+ *
+ * probe () replaces the sample format in `info' by the one the device
+ * handles natively, preferring one that doesn't lose precision, and the
+ * sampling rate by the closest one the device plays without resampling.
+ *
+ * Backends which aren't `automatic' are only used when asked for by name.
+ *
+ * A backend whose sound server can keep sounds has upload (), which hands
+ * the buffer over to the server, and play_uploaded (), which asks it to
+ * play an uploaded buffer, failing if it wasn't uploaded.  forget () is
+ * called for every buffer freed, to have the server drop it.
+ */
+typedef struct pcm_backend pcm_backend_t;
+
+struct pcm_backend
+{
+  const char *name;
+  bool        automatic;
+
+  bool (*probe) (pcm_data_info_t *info);
+  bool (*open)  (pcm_data_info_t *info);
+  bool (*write) (uint8_t *data, size_t len);
+  void (*drain) (void);
+  void (*close) (void);
+
+  bool (*upload)        (playable_pcm_buffer_t *buffer);
+  bool (*play_uploaded) (playable_pcm_buffer_t *buffer);
+  void (*forget)        (playable_pcm_buffer_t *buffer);
+};
+
+#ifdef HAVE_PULSE
+extern const pcm_backend_t pulse_backend;
+#endif
+#ifdef HAVE_ALSA
+extern const pcm_backend_t alsa_backend;
+#endif
+#ifdef HAVE_OSS
+extern const pcm_backend_t oss_backend;
+#endif
+#ifdef HAVE_SOUNDIO
+extern const pcm_backend_t soundio_backend;
+#endif
+#ifdef HAVE_NULL
+extern const pcm_backend_t null_backend;
+#endif
+#ifdef HAVE_CAPTURE
+extern const pcm_backend_t capture_backend;
+#endif
+
+/**
+ * Selects the backend named `name', failing if there's no such one, or,
+ * given NULL, the automatic backend whose device opens the fastest.  When
+ * the selected device can't be opened later on, the other automatic
+ * backends are tried, fastest first, unless the backend was chosen by name.
+ */
+bool select_pcm_backend (const char *name);
+
+/* The selected backend, and how long each device took to open, as metrics. */
+void write_backend_metrics (FILE *out);
+
+/* The name of the selected backend, or NULL before one is. */
+const char *pcm_backend_name (void);
+
+/**
+ * Has the sound server keep the buffer, so that playing it merely names it.
+ * Fails only if the selected backend has a sound server, and uploading the
+ * buffer failed.
+ */
+bool upload_pcm_buffer          (playable_pcm_buffer_t *buffer);
+bool play_uploaded_pcm_buffer   (playable_pcm_buffer_t *buffer);
+void forget_uploaded_pcm_buffer (playable_pcm_buffer_t *buffer);
+
+/* These go through the selected backend. */
+bool open_pcm_device  (pcm_data_info_t *info);
+bool probe_pcm_device (pcm_data_info_t *info);
+bool write_pcm_device (uint8_t *data, size_t len);
+void drain_pcm_device (void);
+void close_pcm_device (void);
 
 #endif /* HAVE_SOUND */
 #endif /* _NXBELLD_PCM_H_ */
@@ -0,0 +1,238 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "beep.h"
+#include "queue.h"
+#include "player.h"
+#include "mixer.h"
+#include "metrics.h"
+
+#include <pthread.h>
+
+
+static pthread_t          worker;
+static bool               running = false;
+static atomic_bool        stopping;
+
+static bell_queue_t      *bells;
+static beep_descriptor_t *player_beep;
+static bool               device_open;
+
+/**
+ * A beep handed over by replace_player_beep (), and the one it replaced,
+ * which is kept until the mixer stops playing from it.
+ */
+static _Atomic (beep_descriptor_t *) next_beep;
+static beep_descriptor_t *retired_beep;
+static bool               keep_device_open;
+static unsigned int       device_idle_timeout;
+static bool               mixing;
+
+static void
+play_bell (bell_event_t *event)
+{
+  bool                   played;
+
+#ifdef HAVE_SOUND
+  playable_pcm_buffer_t *sound;
+
+  if (mixing)
+    {
+      sound = beep_sound_for_bell (player_beep, event->pitch,
+                                   event->duration, event->percent);
+      if (sound == NULL)
+        {
+          count_metric (METRIC_BELLS_FAILED);
+          return;
+        }
+
+      add_mixer_voice (sound, &(event->received));
+      count_metric (METRIC_BELLS_PLAYED);
+      return;
+    }
+#endif
+
+  start_bell_timing (&(event->received));
+  played = perform_bell (player_beep, event);
+  finish_bell_timing (played);
+
+  if (played)
+    count_metric (METRIC_BELLS_PLAYED);
+  else
+    {
+      count_metric (METRIC_BELLS_FAILED);
+      fprintf (stderr, "%s: Warning: Performing a beep failed.\n",
+               progname);
+    }
+}
+
+/**
+ * Switches to a replacement beep between two bells, so a bell never starts
+ * on one sound and ends on another.
+ */
+static void
+adopt_next_beep (void)
+{
+  beep_descriptor_t *beep;
+
+  if (retired_beep != NULL)
+    {
+#ifdef HAVE_SOUND
+      if (mixing && mixer_active ())
+        return;
+#endif
+      free_beep_desc (retired_beep);
+      retired_beep = NULL;
+    }
+
+  if (atomic_load_explicit (&next_beep, memory_order_relaxed) == NULL)
+    return;
+  beep = atomic_exchange (&next_beep, NULL);
+  if (beep == NULL)
+    return;
+
+  /* The mixer keeps its own device, in a format the new sound matches. */
+  if (device_open && ! mixing)
+    {
+      close_beep_device (player_beep);
+      device_open = open_beep_device (beep);
+    }
+
+  retired_beep = player_beep;
+  player_beep  = beep;
+}
+
+static void *
+player_main (void *unused)
+{
+  bell_event_t event;
+
+  device_open = keep_device_open;
+  while (! atomic_load (&stopping))
+    {
+      adopt_next_beep ();
+
+#ifdef HAVE_SOUND
+      if (mixing && mixer_active ())
+        {
+          /* Bells which came in during the last period join the mix. */
+          while (pop_bell (bells, &event))
+            play_bell (&event);
+
+          if (! mix_period ())
+            {
+              count_metric (METRIC_BELLS_FAILED);
+              fprintf (stderr, "%s: Warning: Mixing the beeps failed.\n",
+                       progname);
+            }
+          continue;
+        }
+#endif
+
+      if (device_open && device_idle_timeout > 0)
+        {
+          if (! wait_for_bell (bells, device_idle_timeout))
+            {
+              if (errno == ETIMEDOUT)
+                {
+                  /* Let the playback device power down. */
+                  close_beep_device (player_beep);
+                  device_open = false;
+                }
+              continue;
+            }
+        }
+      else if (! wait_for_bell (bells, 0))
+        continue;
+
+      if (! pop_bell (bells, &event))
+        continue;
+
+      play_bell (&event);
+      device_open = keep_device_open;
+    }
+
+  return NULL;
+}
+
+bool
+start_player (bell_queue_t *queue, beep_descriptor_t *beep,
+              bool keep_open, unsigned int idle_timeout, bool mix)
+{
+  int status;
+
+  bells               = queue;
+  player_beep         = beep;
+  keep_device_open    = keep_open;
+  device_idle_timeout = idle_timeout;
+  mixing              = mix;
+
+  atomic_init (&stopping,     false);
+  atomic_init (&next_beep,    NULL);
+
+  status = pthread_create (&worker, NULL, player_main, NULL);
+  if (status != 0)
+    {
+      fprintf (stderr, "%s: Failed to start the playback thread: %s.\n",
+               progname, strerror (status));
+
+      return false;
+    }
+
+  running = true;
+  return true;
+}
+
+void
+stop_player (void)
+{
+  if (! running)
+    return;
+
+  atomic_store (&stopping, true);
+  wake_bell_queue (bells);
+  pthread_join (worker, NULL);
+#ifdef HAVE_SOUND
+  if (mixing)
+    stop_mixer ();
+#endif
+
+  running = false;
+
+  /* Whatever the mixer played from has been drained by now. */
+  free_beep_desc (atomic_exchange (&next_beep, NULL));
+  free_beep_desc (retired_beep);
+  retired_beep = NULL;
+}
+
+void
+replace_player_beep (beep_descriptor_t *beep)
+{
+  /* A replacement the worker hasn't picked up yet was never played. */
+  free_beep_desc (atomic_exchange (&next_beep, beep));
+  wake_bell_queue (bells);
+}
+
+beep_descriptor_t *
+current_player_beep (void)
+{
+  return player_beep;
+}
@@ -0,0 +1,55 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_PLAYER_H_
+#define _NXBELLD_PLAYER_H_ 1
+
+#include "common.h"
+#include "beep.h"
+#include "queue.h"
+
+
+/**
+ * The playback worker takes bells off the queue and performs them, so that
+ * the X event loop never blocks on the sound device or on a bell command.
+ *
+ * When the playback device is kept open, the worker also closes it after
+ * `idle_timeout' milliseconds without a bell (0 means never).
+ *
+ * With `mix' set, bells are handed to the mixer, which has to be started
+ * beforehand, instead of being played one after another.
+ */
+bool start_player (bell_queue_t *queue, beep_descriptor_t *beep,
+                   bool keep_open, unsigned int idle_timeout, bool mix);
+void stop_player  (void);
+
+/**
+ * Hands a new beep over to the worker, which switches to it before the next
+ * bell.  A bell being played finishes with the old beep, which is freed once
+ * nothing plays from it any longer.  The new beep must have been set up the
+ * same way as the one given to start_player ().
+ */
+void               replace_player_beep (beep_descriptor_t *beep);
+
+/* The beep in use; once the worker is stopped, the caller's to free. */
+beep_descriptor_t *current_player_beep (void);
+
+
+#endif /* _NXBELLD_PLAYER_H_ */
@@ -0,0 +1,606 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_PULSE
+
+#include "pcm.h"
+#include "metrics.h"
+#include <unistd.h>
+#include <pulse/pulseaudio.h>
+#include <pulse/simple.h>
+#include <pulse/error.h>
+
+#define BUF_SIZE 4096
+
+/**
+ * The PulseAudio backend plays the sound nxbelld keeps for every bell from
+ * the server's sample cache: it's uploaded once, and each bell merely asks
+ * the server to play it by name.  Other sounds, such as the beeps made for
+ * --per-bell, and files played from disk, are played through a stream.
+ *
+ * Talking to the sample cache takes the asynchronous API, run by a
+ * threaded main loop, whose lock guards everything here but the stream.
+ * Should the server go away, the next bell connects again, and uploads
+ * every sound anew.
+ */
+typedef struct pulse_sample pulse_sample_t;
+
+struct pulse_sample
+{
+  playable_pcm_buffer_t *buffer;
+  char                   name[48];
+
+  pulse_sample_t        *next;
+};
+
+static pa_threaded_mainloop *mainloop = NULL;
+static pa_context           *context  = NULL;
+static pulse_sample_t       *samples  = NULL;
+static unsigned int          samples_made = 0;
+
+/* The stream other sounds are played through, and its format. */
+static pa_simple            *stream = NULL;
+static pcm_data_info_t       stream_info;
+
+static void close_pulse_device (void);
+
+static bool
+determine_sample_spec (pcm_data_info_t *info, pa_sample_spec *spec)
+{
+  bool big_endian;
+
+  /* Non-native data is little-endian, as found in WAVE files. */
+#ifdef WORDS_BIGENDIAN
+  big_endian = info->native_endian;
+#else
+  big_endian = false;
+#endif
+
+  spec->rate     = info->sample_rate;
+  spec->channels = info->channels;
+
+  if (info->floating)
+    {
+      if (info->bytes_per_sample != 4)
+        return false;
+
+      spec->format = big_endian ? PA_SAMPLE_FLOAT32BE : PA_SAMPLE_FLOAT32LE;
+      return true;
+    }
+
+  if (info->bytes_per_sample == 1)
+    {
+      spec->format = PA_SAMPLE_U8;
+      return ! info->sign;
+    }
+
+  if (! info->sign)
+    return false;
+
+  switch (info->bytes_per_sample)
+    {
+      case 2:
+        spec->format = big_endian ? PA_SAMPLE_S16BE : PA_SAMPLE_S16LE;
+        return true;
+
+      case 3:
+        spec->format = big_endian ? PA_SAMPLE_S24BE : PA_SAMPLE_S24LE;
+        return true;
+
+      case 4:
+        if (info->bits_per_sample == 24)
+          spec->format = big_endian ? PA_SAMPLE_S24_32BE : PA_SAMPLE_S24_32LE;
+        else
+          spec->format = big_endian ? PA_SAMPLE_S32BE : PA_SAMPLE_S32LE;
+        return true;
+    }
+
+  return false;
+}
+
+
+static void
+context_state_changed (pa_context *changed, void *unused)
+{
+  pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static void
+stream_state_changed (pa_stream *changed, void *unused)
+{
+  pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static void
+operation_done (pa_context *done, int success, void *result)
+{
+  *((int *) result) = success;
+  pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+static void
+server_info_received (pa_context *queried, const pa_server_info *server,
+                      void *rate)
+{
+  if (server != NULL)
+    *((unsigned int *) rate) = server->sample_spec.rate;
+
+  pa_threaded_mainloop_signal (mainloop, 0);
+}
+
+/* With the lock held, waits for the operation to complete, and drops it. */
+static bool
+wait_for_operation (pa_operation *operation)
+{
+  if (operation == NULL)
+    return false;
+
+  while (pa_operation_get_state (operation) == PA_OPERATION_RUNNING)
+    pa_threaded_mainloop_wait (mainloop);
+
+  pa_operation_unref (operation);
+  return true;
+}
+
+/* With the lock held, waits for the stream to get to the `wanted' state. */
+static bool
+wait_for_stream (pa_stream *waited, pa_stream_state_t wanted)
+{
+  pa_stream_state_t state;
+
+  while ((state = pa_stream_get_state (waited)) != wanted)
+    {
+      if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED)
+        return false;
+
+      pa_threaded_mainloop_wait (mainloop);
+    }
+
+  return true;
+}
+
+static bool
+start_mainloop (void)
+{
+  if (mainloop != NULL)
+    return true;
+
+  mainloop = pa_threaded_mainloop_new ();
+  if (mainloop == NULL)
+    {
+      fprintf (stderr, "%s: Failed to create the PulseAudio main loop.\n",
+               progname);
+
+      return false;
+    }
+
+  if (pa_threaded_mainloop_start (mainloop) < 0)
+    {
+      fprintf (stderr, "%s: Failed to start the PulseAudio main loop.\n",
+               progname);
+
+      pa_threaded_mainloop_free (mainloop);
+      mainloop = NULL;
+      return false;
+    }
+
+  return true;
+}
+
+static void
+disconnect_context (void)
+{
+  pa_context_disconnect (context);
+  pa_context_unref (context);
+  context = NULL;
+}
+
+/* With the lock held, uploads the sample's sound into the sample cache. */
+static bool
+send_sample (pulse_sample_t *sample)
+{
+  playable_pcm_buffer_t *buffer = sample->buffer;
+  pa_sample_spec         spec;
+  pa_stream             *upload;
+  bool                   sent;
+
+
+  if (! determine_sample_spec (&(buffer->info), &spec))
+    {
+      fprintf (stderr, "%s: PulseAudio can't play the sound's sample "
+                       "format.\n",
+               progname);
+
+      return false;
+    }
+
+  upload = pa_stream_new (context, sample->name, &spec, NULL);
+  if (upload == NULL)
+    {
+      fprintf (stderr, "%s: Failed to upload the sound to PulseAudio: %s.\n",
+               progname, pa_strerror (pa_context_errno (context)));
+
+      return false;
+    }
+  pa_stream_set_state_callback (upload, stream_state_changed, NULL);
+
+  sent = (pa_stream_connect_upload (upload, buffer->data_len) == 0
+          && wait_for_stream (upload, PA_STREAM_READY)
+          && pa_stream_write (upload, buffer->data, buffer->data_len, NULL, 0,
+                              PA_SEEK_RELATIVE) == 0
+          && pa_stream_finish_upload (upload) == 0
+          && wait_for_stream (upload, PA_STREAM_TERMINATED));
+  if (! sent)
+    fprintf (stderr, "%s: Failed to upload the sound to PulseAudio: %s.\n",
+             progname, pa_strerror (pa_context_errno (context)));
+
+  pa_stream_set_state_callback (upload, NULL, NULL);
+  pa_stream_unref (upload);
+  return sent;
+}
+
+/**
+ * With the lock held, makes sure the context is connected, connecting it
+ * anew if the server went away, and uploading every sample again then.
+ */
+static bool
+connect_context (void)
+{
+  pa_context_state_t  state;
+  pulse_sample_t     *sample;
+
+  if (context != NULL)
+    {
+      if (pa_context_get_state (context) == PA_CONTEXT_READY)
+        return true;
+
+      disconnect_context ();
+    }
+
+  context = pa_context_new (pa_threaded_mainloop_get_api (mainloop),
+                            PACKAGE_NAME);
+  if (context == NULL)
+    {
+      fprintf (stderr, "%s: Failed to create a PulseAudio context.\n",
+               progname);
+
+      return false;
+    }
+  pa_context_set_state_callback (context, context_state_changed, NULL);
+
+  if (pa_context_connect (context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0)
+    state = PA_CONTEXT_FAILED;
+  else
+    {
+      while ((state = pa_context_get_state (context)) != PA_CONTEXT_READY
+             && PA_CONTEXT_IS_GOOD (state))
+        pa_threaded_mainloop_wait (mainloop);
+    }
+
+  if (state != PA_CONTEXT_READY)
+    {
+      fprintf (stderr, "%s: Failed to connect to the PulseAudio server: %s.\n",
+               progname, pa_strerror (pa_context_errno (context)));
+
+      disconnect_context ();
+      return false;
+    }
+
+  for (sample = samples; sample != NULL; sample = sample->next)
+    send_sample (sample);
+
+  return true;
+}
+
+static pulse_sample_t *
+find_sample (playable_pcm_buffer_t *buffer)
+{
+  pulse_sample_t *sample;
+
+  for (sample = samples; sample != NULL; sample = sample->next)
+    if (sample->buffer == buffer)
+      return sample;
+
+  return NULL;
+}
+
+
+static bool
+probe_pulse_device (pcm_data_info_t *info)
+{
+  unsigned int rate;
+  bool         connected;
+
+
+  if (! start_mainloop ())
+    return false;
+
+  rate = 0;
+  pa_threaded_mainloop_lock (mainloop);
+  connected = connect_context ();
+  if (connected)
+    wait_for_operation (pa_context_get_server_info (context,
+                                                    server_info_received,
+                                                    &rate));
+  pa_threaded_mainloop_unlock (mainloop);
+
+  if (! connected)
+    return false;
+
+  /* The server converts anything, floats are kept as they are. */
+  if (rate > 0)
+    info->sample_rate = rate;
+
+  info->native_endian = true;
+  info->sign          = true;
+  if (info->floating)
+    info->bytes_per_sample = 4;
+  else if (info->bits_per_sample > 16)
+    {
+      info->bytes_per_sample = 4;
+      info->bits_per_sample  = 32;
+    }
+  else
+    {
+      info->bytes_per_sample = 2;
+      info->bits_per_sample  = 16;
+    }
+
+  return true;
+}
+
+static bool
+open_pulse_device (pcm_data_info_t *info)
+{
+  pa_sample_spec  spec;
+  pa_buffer_attr  attributes;
+  int             error;
+
+
+  if (stream != NULL)
+    {
+      if (same_pcm_format (&stream_info, info))
+        return true;
+
+      close_pulse_device ();
+    }
+
+  if (! determine_sample_spec (info, &spec))
+    {
+      fprintf (stderr, "%s: PulseAudio can't play the sound's sample "
+                       "format.\n",
+               progname);
+
+      return false;
+    }
+
+  /* Only the amount of buffered audio is asked for. */
+  attributes.maxlength = (uint32_t) -1;
+  attributes.tlength   = (uint32_t) -1;
+  attributes.prebuf    = (uint32_t) -1;
+  attributes.minreq    = (uint32_t) -1;
+  attributes.fragsize  = (uint32_t) -1;
+  if (pcm_device_latency > 0)
+    attributes.tlength = pa_usec_to_bytes (pcm_device_latency, &spec);
+
+  stream = pa_simple_new (NULL, PACKAGE_NAME, PA_STREAM_PLAYBACK,
+                          pcm_device_name, "bell", &spec, NULL,
+                          &attributes, &error);
+  if (stream == NULL)
+    {
+      fprintf (stderr, "%s: Failed to open a PulseAudio stream: %s.\n",
+               progname, pa_strerror (error));
+
+      return false;
+    }
+  count_metric (METRIC_DEVICE_OPENS);
+
+  stream_info = *info;
+  return true;
+}
+
+static bool
+write_pulse_device (uint8_t *data, size_t len)
+{
+  size_t  to_write;
+  size_t  already_wrote;
+  int     error;
+
+
+  already_wrote = 0;
+  while (already_wrote < len)
+    {
+      to_write = len - already_wrote;
+      if (to_write > BUF_SIZE)
+        to_write = BUF_SIZE;
+
+      if (pa_simple_write (stream, data + already_wrote, to_write,
+                           &error) < 0)
+        {
+          fprintf (stderr, "%s: An error occured while writing to the "
+                           "PulseAudio stream: %s.\n",
+                   progname, pa_strerror (error));
+
+          return false;
+        }
+
+      already_wrote += to_write;
+      note_first_sample ();
+    }
+
+  return true;
+}
+
+static void
+drain_pulse_device (void)
+{
+  int error;
+
+  if (stream != NULL)
+    pa_simple_drain (stream, &error);
+}
+
+static void
+close_pulse_device (void)
+{
+  if (stream == NULL)
+    return;
+
+  pa_simple_free (stream);
+  stream = NULL;
+}
+
+static bool
+upload_pulse_buffer (playable_pcm_buffer_t *buffer)
+{
+  pulse_sample_t *sample;
+  bool            uploaded;
+
+
+  if (! start_mainloop ())
+    return false;
+
+  pa_threaded_mainloop_lock (mainloop);
+  if (find_sample (buffer) != NULL)
+    {
+      pa_threaded_mainloop_unlock (mainloop);
+      return true;
+    }
+
+  sample = malloc (sizeof (pulse_sample_t));
+  if (sample == NULL)
+    {
+      pa_threaded_mainloop_unlock (mainloop);
+      fprintf (stderr, "%s: Memory allocation failed.\n", progname);
+
+      return false;
+    }
+  sample->buffer = buffer;
+  snprintf (sample->name, sizeof (sample->name), "%s-%ld-%u",
+            PACKAGE_NAME, (long) getpid (), samples_made++);
+
+  /* Kept even if the server isn't there yet, to be uploaded once it is. */
+  sample->next = samples;
+  samples      = sample;
+
+  if (context != NULL && pa_context_get_state (context) == PA_CONTEXT_READY)
+    uploaded = send_sample (sample);
+  else
+    uploaded = connect_context ();
+  pa_threaded_mainloop_unlock (mainloop);
+
+  return uploaded;
+}
+
+static bool
+play_uploaded_pulse_buffer (playable_pcm_buffer_t *buffer)
+{
+  pulse_sample_t *sample;
+  unsigned int    attempt;
+  int             success;
+  bool            played;
+
+
+  if (mainloop == NULL)
+    return false;
+
+  pa_threaded_mainloop_lock (mainloop);
+  sample = find_sample (buffer);
+
+  played = false;
+  for (attempt = 0; sample != NULL && ! played && attempt < 2; attempt++)
+    {
+      if (! connect_context ())
+        break;
+
+      success = 0;
+      played  = wait_for_operation (pa_context_play_sample (context,
+                                                            sample->name,
+                                                            pcm_device_name,
+                                                            PA_VOLUME_NORM,
+                                                            operation_done,
+                                                            &success))
+                && success;
+
+      /* A restarted server may have lost the sample before we noticed. */
+      if (! played && pa_context_get_state (context) == PA_CONTEXT_READY
+          && ! send_sample (sample))
+        break;
+    }
+  pa_threaded_mainloop_unlock (mainloop);
+
+  if (played)
+    note_first_sample ();
+
+  return played;
+}
+
+static void
+forget_pulse_buffer (playable_pcm_buffer_t *buffer)
+{
+  pulse_sample_t **link;
+  pulse_sample_t  *sample;
+  pa_operation    *operation;
+
+
+  if (mainloop == NULL)
+    return;
+
+  pa_threaded_mainloop_lock (mainloop);
+  for (link = &samples; *link != NULL; link = &((*link)->next))
+    {
+      if ((*link)->buffer != buffer)
+        continue;
+
+      sample = *link;
+      *link  = sample->next;
+
+      if (context != NULL
+          && pa_context_get_state (context) == PA_CONTEXT_READY)
+        {
+          operation = pa_context_remove_sample (context, sample->name, NULL,
+                                                NULL);
+          if (operation != NULL)
+            pa_operation_unref (operation);
+        }
+
+      free (sample);
+      break;
+    }
+  pa_threaded_mainloop_unlock (mainloop);
+}
+
+const pcm_backend_t pulse_backend =
+{
+  .name          = "pulse",
+  .automatic     = true,
+  .probe         = probe_pulse_device,
+  .open          = open_pulse_device,
+  .write         = write_pulse_device,
+  .drain         = drain_pulse_device,
+  .close         = close_pulse_device,
+  .upload        = upload_pulse_buffer,
+  .play_uploaded = play_uploaded_pulse_buffer,
+  .forget        = forget_pulse_buffer
+};
+
+#endif /* HAVE_PULSE */
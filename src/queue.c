@@ -0,0 +1,257 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "queue.h"
+
+bell_queue_t *
+create_bell_queue (unsigned int length, unsigned int policy)
+{
+  bell_queue_t *queue;
+  unsigned int  size;
+  unsigned int  index;
+
+  queue = malloc (sizeof (bell_queue_t));
+  if (queue == NULL)
+    {
+      fprintf (stderr, "%s: create_bell_queue (): Memory allocation "
+                       "failed: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+
+  /* Round the length up to a power of two, so that indices can be masked. */
+  size = 1;
+  while (size < length)
+    size <<= 1;
+
+  queue->slots = malloc (size * sizeof (bell_slot_t));
+  if (queue->slots == NULL)
+    {
+      fprintf (stderr, "%s: create_bell_queue (): Failed to allocate the "
+                       "bell slots: %s.\n",
+               progname, strerror (errno));
+
+      free (queue);
+      return NULL;
+    }
+
+  if (sem_init (&(queue->pending), 0, 0) != 0)
+    {
+      fprintf (stderr, "%s: create_bell_queue (): Failed to initialize a "
+                       "semaphore: %s.\n",
+               progname, strerror (errno));
+
+      free (queue->slots);
+      free (queue);
+      return NULL;
+    }
+
+  queue->mask   = size - 1;
+  queue->policy = policy;
+
+  for (index = 0; index < size; index++)
+    atomic_init (&(queue->slots[index].seq), index);
+
+  atomic_init (&(queue->head), 0);
+  atomic_init (&(queue->tail), 0);
+
+  atomic_init (&(queue->enqueued),       0);
+  atomic_init (&(queue->dropped_newest), 0);
+  atomic_init (&(queue->dropped_oldest), 0);
+  atomic_init (&(queue->coalesced),      0);
+
+  return queue;
+}
+
+void
+free_bell_queue (bell_queue_t *queue)
+{
+  if (queue == NULL)
+    return;
+
+  sem_destroy (&(queue->pending));
+  free (queue->slots);
+  free (queue);
+}
+
+void
+push_bell (bell_queue_t *queue, const bell_event_t *event)
+{
+  bell_slot_t  *slot;
+  unsigned int  head;
+  unsigned int  tail;
+
+  tail = atomic_load_explicit (&(queue->tail), memory_order_relaxed);
+  head = atomic_load_explicit (&(queue->head), memory_order_acquire);
+
+  if (queue->policy == OVERFLOW_COALESCE && head != tail)
+    {
+      atomic_fetch_add_explicit (&(queue->coalesced), 1, memory_order_relaxed);
+      return;
+    }
+
+  slot = &(queue->slots[tail & queue->mask]);
+  if (atomic_load_explicit (&(slot->seq), memory_order_acquire) != tail)
+    {
+      /**
+       * The ring is full.  The slot to write holds the oldest bell, which
+       * may be dropped unless the consumer has claimed it meanwhile; then
+       * it's being copied out, and the new bell is dropped instead.  Either
+       * way, the number of waiting bells stays the same.
+       */
+      if (queue->policy == OVERFLOW_DROP_OLDEST
+          && tail - head > queue->mask
+          && atomic_compare_exchange_strong (&(queue->head), &head, head + 1))
+        atomic_fetch_add_explicit (&(queue->dropped_oldest), 1,
+                                   memory_order_relaxed);
+      else
+        {
+          atomic_fetch_add_explicit (&(queue->dropped_newest), 1,
+                                     memory_order_relaxed);
+          return;
+        }
+
+      slot->event = *event;
+      atomic_store_explicit (&(slot->seq), tail + 1, memory_order_release);
+      atomic_store_explicit (&(queue->tail), tail + 1, memory_order_release);
+      atomic_fetch_add_explicit (&(queue->enqueued), 1, memory_order_relaxed);
+      return;
+    }
+
+  slot->event = *event;
+  atomic_store_explicit (&(slot->seq), tail + 1, memory_order_release);
+  atomic_store_explicit (&(queue->tail), tail + 1, memory_order_release);
+  atomic_fetch_add_explicit (&(queue->enqueued), 1, memory_order_relaxed);
+
+  sem_post (&(queue->pending));
+}
+
+static void
+add_milliseconds (struct timespec *time, unsigned long ms)
+{
+  time->tv_sec  += ms / 1000;
+  time->tv_nsec += (ms % 1000) * 1000000;
+  if (time->tv_nsec >= 1000000000)
+    {
+      time->tv_sec  += 1;
+      time->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * The timeout is measured on CLOCK_MONOTONIC, so that the wall clock being
+ * set can't cut it short or stretch it.
+ */
+bool
+wait_for_bell (bell_queue_t *queue, unsigned long timeout)
+{
+  struct timespec deadline;
+#ifndef HAVE_SEM_CLOCKWAIT
+  struct timespec now;
+  struct timespec wall_deadline;
+  long long       remaining;
+#endif
+
+  if (timeout == 0)
+    return (sem_wait (&(queue->pending)) == 0);
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline);
+  add_milliseconds (&deadline, timeout);
+
+#ifdef HAVE_SEM_CLOCKWAIT
+  return (sem_clockwait (&(queue->pending), CLOCK_MONOTONIC, &deadline) == 0);
+#else
+  /* Wait again should the wall clock have jumped ahead meanwhile. */
+  for (;;)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      remaining = (deadline.tv_sec - now.tv_sec) * 1000LL
+                  + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+      if (remaining <= 0)
+        {
+          if (sem_trywait (&(queue->pending)) == 0)
+            return true;
+
+          /* Callers tell a timeout from a failure as with sem_timedwait. */
+          if (errno == EAGAIN)
+            errno = ETIMEDOUT;
+          return false;
+        }
+
+      clock_gettime (CLOCK_REALTIME, &wall_deadline);
+      add_milliseconds (&wall_deadline, remaining);
+      if (sem_timedwait (&(queue->pending), &wall_deadline) == 0)
+        return true;
+      if (errno != ETIMEDOUT && errno != EINTR)
+        return false;
+    }
+#endif
+}
+
+bool
+pop_bell (bell_queue_t *queue, bell_event_t *event)
+{
+  bell_slot_t  *slot;
+  unsigned int  head;
+
+  /**
+   * The slot is claimed before it's copied.  The head is only ever moved by
+   * the producer when it drops the oldest bell, in which case the next one
+   * is tried.
+   */
+  head = atomic_load_explicit (&(queue->head), memory_order_relaxed);
+  do
+    {
+      slot = &(queue->slots[head & queue->mask]);
+      if (atomic_load_explicit (&(slot->seq), memory_order_acquire)
+          != head + 1)
+        return false;
+    }
+  while (! atomic_compare_exchange_weak (&(queue->head), &head, head + 1));
+
+  *event = slot->event;
+  atomic_store_explicit (&(slot->seq), head + queue->mask + 1,
+                         memory_order_release);
+
+  return true;
+}
+
+void
+wake_bell_queue (bell_queue_t *queue)
+{
+  sem_post (&(queue->pending));
+}
+
+bool
+parse_overflow_policy (const char *name, unsigned int *policy)
+{
+  if (strcmp (name, "drop-newest") == 0)
+    *policy = OVERFLOW_DROP_NEWEST;
+  else if (strcmp (name, "drop-oldest") == 0)
+    *policy = OVERFLOW_DROP_OLDEST;
+  else if (strcmp (name, "coalesce") == 0)
+    *policy = OVERFLOW_COALESCE;
+  else
+    return false;
+
+  return true;
+}
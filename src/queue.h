@@ -0,0 +1,124 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_QUEUE_H_
+#define _NXBELLD_QUEUE_H_ 1
+
+#include "common.h"
+
+#include <time.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+
+/* Longest bell name kept, longer ones are truncated. */
+#define BELL_NAME_MAX  64
+
+/* A bell, as handed over from the X event loop to the playback worker. */
+typedef struct bell_event bell_event_t;
+
+struct bell_event
+{
+  struct timespec  received;     /* CLOCK_MONOTONIC time of reception. */
+  unsigned long    server_time;  /* The X server's timestamp of the bell. */
+  unsigned long    window;       /* The window the bell was rung for, or 0. */
+  /* The bell's name, or "".  Copied, as the display may be gone by now. */
+  char             name[BELL_NAME_MAX];
+
+  /* The bell parameters requested by the client, 0 where not given. */
+  unsigned int     pitch;        /* Hz. */
+  unsigned int     duration;     /* ms. */
+  unsigned int     percent;      /* 0 -- 100. */
+};
+
+/**
+ * A bounded single-producer/single-consumer ring of bells.
+ *
+ * The X event loop is the only producer, the playback worker is the only
+ * consumer.  What happens to a bell which arrives while the ring is full
+ * is decided by the overflow policy:
+ *
+ *   OVERFLOW_DROP_NEWEST - the new bell is discarded,
+ *   OVERFLOW_DROP_OLDEST - the oldest waiting bell is discarded,
+ *   OVERFLOW_COALESCE    - a bell which arrives while another one is still
+ *                          waiting to be played is merged into it, whether
+ *                          the ring is full or not.
+ */
+typedef struct bell_queue bell_queue_t;
+typedef struct bell_slot  bell_slot_t;
+
+/**
+ * A slot's sequence number tells whose turn it is: the slot for index `i'
+ * may be written when it equals `i', and read when it equals `i + 1'.  The
+ * reader hands it back for the next round by setting it to `i + size'.  So
+ * a slot is never written while it's being read, even when the oldest bell
+ * is dropped.
+ */
+struct bell_slot
+{
+  atomic_uint      seq;
+  bell_event_t     event;
+};
+
+struct bell_queue
+{
+  bell_slot_t     *slots;
+  unsigned int     mask;
+  unsigned int     policy;
+
+  atomic_uint      head;    /* Index of the next bell to be played. */
+  atomic_uint      tail;    /* Index of the next free slot. */
+  sem_t            pending; /* Counts the bells waiting in the ring. */
+
+  /* Outcome counters. */
+  atomic_ulong     enqueued;
+  atomic_ulong     dropped_newest;
+  atomic_ulong     dropped_oldest;
+  atomic_ulong     coalesced;
+};
+enum
+{
+  OVERFLOW_DROP_NEWEST,
+  OVERFLOW_DROP_OLDEST,
+  OVERFLOW_COALESCE
+};
+
+bell_queue_t *create_bell_queue (unsigned int length, unsigned int policy);
+void          free_bell_queue   (bell_queue_t *queue);
+
+/* Producer side, never blocks. */
+void push_bell (bell_queue_t *queue, const bell_event_t *event);
+
+/**
+ * Consumer side.  wait_for_bell () blocks until a bell is available, or until
+ * `timeout' milliseconds pass if it is non-zero.  It returns false on a
+ * timeout, with errno set to ETIMEDOUT, or an interruption; pop_bell () may
+ * be called once after it returned true.
+ */
+bool wait_for_bell (bell_queue_t *queue, unsigned long timeout);
+bool pop_bell      (bell_queue_t *queue, bell_event_t *event);
+
+/* Makes a blocked wait_for_bell () return. */
+void wake_bell_queue (bell_queue_t *queue);
+
+bool parse_overflow_policy (const char *name, unsigned int *policy);
+
+
+#endif /* _NXBELLD_QUEUE_H_ */
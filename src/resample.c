@@ -0,0 +1,267 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+#include "convert.h"
+#include "resample.h"
+#include <math.h>
+
+#if defined (__SSE__)
+# include <xmmintrin.h>
+#elif defined (__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+/**
+ * The rate ratio is reduced to `up'/`down'; every output sample lies at one
+ * of `up' fractional positions between two input samples, and has its own
+ * set of filter taps (a phase).  Ratios with more than RESAMPLE_PHASES
+ * positions share the nearest phase, which is off by at most 1/1024th of
+ * a sample.
+ *
+ * The filter is a Kaiser-windowed sinc, with RESAMPLE_ZERO_CROSSINGS zero
+ * crossings on each side; when decimating, the cutoff is lowered below the
+ * output Nyquist frequency, and the filter lengthened accordingly.
+ */
+#define RESAMPLE_PHASES           1024
+#define RESAMPLE_ZERO_CROSSINGS   16
+#define RESAMPLE_MAX_TAPS         512
+#define RESAMPLE_KAISER_BETA      8.6
+#define RESAMPLE_BANDWIDTH        0.95
+
+
+static unsigned int
+gcd (unsigned int a, unsigned int b)
+{
+  unsigned int rest;
+
+  while (b != 0)
+    {
+      rest = a % b;
+      a    = b;
+      b    = rest;
+    }
+
+  return a;
+}
+
+/* The zeroth order modified Bessel function of the first kind. */
+static double
+bessel_i0 (double x)
+{
+  double sum  = 1.0;
+  double term = 1.0;
+  int    k;
+
+  for (k = 1; k < 50 && term > sum * 1e-12; k++)
+    {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum  += term;
+    }
+
+  return sum;
+}
+
+static float *
+design_filter (unsigned int phases, unsigned int taps, double cutoff)
+{
+  float        *coefs;
+  double       *phase_coefs;
+  double        x;
+  double        r;
+  double        sum;
+  unsigned int  phase;
+  unsigned int  tap;
+
+  coefs       = malloc ((size_t) phases * taps * sizeof (float));
+  phase_coefs = malloc (taps * sizeof (double));
+  if (coefs == NULL || phase_coefs == NULL)
+    {
+      free (coefs);
+      free (phase_coefs);
+      return NULL;
+    }
+
+  for (phase = 0; phase < phases; phase++)
+    {
+      sum = 0.0;
+      for (tap = 0; tap < taps; tap++)
+        {
+          /* Distance of the tap's input sample from the output sample. */
+          x = (double) tap - (taps / 2 - 1) - (double) phase / phases;
+          r = x / (taps / 2);
+
+          phase_coefs[tap] = (x == 0.0) ? cutoff
+                             : sin (M_PI * cutoff * x) / (M_PI * x);
+          phase_coefs[tap] *= (fabs (r) < 1.0)
+                              ? bessel_i0 (RESAMPLE_KAISER_BETA
+                                           * sqrt (1.0 - r * r))
+                                / bessel_i0 (RESAMPLE_KAISER_BETA)
+                              : 0.0;
+          sum += phase_coefs[tap];
+        }
+
+      /* Unity gain at DC for every phase. */
+      for (tap = 0; tap < taps; tap++)
+        coefs[phase * taps + tap] = phase_coefs[tap] / sum;
+    }
+
+  free (phase_coefs);
+  return coefs;
+}
+
+static float
+dot_product (const float *restrict a, const float *restrict b,
+             unsigned int count)
+{
+  unsigned int iter = 0;
+  float        sum  = 0.0f;
+
+#if defined (__SSE__)
+  __m128 acc = _mm_setzero_ps ();
+  float  lanes[4];
+
+  for (; iter + 4 <= count; iter += 4)
+    acc = _mm_add_ps (acc, _mm_mul_ps (_mm_loadu_ps (a + iter),
+                                       _mm_loadu_ps (b + iter)));
+
+  _mm_storeu_ps (lanes, acc);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined (__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32 (0.0f);
+
+  for (; iter + 4 <= count; iter += 4)
+    acc = vmlaq_f32 (acc, vld1q_f32 (a + iter), vld1q_f32 (b + iter));
+
+  sum = (vgetq_lane_f32 (acc, 0) + vgetq_lane_f32 (acc, 1))
+        + (vgetq_lane_f32 (acc, 2) + vgetq_lane_f32 (acc, 3));
+#endif
+
+  for (; iter < count; iter++)
+    sum += a[iter] * b[iter];
+
+  return sum;
+}
+
+bool
+resample_pcm_buffer (playable_pcm_buffer_t *buffer, unsigned int rate)
+{
+  pcm_data_info_t  float_format;
+  const float     *in;
+  float           *out;
+  float           *padded;
+  float           *coefs;
+  unsigned int     channels;
+  unsigned int     divisor;
+  unsigned int     up;
+  unsigned int     down;
+  unsigned int     phases;
+  unsigned int     taps;
+  unsigned int     lead;
+  unsigned int     channel;
+  uint64_t         in_frames;
+  uint64_t         out_frames;
+  uint64_t         position;
+  uint64_t         frame;
+  double           cutoff;
+
+
+  if (buffer->info.sample_rate == rate)
+    return true;
+
+  if (buffer->info.sample_rate == 0 || rate == 0)
+    {
+      fprintf (stderr, "%s: Cannot resample sound data to or from 0 Hz.\n",
+               progname);
+
+      return false;
+    }
+
+  float_format                  = buffer->info;
+  float_format.native_endian    = true;
+  float_format.sign             = true;
+  float_format.floating         = true;
+  float_format.bytes_per_sample = 4;
+  float_format.bits_per_sample  = 32;
+  if (! convert_pcm_buffer (buffer, &float_format))
+    return false;
+
+  divisor = gcd (buffer->info.sample_rate, rate);
+  up      = rate / divisor;
+  down    = buffer->info.sample_rate / divisor;
+  phases  = (up < RESAMPLE_PHASES) ? up : RESAMPLE_PHASES;
+
+  cutoff  = RESAMPLE_BANDWIDTH * ((up < down) ? (double) up / down : 1.0);
+  taps    = ceil (2 * RESAMPLE_ZERO_CROSSINGS / cutoff);
+  taps    = (taps + 3) & ~3U;
+  if (taps > RESAMPLE_MAX_TAPS)
+    taps = RESAMPLE_MAX_TAPS;
+  lead    = taps / 2 - 1;
+
+  channels   = buffer->info.channels;
+  in_frames  = buffer->data_len / (sizeof (float) * channels);
+  out_frames = (in_frames * up + down - 1) / down;
+
+  coefs  = design_filter (phases, taps, cutoff);
+  padded = calloc (in_frames + taps, sizeof (float));
+  out    = malloc (out_frames * channels * sizeof (float));
+  if (coefs == NULL || padded == NULL || out == NULL)
+    {
+      fprintf (stderr, "%s: Allocating memory for resampling failed: %s.\n",
+               progname, strerror (errno));
+
+      free (coefs);
+      free (padded);
+      free (out);
+      return false;
+    }
+
+  in = (const float *) buffer->data;
+  for (channel = 0; channel < channels; channel++)
+    {
+      /* One channel, with silence before and after it. */
+      for (frame = 0; frame < in_frames; frame++)
+        padded[lead + frame] = in[frame * channels + channel];
+
+      for (frame = 0; frame < out_frames; frame++)
+        {
+          position = frame * down;
+          out[frame * channels + channel]
+            = dot_product (padded + position / up,
+                           coefs + ((position % up) * phases / up) * taps,
+                           taps);
+        }
+    }
+
+  free (coefs);
+  free (padded);
+
+  replace_pcm_buffer_data (buffer, (uint8_t *) out,
+                           out_frames * channels * sizeof (float));
+  buffer->info.sample_rate = rate;
+
+  return true;
+}
+
+#endif /* HAVE_SOUND */
@@ -0,0 +1,39 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_RESAMPLE_H_
+#define _NXBELLD_RESAMPLE_H_ 1
+
+#include "common.h"
+
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+
+/**
+ * Converts the buffer to the given sampling rate, with a polyphase
+ * windowed-sinc filter.  The resampled buffer holds native-endian 32-bit
+ * floating point samples; convert_pcm_buffer () takes it from there.
+ */
+bool resample_pcm_buffer (playable_pcm_buffer_t *buffer, unsigned int rate);
+
+#endif /* HAVE_SOUND */
+#endif /* _NXBELLD_RESAMPLE_H_ */
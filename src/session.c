@@ -0,0 +1,488 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "session.h"
+#include "metrics.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* Where local X servers put their sockets. */
+#define X11_UNIX_DIR            "/tmp/.X11-unix"
+
+/* How often lost and new displays are looked for, in ms. */
+#define SESSION_CHECK_INTERVAL  2000
+
+/* Delays before connecting to a display again, in ms. */
+#define SESSION_MIN_BACKOFF     2000
+#define SESSION_MAX_BACKOFF     300000
+
+
+static const char *
+session_label (bell_session_t *session)
+{
+  return (session->name != NULL) ? session->name : "the default display";
+}
+
+static void
+hand_over_bell (const bell_event_t *bell, void *data)
+{
+  bell_session_t *session = data;
+
+  session->received++;
+  count_metric (METRIC_BELLS_RECEIVED);
+  if (admit_bell (&(session->throttle), &(bell->received)))
+    push_bell (session->set->queue, bell);
+  else
+    count_metric (METRIC_BELLS_THROTTLED);
+}
+
+static void
+schedule_retry (bell_session_t *session)
+{
+  clock_gettime (CLOCK_MONOTONIC, &(session->retry_at));
+  session->retry_at.tv_sec  += session->backoff / 1000;
+  session->retry_at.tv_nsec += (session->backoff % 1000) * 1000000;
+  if (session->retry_at.tv_nsec >= 1000000000)
+    {
+      session->retry_at.tv_sec++;
+      session->retry_at.tv_nsec -= 1000000000;
+    }
+
+  if (session->backoff < SESSION_MAX_BACKOFF / 2)
+    session->backoff *= 2;
+  else
+    session->backoff = SESSION_MAX_BACKOFF;
+}
+
+static void
+lose_session (bell_session_t *session)
+{
+  session_set_t *set = session->set;
+
+  unwatch_loop_fd (set->loop, session->fd);
+  close_bell_display (session->display);
+  session->display = NULL;
+
+  fprintf (stderr, "%s: Lost the connection to %s.\n",
+           progname, session_label (session));
+  if (! set->persistent)
+    {
+      set->lost = true;
+      stop_event_loop (set->loop);
+      return;
+    }
+
+  session->backoff = SESSION_MIN_BACKOFF;
+  schedule_retry (session);
+}
+
+/**
+ * The event loop only timestamps bells and hands them over to the playback
+ * worker, so that a long beep never holds up the processing of X events.
+ */
+static void
+read_session_bells (void *data)
+{
+  bell_session_t *session = data;
+
+  if (! read_display_bells (session->display, hand_over_bell, session))
+    lose_session (session);
+}
+
+/* Selects bell notifications on a newly connected display. */
+static bool
+activate_session (bell_session_t *session)
+{
+  session_set_t *set = session->set;
+
+  if (! select_bell_events (session->display))
+    {
+      fprintf (stderr, "%s: Couldn't select bell notifications on %s.\n",
+               progname, session_label (session));
+      return false;
+    }
+
+  /* Hand the audible bell back on exit, unless it was off to begin with. */
+  session->restore_abell = set->disable_abell
+                           && audible_bell_enabled (session->display);
+  if (set->disable_abell)
+    {
+      if (! set_audible_bell (session->display, false))
+        {
+          fprintf (stderr, "%s: Couldn't disable the audible bell of %s.\n",
+                   progname, session_label (session));
+          return false;
+        }
+    }
+
+  return watch_loop_fd (set->loop, session->fd, read_session_bells, session);
+}
+
+static bool
+connect_session (bell_session_t *session)
+{
+  session->display = open_bell_display (session->name);
+  if (session->display == NULL)
+    {
+      schedule_retry (session);
+      return false;
+    }
+  session->fd = bell_display_fd (session->display);
+  session->connects++;
+  session->backoff = SESSION_MIN_BACKOFF;
+
+  if (session->set->loop != NULL && ! activate_session (session))
+    {
+      close_bell_display (session->display);
+      session->display = NULL;
+      schedule_retry (session);
+      return false;
+    }
+
+  if (session->connects > 1 || session->discovered)
+    fprintf (stderr, "%s: Connected to %s.\n",
+             progname, session_label (session));
+
+  return true;
+}
+
+static bell_session_t *
+new_session (session_set_t *set, const char *name)
+{
+  bell_session_t  *session;
+  bell_session_t **sessions;
+
+  if (set->count == set->size)
+    {
+      sessions = realloc (set->sessions,
+                          (set->size + 8) * sizeof (bell_session_t *));
+      if (sessions == NULL)
+        goto no_memory;
+      set->sessions = sessions;
+      set->size    += 8;
+    }
+
+  session = calloc (1, sizeof (bell_session_t));
+  if (session == NULL)
+    goto no_memory;
+  if (name != NULL)
+    {
+      session->name = strdup (name);
+      if (session->name == NULL)
+        {
+          free (session);
+          goto no_memory;
+        }
+    }
+  session->display = NULL;
+  session->fd      = -1;
+  session->backoff = SESSION_MIN_BACKOFF;
+  session->set     = set;
+  init_bell_throttle (&(session->throttle), set->throttle_interval,
+                      set->burst);
+
+  set->sessions[set->count++] = session;
+  return session;
+
+no_memory:
+  fprintf (stderr, "%s: Failed to allocate a display session: %s.\n",
+           progname, strerror (errno));
+
+  return NULL;
+}
+
+static void
+free_session (bell_session_t *session)
+{
+  if (session->display != NULL)
+    {
+      if (session->restore_abell)
+        set_audible_bell (session->display, true);
+      if (session->set->loop != NULL)
+        unwatch_loop_fd (session->set->loop, session->fd);
+      close_bell_display (session->display);
+    }
+
+  free (session->name);
+  free (session);
+}
+
+static bell_session_t *
+find_session (session_set_t *set, const char *name)
+{
+  unsigned int iter;
+
+  for (iter = 0; iter < set->count; iter++)
+    {
+      if (set->sessions[iter]->name != NULL
+          && strcmp (set->sessions[iter]->name, name) == 0)
+        return set->sessions[iter];
+    }
+
+  return NULL;
+}
+
+/* Tells whether a discovered display's socket is still there. */
+static bool
+session_socket_exists (bell_session_t *session)
+{
+  char        path[sizeof (X11_UNIX_DIR) + 16];
+  struct stat info;
+
+  /* Discovered sessions are named `:N', their socket is `XN'. */
+  snprintf (path, sizeof (path), X11_UNIX_DIR "/X%s", session->name + 1);
+
+  return lstat (path, &info) == 0 && S_ISSOCK (info.st_mode);
+}
+
+static void
+scan_sessions (session_set_t *set)
+{
+  DIR            *dir;
+  struct dirent  *entry;
+  bell_session_t *session;
+  char            path[sizeof (X11_UNIX_DIR) + 256 + 1];
+  char            name[256 + 1];
+  struct stat     info;
+
+  dir = opendir (X11_UNIX_DIR);
+  if (dir == NULL)
+    return;
+
+  while ((entry = readdir (dir)) != NULL)
+    {
+      if (entry->d_name[0] != 'X' || entry->d_name[1] == '\0'
+          || strspn (entry->d_name + 1, "0123456789")
+               != strlen (entry->d_name + 1))
+        continue;
+
+      snprintf (path, sizeof (path), X11_UNIX_DIR "/%s", entry->d_name);
+      if (lstat (path, &info) != 0 || ! S_ISSOCK (info.st_mode))
+        continue;
+
+      snprintf (name, sizeof (name), ":%s", entry->d_name + 1);
+      if (find_session (set, name) != NULL)
+        continue;
+
+      session = new_session (set, name);
+      if (session != NULL)
+        {
+          session->discovered = true;
+          connect_session (session);
+        }
+    }
+
+  closedir (dir);
+}
+
+static bool
+retry_due (bell_session_t *session, struct timespec *now)
+{
+  return now->tv_sec > session->retry_at.tv_sec
+         || (now->tv_sec == session->retry_at.tv_sec
+             && now->tv_nsec >= session->retry_at.tv_nsec);
+}
+
+/* Reconnects lost displays, and follows the displays coming and going. */
+static void
+check_sessions (void *data)
+{
+  session_set_t  *set = data;
+  bell_session_t *session;
+  struct timespec now;
+  unsigned int    iter;
+
+  if (set->discover)
+    scan_sessions (set);
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  for (iter = 0; iter < set->count; iter++)
+    {
+      session = set->sessions[iter];
+      if (session->display != NULL)
+        continue;
+
+      if (session->discovered && ! session_socket_exists (session))
+        {
+          /* The X server is gone for good. */
+          free_session (session);
+          set->sessions[iter--] = set->sessions[--set->count];
+          continue;
+        }
+
+      if (retry_due (session, &now))
+        connect_session (session);
+    }
+
+  arm_loop_timer (set->timer, SESSION_CHECK_INTERVAL);
+}
+
+session_set_t *
+create_session_set (unsigned int throttle_interval, unsigned int burst,
+                    bool disable_abell, bool persistent)
+{
+  session_set_t *set;
+
+  set = calloc (1, sizeof (session_set_t));
+  if (set == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the display sessions: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  set->persistent        = persistent;
+  set->discover          = false;
+  set->lost              = false;
+  set->throttle_interval = throttle_interval;
+  set->burst             = burst;
+  set->disable_abell     = disable_abell;
+  set->loop              = NULL;
+
+  return set;
+}
+
+bool
+add_session (session_set_t *set, const char *name)
+{
+  bell_session_t *session;
+
+  if (name != NULL && find_session (set, name) != NULL)
+    return true;
+
+  session = new_session (set, name);
+  if (session == NULL)
+    return false;
+
+  return connect_session (session) || set->persistent;
+}
+
+bool
+discover_sessions (session_set_t *set)
+{
+  set->discover = true;
+  scan_sessions (set);
+
+  return true;
+}
+
+bell_display_t *
+any_session_display (session_set_t *set)
+{
+  unsigned int iter;
+
+  for (iter = 0; iter < set->count; iter++)
+    {
+      if (set->sessions[iter]->display != NULL)
+        return set->sessions[iter]->display;
+    }
+
+  return NULL;
+}
+
+bool
+start_sessions (session_set_t *set, event_loop_t *loop, bell_queue_t *queue)
+{
+  bell_session_t *session;
+  unsigned int    iter;
+
+  set->loop  = loop;
+  set->queue = queue;
+
+  for (iter = 0; iter < set->count; iter++)
+    {
+      session = set->sessions[iter];
+      if (session->display == NULL || activate_session (session))
+        continue;
+
+      if (! set->persistent)
+        return false;
+
+      close_bell_display (session->display);
+      session->display = NULL;
+      schedule_retry (session);
+    }
+
+  if (set->persistent)
+    {
+      set->timer = add_loop_timer (loop, check_sessions, set);
+      if (set->timer == NULL)
+        return false;
+      arm_loop_timer (set->timer, SESSION_CHECK_INTERVAL);
+    }
+
+  return true;
+}
+
+/* The name a display's metrics are labelled with. */
+static const char *
+session_metric_label (bell_session_t *session)
+{
+  if (session->name != NULL)
+    return session->name;
+
+  return (getenv ("DISPLAY") != NULL) ? getenv ("DISPLAY") : "";
+}
+
+void
+write_session_metrics (session_set_t *set, FILE *out)
+{
+  unsigned int iter;
+
+  fprintf (out, "# TYPE nxbelld_display_bells_received_total counter\n");
+  for (iter = 0; iter < set->count; iter++)
+    fprintf (out, "nxbelld_display_bells_received_total{display=\"%s\"} %lu\n",
+             session_metric_label (set->sessions[iter]),
+             set->sessions[iter]->received);
+
+  fprintf (out, "# TYPE nxbelld_display_bells_throttled_total counter\n");
+  for (iter = 0; iter < set->count; iter++)
+    fprintf (out, "nxbelld_display_bells_throttled_total{display=\"%s\"} %lu\n",
+             session_metric_label (set->sessions[iter]),
+             set->sessions[iter]->throttle.suppressed);
+
+  fprintf (out, "# TYPE nxbelld_display_connects_total counter\n");
+  for (iter = 0; iter < set->count; iter++)
+    fprintf (out, "nxbelld_display_connects_total{display=\"%s\"} %lu\n",
+             session_metric_label (set->sessions[iter]),
+             set->sessions[iter]->connects);
+
+  fprintf (out, "# TYPE nxbelld_display_connected gauge\n");
+  for (iter = 0; iter < set->count; iter++)
+    fprintf (out, "nxbelld_display_connected{display=\"%s\"} %d\n",
+             session_metric_label (set->sessions[iter]),
+             set->sessions[iter]->display != NULL);
+}
+
+void
+close_session_set (session_set_t *set)
+{
+  unsigned int iter;
+
+  if (set == NULL)
+    return;
+
+  for (iter = 0; iter < set->count; iter++)
+    free_session (set->sessions[iter]);
+  free (set->sessions);
+  free (set);
+}
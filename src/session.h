@@ -0,0 +1,115 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_SESSION_H_
+#define _NXBELLD_SESSION_H_ 1
+
+#include "common.h"
+#include "display.h"
+#include "queue.h"
+#include "throttle.h"
+#include "loop.h"
+
+#include <time.h>
+
+
+/**
+ * The X displays bells are received from.  Every display has a throttle
+ * and counters of its own, while all of them feed the same bell queue, so
+ * they share a single prepared beep and playback device.
+ */
+typedef struct session_set session_set_t;
+typedef struct bell_session bell_session_t;
+
+struct bell_session
+{
+  char             *name;          /* NULL for $DISPLAY. */
+  bell_display_t   *display;       /* NULL while disconnected. */
+  int               fd;
+  bool              discovered;    /* Found in /tmp/.X11-unix. */
+  bool              restore_abell;
+
+  /* When to try connecting again, and the delay after that. */
+  struct timespec   retry_at;
+  unsigned int      backoff;
+
+  bell_throttle_t   throttle;
+  unsigned long     received;
+  unsigned long     connects;
+
+  session_set_t    *set;
+};
+
+struct session_set
+{
+  bell_session_t  **sessions;
+  unsigned int      count;
+  unsigned int      size;
+
+  /**
+   * With `persistent' set, lost displays are connected to again, otherwise
+   * losing one stops the event loop, and sets `lost'.  With `discover' set,
+   * displays whose socket appears in /tmp/.X11-unix are added, and dropped
+   * again once their socket is gone.
+   */
+  bool              persistent;
+  bool              discover;
+  bool              lost;
+
+  unsigned int      throttle_interval;
+  unsigned int      burst;
+  bool              disable_abell;
+
+  event_loop_t     *loop;
+  bell_queue_t     *queue;
+  loop_timer_t     *timer;
+};
+
+session_set_t *create_session_set (unsigned int throttle_interval,
+                                   unsigned int burst, bool disable_abell,
+                                   bool persistent);
+
+/**
+ * Adds a display, and connects to it right away.  Unless the set is
+ * persistent, failing to connect is an error.
+ */
+bool add_session (session_set_t *set, const char *name);
+
+/* Adds the displays found in /tmp/.X11-unix, and follows them from now on. */
+bool discover_sessions (session_set_t *set);
+
+/* A connected display, to read the server's defaults from, or NULL. */
+bell_display_t *any_session_display (session_set_t *set);
+
+/**
+ * Starts receiving bells from the displays through `loop', and handing
+ * them over to `queue'.
+ */
+bool start_sessions (session_set_t *set, event_loop_t *loop,
+                     bell_queue_t *queue);
+
+/* Writes the counters of every display, labelled with its name. */
+void write_session_metrics (session_set_t *set, FILE *out);
+
+/* Restores the audible bell where it was disabled, and disconnects. */
+void close_session_set (session_set_t *set);
+
+
+#endif /* _NXBELLD_SESSION_H_ */
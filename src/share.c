@@ -0,0 +1,303 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_SOUND
+
+#include "share.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHARE_MAGIC      "NXBELLD\001"
+#define SHARE_MAGIC_LEN  8
+
+/* The PCM data starts at a multiple of this, past the header and the key. */
+#define SHARE_ALIGNMENT  64
+
+typedef struct shared_sound_header shared_sound_header_t;
+
+/* A published file starts with this header, in the host's byte order. */
+struct shared_sound_header
+{
+  char     magic[SHARE_MAGIC_LEN];
+  uint32_t key_len;
+  uint32_t data_offset;
+  uint32_t data_len;
+
+  uint8_t  native_endian;
+  uint8_t  sign;
+  uint8_t  floating;
+  uint8_t  reserved;
+
+  uint32_t sample_rate;
+  uint32_t channels;
+  uint32_t bytes_per_sample;
+  uint32_t bits_per_sample;
+};
+
+/* The file a sound is published as, named by the FNV-1a hash of its key. */
+static char *
+shared_sound_path (const char *dir, const char *key)
+{
+  uint64_t hash;
+  char    *path;
+
+  hash = 0xcbf29ce484222325ull;
+  for (; *key != '\0'; key++)
+    hash = (hash ^ (uint8_t) *key) * 0x100000001b3ull;
+
+  path = malloc (strlen (dir) + 32);
+  if (path == NULL)
+    {
+      fprintf (stderr, "%s: Memory allocation failed.\n", progname);
+
+      return NULL;
+    }
+
+  sprintf (path, "%s/nxbelld-%016llx.pcm", dir, (unsigned long long) hash);
+  return path;
+}
+
+static uint32_t
+data_offset_for (size_t key_len)
+{
+  return (sizeof (shared_sound_header_t) + key_len + SHARE_ALIGNMENT - 1)
+         / SHARE_ALIGNMENT * SHARE_ALIGNMENT;
+}
+
+/* Checks that a mapped file holds a sound for `key' which can be played. */
+static bool
+valid_shared_sound (const uint8_t *map, size_t map_len, const char *key)
+{
+  const shared_sound_header_t *header = (const shared_sound_header_t *) map;
+  size_t                       key_len;
+  uint32_t                     frame;
+
+
+  key_len = strlen (key);
+  if (map_len < sizeof (shared_sound_header_t)
+      || memcmp (header->magic, SHARE_MAGIC, SHARE_MAGIC_LEN) != 0
+      || header->key_len != key_len
+      || header->data_offset != data_offset_for (key_len)
+      || (uint64_t) header->data_offset + header->data_len != map_len
+      || memcmp (map + sizeof (shared_sound_header_t), key, key_len) != 0)
+    return false;
+
+  if (header->channels == 0 || header->channels > 8
+      || header->bytes_per_sample == 0 || header->bytes_per_sample > 4
+      || header->bits_per_sample > header->bytes_per_sample * 8
+      || header->sample_rate == 0)
+    return false;
+
+  frame = header->channels * header->bytes_per_sample;
+  return header->data_len % frame == 0;
+}
+
+playable_pcm_buffer_t *
+map_shared_pcm_buffer (const char *dir, const char *key)
+{
+  playable_pcm_buffer_t       *buffer;
+  const shared_sound_header_t *header;
+  struct stat                  file_stat;
+  char                        *path;
+  void                        *map;
+  int                          fd;
+
+
+  path = shared_sound_path (dir, key);
+  if (path == NULL)
+    return NULL;
+
+  fd = open (path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  free (path);
+  if (fd == -1)
+    return NULL;
+
+  /**
+   * The mapping follows later changes to the file, so only files which
+   * nobody but ourselves or root can change, let alone truncate, are used.
+   */
+  if (fstat (fd, &file_stat) != 0 || ! S_ISREG (file_stat.st_mode)
+      || (file_stat.st_uid != geteuid () && file_stat.st_uid != 0)
+      || (file_stat.st_mode & (S_IWGRP | S_IWOTH)) != 0
+      || file_stat.st_size < (off_t) sizeof (shared_sound_header_t))
+    {
+      close (fd);
+      return NULL;
+    }
+
+  map = mmap (NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  if (! valid_shared_sound (map, file_stat.st_size, key))
+    {
+      fprintf (stderr, "%s: Warning: Ignoring a damaged shared sound in "
+                       "`%s'.\n",
+               progname, dir);
+
+      munmap (map, file_stat.st_size);
+      return NULL;
+    }
+
+  buffer = malloc (sizeof (playable_pcm_buffer_t));
+  if (buffer == NULL)
+    {
+      fprintf (stderr, "%s: Memory allocation failed.\n", progname);
+
+      munmap (map, file_stat.st_size);
+      return NULL;
+    }
+
+  header = map;
+  buffer->map                   = map;
+  buffer->map_len               = file_stat.st_size;
+  buffer->data                  = (uint8_t *) map + header->data_offset;
+  buffer->data_len              = header->data_len;
+  buffer->info.native_endian    = header->native_endian;
+  buffer->info.sign             = header->sign;
+  buffer->info.floating         = header->floating;
+  buffer->info.sample_rate      = header->sample_rate;
+  buffer->info.channels         = header->channels;
+  buffer->info.bytes_per_sample = header->bytes_per_sample;
+  buffer->info.bits_per_sample  = header->bits_per_sample;
+
+  track_pcm_buffer (buffer);
+  return buffer;
+}
+
+static bool
+write_fully (int fd, const void *data, size_t len)
+{
+  ssize_t wrote;
+
+  while (len > 0)
+    {
+      wrote = write (fd, data, len);
+      if (wrote == -1)
+        {
+          if (errno == EINTR)
+            continue;
+
+          return false;
+        }
+
+      data = (const uint8_t *) data + wrote;
+      len -= wrote;
+    }
+
+  return true;
+}
+
+bool
+publish_pcm_buffer (const char *dir, const char *key,
+                    playable_pcm_buffer_t *buffer)
+{
+  static const uint8_t  padding[SHARE_ALIGNMENT];
+  shared_sound_header_t header;
+  char                 *path;
+  char                 *temp_path;
+  size_t                key_len;
+  bool                  written;
+  int                   fd;
+
+
+  path = shared_sound_path (dir, key);
+  if (path == NULL)
+    return false;
+
+  /* Published sounds are never replaced, whatever they hold. */
+  if (access (path, F_OK) == 0)
+    {
+      free (path);
+      return true;
+    }
+
+  temp_path = malloc (strlen (dir) + 32);
+  if (temp_path == NULL)
+    {
+      fprintf (stderr, "%s: Memory allocation failed.\n", progname);
+
+      free (path);
+      return false;
+    }
+  sprintf (temp_path, "%s/.nxbelld-XXXXXX", dir);
+
+  fd = mkstemp (temp_path);
+  if (fd == -1)
+    {
+      fprintf (stderr, "%s: Failed to create a file in `%s': %s.\n",
+               progname, dir, strerror (errno));
+
+      free (temp_path);
+      free (path);
+      return false;
+    }
+
+  key_len = strlen (key);
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, SHARE_MAGIC, SHARE_MAGIC_LEN);
+  header.key_len          = key_len;
+  header.data_offset      = data_offset_for (key_len);
+  header.data_len         = buffer->data_len;
+  header.native_endian    = buffer->info.native_endian;
+  header.sign             = buffer->info.sign;
+  header.floating         = buffer->info.floating;
+  header.sample_rate      = buffer->info.sample_rate;
+  header.channels         = buffer->info.channels;
+  header.bytes_per_sample = buffer->info.bytes_per_sample;
+  header.bits_per_sample  = buffer->info.bits_per_sample;
+
+  written = (fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0
+             && write_fully (fd, &header, sizeof (header))
+             && write_fully (fd, key, key_len)
+             && write_fully (fd, padding, header.data_offset - key_len
+                                          - sizeof (header))
+             && write_fully (fd, buffer->data, buffer->data_len));
+  if (close (fd) != 0)
+    written = false;
+
+  /* Readers only ever see a complete file, and the first one published. */
+  if (written && link (temp_path, path) != 0 && errno != EEXIST)
+    written = false;
+
+  if (! written)
+    fprintf (stderr, "%s: Failed to publish the sound in `%s': %s.\n",
+             progname, dir, strerror (errno));
+
+  unlink (temp_path);
+  free (temp_path);
+  free (path);
+  return written;
+}
+
+bool
+shared_pcm_buffer (playable_pcm_buffer_t *buffer)
+{
+  return (buffer->map != NULL
+          && buffer->map_len >= sizeof (shared_sound_header_t)
+          && memcmp (buffer->map, SHARE_MAGIC, SHARE_MAGIC_LEN) == 0);
+}
+
+#endif /* HAVE_SOUND */
@@ -0,0 +1,61 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_SHARE_H_
+#define _NXBELLD_SHARE_H_ 1
+
+#include "common.h"
+
+#ifdef HAVE_SOUND
+
+#include "pcm.h"
+
+
+/**
+ * Prepared sounds shared between nxbelld instances, such as those of the
+ * users of a terminal server, through files in a directory, best on a tmpfs
+ * like /dev/shm.  The first instance to prepare a sound publishes it under
+ * a hash of `key', a description of everything the sound was made from,
+ * down to the playback device it was converted for.  Later instances map
+ * the file read-only instead of preparing the sound again, so that all of
+ * them share a single copy of it.
+ *
+ * Only files owned by the effective user or by root, and writable by nobody
+ * else, are mapped, so that no other user can change the sound, or truncate
+ * the file under the mapping.  Sharing between users thus takes sounds which
+ * root published.
+ */
+
+/* Maps the sound published for `key', or returns NULL if there's none. */
+playable_pcm_buffer_t *map_shared_pcm_buffer (const char *dir,
+                                              const char *key);
+
+/**
+ * Publishes the buffer for `key', unless a sound was published for it
+ * already; a published file is never replaced.
+ */
+bool publish_pcm_buffer (const char *dir, const char *key,
+                         playable_pcm_buffer_t *buffer);
+
+/* Whether the buffer is mapped from a published sound. */
+bool shared_pcm_buffer (playable_pcm_buffer_t *buffer);
+
+#endif /* HAVE_SOUND */
+#endif /* _NXBELLD_SHARE_H_ */
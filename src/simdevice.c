@@ -0,0 +1,168 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_SIM_DEVICE
+
+#include "simdevice.h"
+#include "metrics.h"
+
+#define NANOSECONDS 1000000000ull
+
+/**
+ * The device's clock: `queued' frames have been taken since `epoch', and
+ * the device plays `rate' of them every second, so it runs dry at
+ * epoch + queued / rate.
+ */
+static uint64_t      epoch;
+static uint64_t      queued;
+static uint64_t      rate;
+static uint64_t      buffer_frames;
+static size_t        frame_size;
+
+/* Set once data was queued, and until it's drained. */
+static bool          running;
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * NANOSECONDS + now.tv_nsec;
+}
+
+/* The moment the frame queued as the `frame'th will be played. */
+static uint64_t
+frame_time (uint64_t frame)
+{
+  return epoch + frame * NANOSECONDS / rate;
+}
+
+static void
+sleep_until (uint64_t deadline)
+{
+  struct timespec until;
+
+  until.tv_sec  = deadline / NANOSECONDS;
+  until.tv_nsec = deadline % NANOSECONDS;
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+         == EINTR)
+    ;
+}
+
+void
+probe_sim_device (pcm_data_info_t *info)
+{
+  info->native_endian = true;
+  info->sign          = true;
+  if (info->floating || info->bits_per_sample > 16)
+    {
+      info->bytes_per_sample = 4;
+      info->bits_per_sample  = 32;
+    }
+  else
+    {
+      info->bytes_per_sample = 2;
+      info->bits_per_sample  = 16;
+    }
+  info->floating = false;
+}
+
+void
+open_sim_device (pcm_data_info_t *info)
+{
+  unsigned int latency;
+
+  latency = (pcm_device_latency > 0) ? pcm_device_latency
+                                     : SIM_DEVICE_LATENCY;
+
+  rate          = info->sample_rate;
+  frame_size    = info->channels * info->bytes_per_sample;
+  buffer_frames = (uint64_t) rate * latency / 1000000;
+  if (buffer_frames < 4)
+    buffer_frames = 4;
+
+  epoch   = now_ns ();
+  queued  = 0;
+  running = false;
+}
+
+size_t
+queue_sim_device (size_t len, struct timespec *starts)
+{
+  uint64_t now;
+  uint64_t frames;
+  uint64_t played;
+  uint64_t start;
+
+
+  frames = len / frame_size;
+  if (frames > buffer_frames / 4)
+    frames = buffer_frames / 4;
+
+  now = now_ns ();
+  if (frame_time (queued) <= now)
+    {
+      /* The device ran dry, it starts over with the new data. */
+      if (running)
+        count_metric (METRIC_XRUNS);
+
+      epoch  = now;
+      queued = 0;
+    }
+  else if (queued + frames > buffer_frames)
+    {
+      /* Wait for enough of the buffer to be played. */
+      played = queued + frames - buffer_frames;
+      sleep_until (frame_time (played));
+    }
+
+  start = frame_time (queued);
+  starts->tv_sec  = start / NANOSECONDS;
+  starts->tv_nsec = start % NANOSECONDS;
+
+  /* A partial frame left at the end takes no time to play. */
+  if (frames == 0)
+    return len;
+
+  queued += frames;
+  running = true;
+
+  /* Keep the clock small, a second's worth of frames at a time. */
+  if (queued >= rate)
+    {
+      epoch  += (queued / rate) * NANOSECONDS;
+      queued %= rate;
+    }
+  return frames * frame_size;
+}
+
+void
+drain_sim_device (void)
+{
+  if (running)
+    sleep_until (frame_time (queued));
+
+  running = false;
+}
+
+#endif /* HAVE_SIM_DEVICE */
@@ -0,0 +1,61 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_SIMDEVICE_H_
+#define _NXBELLD_SIMDEVICE_H_ 1
+
+#include "common.h"
+
+#ifdef HAVE_SIM_DEVICE
+
+#include "pcm.h"
+#include <time.h>
+
+/* The buffer of the device, in microseconds, unless pcm_device_latency is set. */
+#define SIM_DEVICE_LATENCY 50000
+
+
+/**
+ * A playback device which exists only as a clock, for the null and capture
+ * backends.  It accepts PCM data at the pace a sound card would play it,
+ * measured against CLOCK_MONOTONIC, buffering `pcm_device_latency'
+ * microseconds of it, so that nxbelld's timing works as it does with real
+ * hardware.  Running out of data before being drained counts an underrun.
+ * There's a single simulated device, used by whichever of the two backends
+ * is selected.
+ *
+ * probe_sim_device () picks the native 16-bit or 32-bit integer format a
+ * typical sound card would, keeping the sampling rate.
+ */
+void   probe_sim_device (pcm_data_info_t *info);
+void   open_sim_device  (pcm_data_info_t *info);
+
+/**
+ * Waits until the device has room for some of the `len' bytes, takes at
+ * most a quarter of its buffer of them, and returns how many bytes it took.
+ * `starts' is set to the moment the first of them is to be played.
+ */
+size_t queue_sim_device (size_t len, struct timespec *starts);
+
+/* Waits until all of the queued data has been played. */
+void   drain_sim_device (void);
+
+#endif /* HAVE_SIM_DEVICE */
+#endif /* _NXBELLD_SIMDEVICE_H_ */
@@ -23,22 +23,29 @@
 #ifdef HAVE_SOUNDIO
 
 #include "pcm.h"
+#include "metrics.h"
 #include <sndio.h>
 
-bool
-play_pcm_buffer (playable_pcm_buffer_t *buffer)
+/* The playback device, and the format it's configured for. */
+static struct sio_hdl   *handle = NULL;
+static pcm_data_info_t   handle_info;
+static size_t            playback_chunk;
+static bool              started;
+
+static void close_soundio_device (void);
+
+static bool
+probe_soundio_device (pcm_data_info_t *info)
 {
-  int               status;
-  struct sio_hdl   *handle;
+  struct sio_hdl   *probe;
   struct sio_par    parameters;
-  size_t            playback_chunk;
-  size_t            to_write;
-  size_t            already_wrote;
-  size_t            wrote_bytes;
+  int               status;
 
 
-  handle = sio_open (SIO_DEVANY, SIO_PLAY, 0);
-  if (handle == NULL)
+  /* A second handle is fine, sndiod arbitrates between its clients. */
+  probe = sio_open ((pcm_device_name != NULL) ? pcm_device_name : SIO_DEVANY,
+                    SIO_PLAY, 0);
+  if (probe == NULL)
     {
       fprintf (stderr, "%s: Failed to open the playback device.\n", progname);
 
@@ -47,164 +54,126 @@ play_pcm_buffer (playable_pcm_buffer_t *buffer)
 
   sio_initpar (&parameters);
 
-  parameters.bits   = buffer->info.bits_per_sample;
-  parameters.bps    = buffer->info.bytes_per_sample;
-  parameters.sig    = buffer->info.sign ? 1 : 0;
-  parameters.le     = buffer->info.native_endian ? SIO_LE_NATIVE : 1;
-  parameters.pchan  = buffer->info.channels;
-  parameters.rate   = buffer->info.sample_rate;
-  parameters.xrun   = SIO_IGNORE;
-
-  status = sio_setpar (handle, &parameters);
-  if (!status)
-    {
-      fprintf (stderr, "%s: Failed to configure the playback device.\n",
-               progname);
-
-      sio_close (handle);
-      return false;
-    }
-
-  status = sio_getpar (handle, &parameters);
-  if (!status)
-    {
-      fprintf (stderr, "%s: Failed to check the playback device configuration.\n",
-               progname);
+  parameters.bits  = (info->floating || info->bits_per_sample > 16) ? 32 : 16;
+  parameters.sig   = 1;
+  parameters.le    = SIO_LE_NATIVE;
+  parameters.pchan = info->channels;
+  parameters.rate  = info->sample_rate;
 
-      sio_close (handle);
-      return false;
-    }
+  status = sio_setpar (probe, &parameters) && sio_getpar (probe, &parameters);
+  sio_close (probe);
 
-  if (parameters.bits     != buffer->info.bits_per_sample
-      || parameters.bps   != buffer->info.bytes_per_sample
-      || parameters.pchan != buffer->info.channels
-      || parameters.rate  != buffer->info.sample_rate)
+  if (!status || !parameters.sig || parameters.le != SIO_LE_NATIVE
+      || (parameters.bps != 2 && parameters.bps != 4))
     {
-      fprintf (stderr, "%s: Configuring the playback device for the given data failed.\n",
+      fprintf (stderr, "%s: The playback device supports none of the "
+                       "known sample formats.\n",
                progname);
 
-      sio_close (handle);
       return false;
     }
 
-  if (parameters.appbufsz == 0)     /* Just in case, you never know... */
-    parameters.appbufsz = 8192;
+  /* MSB-aligned samples are treated as full-width ones. */
+  if (parameters.msb && parameters.bits < parameters.bps * 8)
+    parameters.bits = parameters.bps * 8;
 
-  playback_chunk = parameters.appbufsz * parameters.bps * parameters.pchan;
-  already_wrote  = 0;
-
-  status = sio_start (handle);
-  if (!status)
-    {
-      fprintf (stderr, "%s: Failed to start playback.\n", progname);
-
-      sio_close (handle);
-      return false;
-    }
-
-  while (already_wrote < buffer->data_len)
-    {
-      if (buffer->data_len - already_wrote < playback_chunk)
-        to_write = buffer->data_len - already_wrote;
-      else
-        to_write = playback_chunk;
-
-      wrote_bytes = sio_write (handle, buffer->data + already_wrote, to_write);
-
-      already_wrote += wrote_bytes;
-      if (wrote_bytes != to_write)
-        fprintf (stderr, "%s: Warning: Wrote only %lu bytes instead of the "
-                         "expected %lu to the playback device.\n",
-                 progname, wrote_bytes, to_write);
-    }
-
-  sio_stop (handle);
-  sio_close (handle);
+  info->native_endian    = true;
+  info->sign             = true;
+  info->floating         = false;
+  info->bits_per_sample  = parameters.bits;
+  info->bytes_per_sample = parameters.bps;
+  info->sample_rate      = parameters.rate;
 
   return true;
 }
 
-bool
-play_pcm_file (playable_pcm_file_t *file)
+static bool
+open_soundio_device (pcm_data_info_t *info)
 {
   int               status;
-  struct sio_hdl   *handle;
   struct sio_par    parameters;
-  uint8_t          *playback_buf;
-  size_t            playback_buflen;
-  size_t            read_bytes;
-  size_t            wrote_bytes;
 
-  if (fsetpos (file->stream, &(file->pcm_start_pos)) != 0)
+
+  if (info->floating)
     {
-      fprintf (stderr, "%s: Failed to seek to the PCM data of `%s': %s.\n",
-               progname, file->name, strerror (errno));
+      fprintf (stderr, "%s: The sndio sound API can't play floating point samples.\n",
+               progname);
 
       return false;
     }
 
-  handle = sio_open (SIO_DEVANY, SIO_PLAY, 0);
-  if (handle == NULL)
+  if (handle != NULL)
     {
-      fprintf (stderr, "%s: Failed to open the playback device.\n", progname);
-
-      return false;
+      if (! same_pcm_format (&handle_info, info))
+        close_soundio_device ();
+      else if (started)
+        return true;
     }
 
-  sio_initpar (&parameters);
-
-  parameters.bits   = file->info.bits_per_sample;
-  parameters.bps    = file->info.bytes_per_sample;
-  parameters.sig    = file->info.sign ? 1 : 0;
-  parameters.le     = file->info.native_endian ? SIO_LE_NATIVE : 1;
-  parameters.pchan  = file->info.channels;
-  parameters.rate   = file->info.sample_rate;
-  parameters.xrun   = SIO_IGNORE;
-
-  status = sio_setpar (handle, &parameters);
-  if (!status)
+  if (handle == NULL)
     {
-      fprintf (stderr, "%s: Failed to configure the playback device.\n",
-               progname);
+      handle = sio_open ((pcm_device_name != NULL) ? pcm_device_name
+                                                   : SIO_DEVANY,
+                         SIO_PLAY, 0);
+      if (handle == NULL)
+        {
+          fprintf (stderr, "%s: Failed to open the playback device.\n", progname);
 
-      sio_close (handle);
-      return false;
-    }
+          return false;
+        }
+      count_metric (METRIC_DEVICE_OPENS);
+
+      sio_initpar (&parameters);
+
+      parameters.bits   = info->bits_per_sample;
+      parameters.bps    = info->bytes_per_sample;
+      parameters.sig    = info->sign ? 1 : 0;
+      parameters.le     = info->native_endian ? SIO_LE_NATIVE : 1;
+      parameters.pchan  = info->channels;
+      parameters.rate   = info->sample_rate;
+      parameters.xrun   = SIO_IGNORE;
+      if (pcm_device_latency > 0)
+        parameters.appbufsz = ((uint64_t) info->sample_rate
+                               * pcm_device_latency) / 1000000;
+
+      status = sio_setpar (handle, &parameters);
+      if (!status)
+        {
+          fprintf (stderr, "%s: Failed to configure the playback device.\n",
+                   progname);
 
-  status = sio_getpar (handle, &parameters);
-  if (!status)
-    {
-      fprintf (stderr, "%s: Failed to check the playback device configuration.\n",
-               progname);
+          close_soundio_device ();
+          return false;
+        }
 
-      sio_close (handle);
-      return false;
-    }
+      status = sio_getpar (handle, &parameters);
+      if (!status)
+        {
+          fprintf (stderr, "%s: Failed to check the playback device configuration.\n",
+                   progname);
 
-  if (parameters.bits     != file->info.bits_per_sample
-      || parameters.bps   != file->info.bytes_per_sample
-      || parameters.pchan != file->info.channels
-      || parameters.rate  != file->info.sample_rate)
-    {
-      fprintf (stderr, "%s: Configuring the playback device for `%s' failed.\n",
-               progname, file->name);
+          close_soundio_device ();
+          return false;
+        }
 
-      sio_close (handle);
-      return false;
-    }
+      if (parameters.bits     != info->bits_per_sample
+          || parameters.bps   != info->bytes_per_sample
+          || parameters.pchan != info->channels
+          || parameters.rate  != info->sample_rate)
+        {
+          fprintf (stderr, "%s: Configuring the playback device for the given data failed.\n",
+                   progname);
 
-  if (parameters.appbufsz == 0)     /* Just in case, you never know... */
-    parameters.appbufsz = 8192;
+          close_soundio_device ();
+          return false;
+        }
 
-  playback_buflen = parameters.appbufsz * parameters.bps * parameters.pchan;
-  playback_buf = malloc (playback_buflen);
-  if (playback_buf == NULL)
-    {
-      fprintf (stderr, "%s: Failed to create a data buffer: %s\n",
-               progname, strerror (errno));
+      if (parameters.appbufsz == 0)     /* Just in case, you never know... */
+        parameters.appbufsz = 8192;
 
-      sio_close (handle);
-      return false;
+      playback_chunk = parameters.appbufsz * parameters.bps * parameters.pchan;
+      handle_info    = *info;
+      started        = false;
     }
 
   status = sio_start (handle);
@@ -212,43 +181,82 @@ play_pcm_file (playable_pcm_file_t *file)
     {
       fprintf (stderr, "%s: Failed to start playback.\n", progname);
 
-      sio_close (handle);
-      free (playback_buf);
+      close_soundio_device ();
       return false;
     }
+  started = true;
+
+  return true;
+}
+
+static bool
+write_soundio_device (uint8_t *data, size_t len)
+{
+  size_t            to_write;
+  size_t            already_wrote;
+  size_t            wrote_bytes;
 
-  while (true)
-    {
-      read_bytes = fread (playback_buf, 1, playback_buflen, file->stream);
-      if (read_bytes == 0)
-        {
-          if (ferror (file->stream))
-            {
-              fprintf (stderr, "%s: An error occured while reading from `%s': %s.\n",
-                       progname, file->name, strerror (errno));
 
-              sio_stop (handle);
-              sio_close (handle);
-              free (playback_buf);
+  already_wrote = 0;
+  while (already_wrote < len)
+    {
+      if (len - already_wrote < playback_chunk)
+        to_write = len - already_wrote;
+      else
+        to_write = playback_chunk;
 
-              return false;
-            }
+      wrote_bytes = sio_write (handle, data + already_wrote, to_write);
+      if (wrote_bytes == 0 && sio_eof (handle))
+        {
+          fprintf (stderr, "%s: An error occured while writing to the playback device.\n",
+                   progname);
 
-          break;
+          return false;
         }
 
-      wrote_bytes = sio_write (handle, playback_buf, read_bytes);
-      if (wrote_bytes != read_bytes)
-        fprintf (stderr, "%s: Warning: Read %lu bytes, but wrote only %lu.\n",
-                 progname, read_bytes, wrote_bytes);
+      already_wrote += wrote_bytes;
+      if (wrote_bytes > 0)
+        note_first_sample ();
+      if (wrote_bytes != to_write)
+        fprintf (stderr, "%s: Warning: Wrote only %lu bytes instead of the "
+                         "expected %lu to the playback device.\n",
+                 progname, wrote_bytes, to_write);
     }
 
-  sio_stop (handle);
-  sio_close (handle);
+  return true;
+}
 
-  free (playback_buf);
+static void
+drain_soundio_device (void)
+{
+  /* sio_stop () waits for the buffered data to be played. */
+  if (handle != NULL && started)
+    {
+      sio_stop (handle);
+      started = false;
+    }
+}
 
-  return true;
+static void
+close_soundio_device (void)
+{
+  if (handle == NULL)
+    return;
+
+  sio_close (handle);
+  handle  = NULL;
+  started = false;
 }
 
+const pcm_backend_t soundio_backend =
+{
+  .name      = "sndio",
+  .automatic = true,
+  .probe     = probe_soundio_device,
+  .open      = open_soundio_device,
+  .write     = write_soundio_device,
+  .drain     = drain_soundio_device,
+  .close     = close_soundio_device
+};
+
 #endif /* HAVE_SOUNDIO */
@@ -0,0 +1,203 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Compares the wavetable synthesizer with the libm based generators it
+ * replaced, in generation speed and pitch accuracy.  Build it with
+ * `make synth-bench', run it as `./synth-bench [duration-ms [rate]]'.
+ */
+
+#include "common.h"
+#include "synth.h"
+#include <math.h>
+#include <time.h>
+
+const char *progname = "synth-bench";
+
+#define ROUNDS 5
+
+
+/* The generators of nxbelld 0.1.1, minus the buffer allocation. */
+static void
+legacy_sine (int16_t *samples, uint32_t samples_count, unsigned int rate,
+             unsigned int frequency, unsigned int volume)
+{
+  unsigned int period_counter;
+  unsigned int period_length;
+  uint32_t     iter;
+
+  period_length  = rate / frequency;
+  period_counter = period_length;
+  for (iter = 0; iter < samples_count; iter++)
+    {
+      if (period_counter == period_length)
+        period_counter = 0;
+      else
+        period_counter++;
+
+      samples[iter] = INT16_MAX
+                      * sin (2 * M_PI * period_counter / period_length)
+                      * (volume / 100.0);
+    }
+}
+
+static double
+legacy_complex_wave (double param)
+{
+  return (sin (param)
+          + (sin (3 * param) * 0.192450089729875254836382926833)
+          + (sin (5 * param) * 0.089442719099991587856366946749)
+          + (sin (7 * param) * 0.053994924715603889602073790890)
+          + (sin (9 * param) * 0.037037037037037037037037037037));
+}
+
+static void
+legacy_complex (int16_t *samples, uint32_t samples_count, unsigned int rate,
+                unsigned int frequency, unsigned int volume)
+{
+  unsigned int period_counter;
+  unsigned int period_length;
+  uint32_t     iter;
+
+  period_length  = rate / frequency;
+  period_counter = period_length;
+  for (iter = 0; iter < samples_count; iter++)
+    {
+      if (period_counter == period_length)
+        period_counter = 0;
+      else
+        period_counter++;
+
+      samples[iter] = INT16_MAX
+                      * legacy_complex_wave (2 * M_PI * period_counter
+                                             / period_length)
+                      * (volume / 100.0);
+    }
+}
+
+static double
+elapsed_ns (struct timespec *start, struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9
+         + (end->tv_nsec - start->tv_nsec);
+}
+
+static double
+time_legacy (void (*generate) (int16_t *, uint32_t, unsigned int,
+                               unsigned int, unsigned int),
+             int16_t *samples, uint32_t samples_count, unsigned int rate,
+             unsigned int frequency)
+{
+  struct timespec start, end;
+  double          best = HUGE_VAL;
+  unsigned int    round;
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      generate (samples, samples_count, rate, frequency, 50);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+
+      if (elapsed_ns (&start, &end) < best)
+        best = elapsed_ns (&start, &end);
+    }
+
+  return best / samples_count;
+}
+
+static double
+time_synth (unsigned int waveform, int16_t *samples, uint32_t samples_count,
+            unsigned int rate, unsigned int frequency)
+{
+  struct timespec start, end;
+  synth_osc_t     osc;
+  double          best = HUGE_VAL;
+  unsigned int    round;
+
+  /* Fault the wavetable in outside of the timed region. */
+  if (! synth_init_osc (&osc, waveform, frequency, rate, 50))
+    exit (1);
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      synth_init_osc (&osc, waveform, frequency, rate, 50);
+      synth_render (&osc, samples, samples_count);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+
+      if (elapsed_ns (&start, &end) < best)
+        best = elapsed_ns (&start, &end);
+    }
+
+  return best / samples_count;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const unsigned int frequencies[] = { 440, 1000, 4000, 7500 };
+
+  unsigned int  duration = (argc > 1) ? strtoul (argv[1], NULL, 10) : 1000;
+  unsigned int  rate     = (argc > 2) ? strtoul (argv[2], NULL, 10) : 44100;
+  uint32_t      samples_count;
+  int16_t      *samples;
+  synth_osc_t   osc;
+  unsigned int  frequency;
+  unsigned int  iter;
+
+
+  samples_count = ((uint64_t) rate * duration) / 1000;
+  samples = malloc (samples_count * sizeof (int16_t));
+  if (samples_count == 0 || samples == NULL)
+    {
+      fprintf (stderr, "%s: Nothing to generate.\n", progname);
+      return 1;
+    }
+
+  printf ("%u ms at %u Hz, best of %d rounds, ns/sample:\n\n",
+          duration, rate, ROUNDS);
+  printf ("  freq   sine: legacy  synth   complex: legacy  synth"
+          "   pitch: legacy     synth\n");
+
+  for (iter = 0; iter < sizeof (frequencies) / sizeof (frequencies[0]); iter++)
+    {
+      frequency = frequencies[iter];
+      if (frequency >= rate / 2)
+        continue;
+
+      synth_init_osc (&osc, SYNTH_WAVE_SINE, frequency, rate, 50);
+      printf ("%6u  %12.2f %6.2f  %15.2f %6.2f  %14.3f %9.5f\n",
+              frequency,
+              time_legacy (legacy_sine, samples, samples_count, rate,
+                           frequency),
+              time_synth (SYNTH_WAVE_SINE, samples, samples_count, rate,
+                          frequency),
+              time_legacy (legacy_complex, samples, samples_count, rate,
+                           frequency),
+              time_synth (SYNTH_WAVE_COMPLEX, samples, samples_count, rate,
+                          frequency),
+              /* The legacy period is period_length + 1 samples long. */
+              (double) rate / (rate / frequency + 1),
+              ldexp (osc.step, -32) * rate);
+    }
+
+  free (samples);
+  return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "synth.h"
+#include <math.h>
+
+
+/* Bits of the phase below the table index. */
+#define SYNTH_FRAC_BITS   (32 - SYNTH_TABLE_BITS)
+
+
+bool
+synth_init_osc (synth_osc_t *osc, unsigned int waveform,
+                unsigned int frequency, unsigned int sample_rate,
+                unsigned int volume)
+{
+  unsigned int harmonics;
+  unsigned int level;
+
+
+  if (waveform >= SYNTH_WAVES)
+    {
+      fprintf (stderr, "%s: synth_init_osc (): bad waveform, this is a bug.\n",
+               progname);
+      exit (1);
+    }
+
+  if (frequency == 0 || frequency >= sample_rate / 2)
+    {
+      fprintf (stderr, "%s: Cannot generate a %u Hz tone at a sampling rate "
+                       "of %u Hz.\n",
+               progname, frequency, sample_rate);
+
+      return false;
+    }
+
+  /* Pick the richest table whose harmonics all stay below Nyquist. */
+  harmonics = (sample_rate / 2 - 1) / frequency;
+  for (level = 0; level + 1 < SYNTH_LEVELS; level++)
+    if ((2U << level) > harmonics)
+      break;
+
+  osc->table = synth_tables[waveform][level];
+
+  if (volume > 100)
+    volume = 100;
+
+  osc->phase = 0;
+  osc->step  = llrint (ldexp (frequency, 32) / sample_rate);
+  osc->gain  = (volume * INT16_MAX) / 100;
+
+  return true;
+}
+
+/**
+ * The phase of every sample is computed from the starting one rather than
+ * carried from sample to sample, so the iterations are independent of each
+ * other and the loop can be vectorized.
+ */
+void
+synth_render (synth_osc_t *osc, int16_t *restrict out, uint32_t count)
+{
+  const int16_t *restrict table = osc->table;
+  uint32_t                phase = osc->phase;
+  uint32_t                step  = osc->step;
+  int32_t                 gain  = osc->gain;
+  uint32_t                iter;
+
+
+  for (iter = 0; iter < count; iter++)
+    {
+      uint32_t position = phase + iter * step;
+      uint32_t index    = position >> SYNTH_FRAC_BITS;
+      int32_t  frac     = (position >> (SYNTH_FRAC_BITS - 15)) & 0x7fff;
+      int32_t  a        = table[index];
+      int32_t  b        = table[index + 1];
+
+      /* |b - a| < 2^16, so the product fits into 31 bits. */
+      out[iter] = ((a + (((b - a) * frac) >> 15)) * gain) >> 15;
+    }
+
+  osc->phase = phase + count * step;
+}
@@ -0,0 +1,56 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_SYNTH_H_
+#define _NXBELLD_SYNTH_H_ 1
+
+#include "common.h"
+#include "wavetable.h"
+
+
+/**
+ * A direct digital synthesis oscillator: a 32-bit fixed-point phase
+ * accumulator which indexes a band-limited wavetable.  The upper bits of the
+ * phase select the table entry, the bits below them interpolate between it
+ * and the next one, so the pitch is exact to a fraction of a millihertz.
+ */
+typedef struct synth_osc synth_osc_t;
+
+struct synth_osc
+{
+  const int16_t *table;     /* SYNTH_TABLE_LEN + 1 entries. */
+  uint32_t       phase;
+  uint32_t       step;      /* Phase increment per sample. */
+  int32_t        gain;      /* Q15. */
+};
+
+/**
+ * Prepares an oscillator producing the given waveform, with no harmonics at
+ * or above the Nyquist frequency of `sample_rate'.  `volume' is 0 -- 100.
+ */
+bool synth_init_osc (synth_osc_t *osc, unsigned int waveform,
+                     unsigned int frequency, unsigned int sample_rate,
+                     unsigned int volume);
+
+/* Renders `count' signed 16-bit samples, advancing the oscillator. */
+void synth_render (synth_osc_t *osc, int16_t *restrict out, uint32_t count);
+
+
+#endif /* _NXBELLD_SYNTH_H_ */
@@ -0,0 +1,71 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "throttle.h"
+
+
+void
+init_bell_throttle (bell_throttle_t *throttle, unsigned int interval,
+                    unsigned int burst)
+{
+  if (burst == 0)
+    burst = 1;
+
+  throttle->interval   = (uint64_t) interval * 1000000;
+  throttle->capacity   = throttle->interval * burst;
+  throttle->credit     = throttle->capacity;
+  throttle->last_time  = 0;
+  throttle->admitted   = 0;
+  throttle->suppressed = 0;
+}
+
+bool
+admit_bell (bell_throttle_t *throttle, const struct timespec *time)
+{
+  uint64_t now;
+
+  if (throttle->interval == 0)
+    {
+      throttle->admitted++;
+      return true;
+    }
+
+  now = (uint64_t) time->tv_sec * 1000000000 + time->tv_nsec;
+
+  /* Earn the tokens for the time since the last bell, up to a full bucket. */
+  if (throttle->last_time != 0 && now > throttle->last_time)
+    {
+      throttle->credit += now - throttle->last_time;
+      if (throttle->credit > throttle->capacity)
+        throttle->credit = throttle->capacity;
+    }
+  throttle->last_time = now;
+
+  if (throttle->credit < throttle->interval)
+    {
+      throttle->suppressed++;
+      return false;
+    }
+
+  throttle->credit -= throttle->interval;
+  throttle->admitted++;
+  return true;
+}
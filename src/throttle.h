@@ -0,0 +1,55 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_THROTTLE_H_
+#define _NXBELLD_THROTTLE_H_ 1
+
+#include "common.h"
+#include <time.h>
+
+
+/**
+ * A token bucket limiting the rate of bells.  The bucket holds up to `burst'
+ * tokens, a new one is earned every `interval' milliseconds, and every
+ * admitted bell takes one.  Time is kept in nanoseconds of credit, taken
+ * from the CLOCK_MONOTONIC timestamps of the bells, so that changes of the
+ * wall clock don't affect it.
+ */
+typedef struct bell_throttle bell_throttle_t;
+
+struct bell_throttle
+{
+  uint64_t       interval;   /* Nanoseconds per token, 0 disables it. */
+  uint64_t       capacity;   /* `burst' tokens worth of nanoseconds. */
+  uint64_t       credit;
+  uint64_t       last_time;
+
+  unsigned long  admitted;
+  unsigned long  suppressed;
+};
+
+void init_bell_throttle (bell_throttle_t *throttle, unsigned int interval,
+                         unsigned int burst);
+
+/* Decides whether a bell received at `time' is to be played. */
+bool admit_bell (bell_throttle_t *throttle, const struct timespec *time);
+
+
+#endif /* _NXBELLD_THROTTLE_H_ */
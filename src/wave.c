@@ -28,9 +28,12 @@
 #include "pcm.h"
 #include "wave.h"
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 static bool
-find_wave_pcm_data (FILE *stream, uint32_t *data_len, fpos_t *pcm_start_pos)
+find_wave_pcm_data (FILE *stream, uint32_t *data_len, off_t *pcm_start_pos)
 {
   wave_chunk_hdr_t header;
   while (true)
@@ -53,7 +56,8 @@ find_wave_pcm_data (FILE *stream, uint32_t *data_len, fpos_t *pcm_start_pos)
 
   if (pcm_start_pos != NULL)
     {
-      if (fgetpos (stream, pcm_start_pos) != 0)
+      *pcm_start_pos = ftello (stream);
+      if (*pcm_start_pos == -1)
         {
           fprintf (stderr, "%s: Failed to store the location of the PCM data: %s.\n",
                    progname, strerror (errno));
@@ -68,11 +72,70 @@ find_wave_pcm_data (FILE *stream, uint32_t *data_len, fpos_t *pcm_start_pos)
   return true;
 }
 
+/**
+ * Validates a format chunk, as read from a file, and fills in the PCM data
+ * information accordingly.  `ext' is the format extension, or NULL if the
+ * chunk is too short to contain one.
+ */
+static bool
+check_wave_format (wave_fmt_chunk_t *format, wave_fmt_ext_t *ext,
+                   pcm_data_info_t *info)
+{
+  uint16_t data_format;
+
+  /* Swap some endian, if needed. Only swap fields we make use of. */
+  format->data_format      = LE_SHORT (format->data_format);
+  format->channels         = LE_SHORT (format->channels);
+  format->sample_rate      = LE_INT   (format->sample_rate);
+  format->bits_per_sample  = LE_SHORT (format->bits_per_sample);
+
+  data_format = format->data_format;
+  if (data_format == WAVE_FORMAT_EXTENSIBLE && ext != NULL
+      && LE_SHORT (ext->ext_len) >= 22)
+    data_format = LE_SHORT (ext->sub_format);
+
+  if (format->hdr.chunk_id != COMPOSE_ID ('f', 'm', 't', ' ')
+      || LE_INT (format->hdr.chunk_len) < 0x10
+      || (data_format != WAVE_FORMAT_PCM
+          && data_format != WAVE_FORMAT_IEEE_FLOAT)
+      || (data_format == WAVE_FORMAT_IEEE_FLOAT
+          && format->bits_per_sample != 32))
+    {
+      fprintf (stderr,
+               "%s: Unsupported WAVE format; Try encoding the file with:\n"
+               "    ffmpeg -i <file> -vn -acodec pcm_s16le out.wav\n",
+               progname);
+
+      return false;
+    }
+
+  if (format->channels <= 0)
+    {
+      fprintf (stderr, "%s: Cannot play a file with %d channels.\n",
+               progname, format->channels);
+
+      return false;
+    }
+
+  info->native_endian     = false;
+  info->floating          = (data_format == WAVE_FORMAT_IEEE_FLOAT);
+  info->sign              = (format->bits_per_sample > 8);
+  info->sample_rate       = format->sample_rate;
+  info->channels          = format->channels;
+  info->bits_per_sample   = format->bits_per_sample;
+  info->bytes_per_sample  = ceil (format->bits_per_sample / 8.0);
+
+  return true;
+}
+
 static bool
 parse_wave_header (FILE *stream, pcm_data_info_t *info)
 {
   wave_file_hdr_t  header;
   wave_fmt_chunk_t format;
+  wave_fmt_ext_t   ext;
+  uint32_t         extra_len;
+  bool             have_ext;
 
   if (fread (&header, sizeof (wave_file_hdr_t), 1, stream) != 1)
     {
@@ -98,49 +161,175 @@ parse_wave_header (FILE *stream, pcm_data_info_t *info)
       return false;
     }
 
-  /* Swap some endian, if needed. Only swap fields we make use of. */
-  format.hdr.chunk_len    = LE_INT   (format.hdr.chunk_len);
-  format.data_format      = LE_SHORT (format.data_format);
-  format.channels         = LE_SHORT (format.channels);
-  format.sample_rate      = LE_INT   (format.sample_rate);
-  format.bits_per_sample  = LE_SHORT (format.bits_per_sample);
-
-  if (format.hdr.chunk_id != COMPOSE_ID ('f', 'm', 't', ' ')
-      || format.hdr.chunk_len != 0x10 || format.data_format != 0x01)
+  /* Read the extension, if any, and skip whatever else is in the chunk. */
+  extra_len = LE_INT (format.hdr.chunk_len);
+  extra_len = (extra_len > 0x10) ? extra_len - 0x10 + (extra_len & 1) : 0;
+  have_ext  = (extra_len >= sizeof (wave_fmt_ext_t));
+  if (have_ext)
     {
-      fprintf (stderr,
-               "%s: Unsupported WAVE format; Try encoding the file with:\n"
-               "    ffmpeg -i <file> -vn -acodec pcm_s16le out.wav\n",
-               progname);
+      if (fread (&ext, sizeof (wave_fmt_ext_t), 1, stream) != 1)
+        {
+          fprintf (stderr, "%s: Failed to read the format chunk from the file header: %s.\n",
+                   progname, strerror (errno));
+
+          return false;
+        }
+      extra_len -= sizeof (wave_fmt_ext_t);
+    }
+  if (extra_len > 0)
+    fseek (stream, extra_len, SEEK_CUR);
+
+  return check_wave_format (&format, have_ext ? &ext : NULL, info);
+}
+
+
+/**
+ * Walks the chunks of a mapped WAVE file, checking each of them against the
+ * length of the mapping, and locates the format and PCM data chunks.
+ */
+static bool
+parse_wave_map (const uint8_t *map, size_t map_len, pcm_data_info_t *info,
+                size_t *data_offset, uint32_t *data_len)
+{
+  wave_file_hdr_t  header;
+  wave_chunk_hdr_t chunk;
+  wave_fmt_chunk_t format;
+  wave_fmt_ext_t   ext;
+  uint64_t         offset;
+  uint64_t         chunk_len;
+  bool             have_format;
+  bool             have_ext;
+
+  memcpy (&header, map, sizeof (wave_file_hdr_t));
+  if (header.magic != COMPOSE_ID ('R', 'I', 'F', 'F')
+      || header.type != COMPOSE_ID ('W', 'A', 'V', 'E'))
+    {
+      fprintf (stderr, "%s: Not a RIFF WAVE file.\n", progname);
 
       return false;
     }
 
-  if (format.channels <= 0)
+  have_format = false;
+  offset = sizeof (wave_file_hdr_t);
+  while (true)
     {
-      fprintf (stderr, "%s: Cannot play a file with %d channels.\n",
-               progname, format.channels);
+      if (offset + sizeof (wave_chunk_hdr_t) > map_len)
+        {
+          fprintf (stderr, "%s: Failed to read a chunk of the file header: "
+                           "Unexpected end of file.\n",
+                   progname);
+
+          return false;
+        }
+
+      memcpy (&chunk, map + offset, sizeof (wave_chunk_hdr_t));
+      chunk_len = LE_INT (chunk.chunk_len);
+
+      if (chunk.chunk_id == COMPOSE_ID ('f', 'm', 't', ' '))
+        {
+          if (offset + sizeof (wave_fmt_chunk_t) > map_len)
+            {
+              fprintf (stderr, "%s: Failed to read the format chunk from the "
+                               "file header: Unexpected end of file.\n",
+                       progname);
+
+              return false;
+            }
+
+          memcpy (&format, map + offset, sizeof (wave_fmt_chunk_t));
+          have_ext = (chunk_len >= 0x10 + sizeof (wave_fmt_ext_t)
+                      && offset + sizeof (wave_fmt_chunk_t)
+                         + sizeof (wave_fmt_ext_t) <= map_len);
+          if (have_ext)
+            memcpy (&ext, map + offset + sizeof (wave_fmt_chunk_t),
+                    sizeof (wave_fmt_ext_t));
+
+          if (! check_wave_format (&format, have_ext ? &ext : NULL, info))
+            return false;
+
+          have_format = true;
+        }
+      else if (chunk.chunk_id == COMPOSE_ID ('d', 'a', 't', 'a'))
+        break;
+
+      /* Chunks are padded to an even length. */
+      offset += sizeof (wave_chunk_hdr_t) + chunk_len + (chunk_len & 1);
+    }
+
+  if (! have_format)
+    {
+      fprintf (stderr, "%s: The file header lacks a format chunk.\n",
+               progname);
 
       return false;
     }
 
-  info->native_endian     = false;
-  info->sign              = (format.bits_per_sample > 8);
-  info->sample_rate       = format.sample_rate;
-  info->channels          = format.channels;
-  info->bits_per_sample   = format.bits_per_sample;
-  info->bytes_per_sample  = ceil (format.bits_per_sample / 8.0);
+  *data_offset = offset + sizeof (wave_chunk_hdr_t);
+  *data_len    = chunk_len;
+  if (*data_offset + chunk_len > map_len)
+    {
+      fprintf (stderr, "%s: Warning: The PCM data is truncated.\n", progname);
+
+      *data_len = map_len - *data_offset;
+    }
 
   return true;
 }
 
-
+/* Reads the whole file, failing should it turn out shorter than `len'. */
+static uint8_t *
+read_wave_file (int fd, const char *path, size_t len)
+{
+  uint8_t *data;
+  size_t   done;
+  ssize_t  got;
+
+  data = malloc (len);
+  if (data == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate memory for `%s': %s.\n",
+               progname, path, strerror (errno));
+
+      return NULL;
+    }
+
+  for (done = 0; done < len; done += got)
+    {
+      got = read (fd, data + done, len - done);
+      if (got == -1 && errno == EINTR)
+        got = 0;
+      else if (got <= 0)
+        {
+          if (got == 0)
+            fprintf (stderr, "%s: The file `%s' was truncated while being "
+                             "read.\n",
+                     progname, path);
+          else
+            fprintf (stderr, "%s: Failed to read `%s': %s.\n",
+                     progname, path, strerror (errno));
+
+          free (data);
+          return NULL;
+        }
+    }
+
+  return data;
+}
+
+/**
+ * The file is read into private memory rather than mapped: it may be
+ * rewritten in place to be reloaded, and playing from a mapping of a file
+ * which was truncated under it would raise SIGBUS.
+ */
 playable_pcm_buffer_t *
 load_wave_file_into_buffer (const char *path)
 {
   playable_pcm_buffer_t *buffer;
-  size_t                 read_bytes;
-  FILE                  *stream;
+  struct stat            file_stat;
+  uint8_t               *image;
+  size_t                 image_len;
+  size_t                 data_offset;
+  int                    fd;
 
   buffer = malloc (sizeof (playable_pcm_buffer_t));
   if (buffer == NULL)
@@ -151,8 +340,8 @@ load_wave_file_into_buffer (const char *path)
       return NULL;
     }
 
-  stream = fopen (path, "rb");
-  if (stream == NULL)
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
     {
       fprintf (stderr, "%s: Failed to open `%s' for reading: %s.\n",
                progname, path, strerror (errno));
@@ -161,92 +350,63 @@ load_wave_file_into_buffer (const char *path)
       return NULL;
     }
 
-  if (! parse_wave_header (stream, &(buffer->info)))
+  if (fstat (fd, &file_stat) != 0)
     {
-      fprintf (stderr, "%s: Failed to parse the WAVE header of `%s'.\n",
-               progname, path);
+      fprintf (stderr, "%s: Failed to determine the size of `%s': %s.\n",
+               progname, path, strerror (errno));
 
-      fclose (stream);
+      close (fd);
       free (buffer);
       return NULL;
     }
 
-  if (! find_wave_pcm_data (stream, &(buffer->data_len), NULL))
+  if (file_stat.st_size < (off_t) sizeof (wave_file_hdr_t))
     {
-      fprintf (stderr, "%s: Failed to locate the PCM data in the WAVE file `%s'.\n",
+      fprintf (stderr, "%s: The file `%s' is too short to be a WAVE file.\n",
                progname, path);
 
-      fclose (stream);
+      close (fd);
       free (buffer);
       return NULL;
     }
 
-  if (buffer->data_len == 0)
+  image_len = file_stat.st_size;
+  image     = read_wave_file (fd, path, image_len);
+  close (fd);
+  if (image == NULL)
     {
-      fprintf (stderr, "%s: The file `%s' does not contain any sound data.\n",
-               progname, path);
-
-      fclose (stream);
       free (buffer);
       return NULL;
     }
 
-  buffer->data = malloc (buffer->data_len);
-  if (buffer->data == NULL)
+  if (! parse_wave_map (image, image_len, &(buffer->info),
+                        &data_offset, &(buffer->data_len)))
     {
-      fprintf (stderr, "%s: Allocating the buffer for the PCM data failed: %s.\n",
-               progname, strerror (errno));
+      fprintf (stderr, "%s: Failed to parse the WAVE header of `%s'.\n",
+               progname, path);
 
-      fclose (stream);
-      free (buffer);
-      return NULL;
+      buffer->data_len = 0;
     }
+  else if (buffer->data_len == 0)
+    fprintf (stderr, "%s: The file `%s' does not contain any sound data.\n",
+             progname, path);
 
-  read_bytes = fread (buffer->data, 1, buffer->data_len, stream);
-
-  if (read_bytes != buffer->data_len)
+  if (buffer->data_len == 0)
     {
-      if (ferror (stream))
-        {
-          fprintf (stderr, "%s: Reading from `%s' failed: %s.\n",
-                   progname, path, strerror (errno));
-
-          fclose (stream);
-          free (buffer->data);
-          free (buffer);
-          return NULL;
-        }
-
-      fprintf (stderr, "%s: Warning: The PCM data in `%s' is truncated.\n",
-               progname, path);
-
-      if (read_bytes == 0)
-        {
-          fprintf (stderr, "%s: The file `%s' does not contain any sound data.\n",
-                   progname, path);
-
-          fclose (stream);
-          free (buffer->data);
-          free (buffer);
-          return NULL;
-        }
-      else
-        {
-          buffer->data_len = read_bytes;
-          buffer->data = realloc (buffer->data, buffer->data_len);
-          if (buffer->data == NULL)
-            {
-              fprintf (stderr, "%s: Adjusting the PCM data buffer's size failed: %s.\n",
-                       progname, strerror (errno));
-
-              fclose (stream);
-              free (buffer);
-              return NULL;
-            }
-        }
+      free (image);
+      free (buffer);
+      return NULL;
     }
 
-  fclose (stream);
+  /* Keep the sound data only. */
+  memmove (image, image + data_offset, buffer->data_len);
+  buffer->data = realloc (image, buffer->data_len);
+  if (buffer->data == NULL)
+    buffer->data = image;
+  buffer->map     = NULL;
+  buffer->map_len = 0;
+
+  track_pcm_buffer (buffer);
   return buffer;
 }
 
@@ -254,6 +414,8 @@ playable_pcm_file_t *
 prepare_wave_file (const char *path)
 {
   playable_pcm_file_t *file;
+  FILE                *stream;
+  uint32_t             data_len;
 
   file = malloc (sizeof (playable_pcm_file_t));
   if (file == NULL)
@@ -275,8 +437,8 @@ prepare_wave_file (const char *path)
       return NULL;
     }
 
-  file->stream = fopen (file->name, "rb");
-  if (file->stream == NULL)
+  stream = fopen (file->name, "rb");
+  if (stream == NULL)
     {
       fprintf (stderr, "%s: Failed to open `%s' for reading: %s.\n",
                progname, file->name, strerror (errno));
@@ -286,27 +448,48 @@ prepare_wave_file (const char *path)
       return NULL;
     }
 
-  if (! parse_wave_header (file->stream, &(file->info)))
+  if (! parse_wave_header (stream, &(file->info)))
     {
       fprintf (stderr, "%s: Failed to parse the WAVE header of `%s'.\n",
                progname, file->name);
 
-      fclose (file->stream);
+      fclose (stream);
       free (file->name);
       free (file);
       return NULL;
     }
 
-  if (! find_wave_pcm_data (file->stream, NULL, &(file->pcm_start_pos)))
+  if (! find_wave_pcm_data (stream, &data_len, &(file->data_offset)))
     {
       fprintf (stderr, "%s: Failed to locate the PCM data in the WAVE file `%s'.\n",
                progname, file->name);
 
-      fclose (file->stream);
+      fclose (stream);
       free (file->name);
       free (file);
       return NULL;
     }
+  file->data_len = data_len;
+
+  /* The data is read with pread () from now on, the stream isn't needed. */
+  file->head = NULL;
+  file->fd   = dup (fileno (stream));
+  fclose (stream);
+  if (file->fd == -1)
+    {
+      fprintf (stderr, "%s: Failed to duplicate the descriptor of `%s': %s.\n",
+               progname, file->name, strerror (errno));
+
+      free (file->name);
+      free (file);
+      return NULL;
+    }
+
+  if (! read_pcm_file_head (file))
+    {
+      close_pcm_file (file);
+      return NULL;
+    }
 
   return file;
 }
@@ -54,6 +54,12 @@
 typedef struct wave_file_hdr  wave_file_hdr_t;
 typedef struct wave_chunk_hdr wave_chunk_hdr_t;
 typedef struct wave_fmt_chunk wave_fmt_chunk_t;
+typedef struct wave_fmt_ext   wave_fmt_ext_t;
+
+/* Values of the data_format field, and the start of a sub-format GUID. */
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
 
 struct wave_file_hdr
 {
@@ -72,7 +78,7 @@ struct wave_fmt_chunk
 {
   wave_chunk_hdr_t hdr;
 
-  uint16_t data_format;      /* Always 0x01 - linear PCM. */
+  uint16_t data_format;      /* One of the WAVE_FORMAT_* values. */
   uint16_t channels;
   uint32_t sample_rate;
   uint32_t bytes_per_sec;
@@ -80,6 +86,16 @@ struct wave_fmt_chunk
   uint16_t bits_per_sample;
 };
 
+/* Follows the format chunk when data_format is WAVE_FORMAT_EXTENSIBLE. */
+struct wave_fmt_ext
+{
+  uint16_t ext_len;          /* At least 22. */
+  uint16_t valid_bits;
+  uint32_t channel_mask;
+  uint16_t sub_format;       /* The first two bytes of the sub-format GUID. */
+  uint8_t  guid_rest[14];
+};
+
 playable_pcm_buffer_t *load_wave_file_into_buffer (const char *path);
 playable_pcm_file_t   *prepare_wave_file (const char *path);
 
@@ -0,0 +1,54 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NXBELLD_WAVETABLE_H_
+#define _NXBELLD_WAVETABLE_H_ 1
+
+/* Also included by gen-wavetables, which is built without the configuration. */
+#include <stdint.h>
+
+
+/**
+ * The band-limited wavetables of the synthesizer, one period of each waveform
+ * in SYNTH_TABLE_LEN entries, plus a guard entry equal to the first.  They are
+ * rendered at build time by gen-wavetables into read-only data.
+ *
+ * Each waveform has a table per octave of harmonic content: level `l' holds
+ * the harmonics up to 2^l, so a tone whose Nyquist limit falls between 2^l
+ * and 2^(l+1) times its frequency is played from it without aliasing.  Levels
+ * above the last one a waveform has harmonics for share its table.
+ */
+#define SYNTH_TABLE_BITS  11
+#define SYNTH_TABLE_LEN   (1 << SYNTH_TABLE_BITS)
+#define SYNTH_LEVELS      10
+
+enum
+{
+  SYNTH_WAVE_SINE,
+  SYNTH_WAVE_COMPLEX,
+  SYNTH_WAVE_SQUARE,
+
+  SYNTH_WAVES
+};
+
+extern const int16_t *const synth_tables[SYNTH_WAVES][SYNTH_LEVELS];
+
+
+#endif /* _NXBELLD_WAVETABLE_H_ */
@@ -0,0 +1,286 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_XCB
+
+#include "display.h"
+
+#include <time.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xkb.h>
+
+/* Bells with names beyond the first BELL_NAMES ones go nameless. */
+#define BELL_NAMES 16
+
+struct bell_display
+{
+  xcb_connection_t *connection;
+  uint8_t           event_base;   /* The XKB extension's event code. */
+
+  /**
+   * Only a handful of names are ever used, so each is fetched from the
+   * server once, and kept as long as the connection.
+   */
+  xcb_atom_t        atoms[BELL_NAMES];
+  char             *names[BELL_NAMES];
+  unsigned int      name_count;
+};
+
+
+bell_display_t *
+open_bell_display (const char *name)
+{
+  bell_display_t                      *display;
+  const xcb_query_extension_reply_t   *extension;
+  xcb_xkb_use_extension_cookie_t       cookie;
+  xcb_xkb_use_extension_reply_t       *reply;
+
+  display = malloc (sizeof (bell_display_t));
+  if (display == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the display: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  display->name_count = 0;
+
+  display->connection = xcb_connect (name, NULL);
+  if (xcb_connection_has_error (display->connection))
+    {
+      fprintf (stderr, "%s: Cannot open the display.\n", progname);
+
+      xcb_disconnect (display->connection);
+      free (display);
+      return NULL;
+    }
+
+  extension = xcb_get_extension_data (display->connection, &xcb_xkb_id);
+  if (extension == NULL || ! extension->present)
+    {
+      fprintf (stderr, "%s: XKB extension not present.\n", progname);
+
+      close_bell_display (display);
+      return NULL;
+    }
+  display->event_base = extension->first_event;
+
+  cookie = xcb_xkb_use_extension (display->connection, XCB_XKB_MAJOR_VERSION,
+                                  XCB_XKB_MINOR_VERSION);
+  reply  = xcb_xkb_use_extension_reply (display->connection, cookie, NULL);
+  if (reply == NULL || ! reply->supported)
+    {
+      if (reply != NULL)
+        fprintf (stderr, "%s: Xkb version %d.%02d is required (got server "
+                         "%d.%02d).\n",
+                 progname, XCB_XKB_MAJOR_VERSION, XCB_XKB_MINOR_VERSION,
+                 reply->serverMajor, reply->serverMinor);
+      else
+        fprintf (stderr, "%s: Failed to set up the XKB extension.\n",
+                 progname);
+
+      free (reply);
+      close_bell_display (display);
+      return NULL;
+    }
+  free (reply);
+
+  return display;
+}
+
+void
+close_bell_display (bell_display_t *display)
+{
+  unsigned int iter;
+
+  if (display == NULL)
+    return;
+
+  for (iter = 0; iter < display->name_count; iter++)
+    free (display->names[iter]);
+  xcb_disconnect (display->connection);
+  free (display);
+}
+
+int
+bell_display_fd (bell_display_t *display)
+{
+  return xcb_get_file_descriptor (display->connection);
+}
+
+bool
+get_bell_defaults (bell_display_t *display, unsigned int *percent,
+                   unsigned int *pitch, unsigned int *duration)
+{
+  xcb_get_keyboard_control_reply_t *reply;
+
+  reply = xcb_get_keyboard_control_reply (display->connection,
+            xcb_get_keyboard_control (display->connection), NULL);
+  if (reply == NULL)
+    return false;
+
+  *percent  = reply->bell_percent;
+  *pitch    = reply->bell_pitch;
+  *duration = reply->bell_duration;
+
+  free (reply);
+  return true;
+}
+
+bool
+select_bell_events (bell_display_t *display)
+{
+  xcb_generic_error_t *error;
+
+  error = xcb_request_check (display->connection,
+            xcb_xkb_select_events_checked (display->connection,
+                                           XCB_XKB_ID_USE_CORE_KBD,
+                                           XCB_XKB_EVENT_TYPE_BELL_NOTIFY, 0,
+                                           XCB_XKB_EVENT_TYPE_BELL_NOTIFY,
+                                           0, 0, NULL));
+  if (error != NULL)
+    {
+      free (error);
+      return false;
+    }
+
+  return true;
+}
+
+bool
+audible_bell_enabled (bell_display_t *display)
+{
+  xcb_xkb_get_controls_reply_t *reply;
+  bool                          enabled;
+
+  reply = xcb_xkb_get_controls_reply (display->connection,
+            xcb_xkb_get_controls (display->connection,
+                                  XCB_XKB_ID_USE_CORE_KBD),
+            NULL);
+  if (reply == NULL)
+    return true;
+
+  enabled = (reply->enabledControls & XCB_XKB_BOOL_CTRL_AUDIBLE_BELL_MASK) != 0;
+  free (reply);
+
+  return enabled;
+}
+
+bool
+set_audible_bell (bell_display_t *display, bool enabled)
+{
+  xcb_generic_error_t *error;
+  uint8_t              per_key_repeat[32];
+
+  /* Only the enabled controls are changed; the other values are ignored. */
+  memset (per_key_repeat, 0, sizeof (per_key_repeat));
+  error = xcb_request_check (display->connection,
+            xcb_xkb_set_controls_checked (display->connection,
+              XCB_XKB_ID_USE_CORE_KBD, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+              XCB_XKB_BOOL_CTRL_AUDIBLE_BELL_MASK,
+              enabled ? XCB_XKB_BOOL_CTRL_AUDIBLE_BELL_MASK : 0,
+              XCB_XKB_CONTROL_CONTROLS_ENABLED,
+              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, per_key_repeat));
+  if (error != NULL)
+    {
+      free (error);
+      return false;
+    }
+
+  return true;
+}
+
+static const char *
+bell_name (bell_display_t *display, xcb_atom_t atom)
+{
+  xcb_get_atom_name_reply_t *reply;
+  char                      *name;
+  unsigned int               iter;
+
+  if (atom == XCB_ATOM_NONE)
+    return NULL;
+
+  for (iter = 0; iter < display->name_count; iter++)
+    {
+      if (display->atoms[iter] == atom)
+        return display->names[iter];
+    }
+  if (display->name_count == BELL_NAMES)
+    return NULL;
+
+  reply = xcb_get_atom_name_reply (display->connection,
+            xcb_get_atom_name (display->connection, atom), NULL);
+  if (reply == NULL)
+    return NULL;
+
+  name = strndup (xcb_get_atom_name_name (reply),
+                  xcb_get_atom_name_name_length (reply));
+  free (reply);
+  if (name == NULL)
+    return NULL;
+
+  display->atoms[display->name_count] = atom;
+  display->names[display->name_count] = name;
+
+  return display->names[display->name_count++];
+}
+
+bool
+read_display_bells (bell_display_t *display, bell_handler_t handler,
+                    void *data)
+{
+  xcb_generic_event_t          *event;
+  xcb_xkb_bell_notify_event_t  *notify;
+  bell_event_t                  bell;
+  const char                   *name;
+
+  /* Takes the events already buffered, reading more only if there are none. */
+  while ((event = xcb_poll_for_event (display->connection)) != NULL)
+    {
+      notify = (xcb_xkb_bell_notify_event_t *) event;
+      if ((event->response_type & 0x7f) == display->event_base
+          && notify->xkbType == XCB_XKB_BELL_NOTIFY)
+        {
+          clock_gettime (CLOCK_MONOTONIC, &(bell.received));
+          bell.server_time = notify->time;
+          bell.window      = notify->window;
+          name             = bell_name (display, notify->name);
+          snprintf (bell.name, sizeof (bell.name), "%s",
+                    (name != NULL) ? name : "");
+          bell.pitch       = notify->pitch;
+          bell.duration    = notify->duration;
+          bell.percent     = notify->percent;
+
+          handler (&bell, data);
+        }
+
+      free (event);
+    }
+
+  if (xcb_connection_has_error (display->connection))
+    return false;
+
+  return true;
+}
+
+#endif /* HAVE_XCB */
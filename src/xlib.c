@@ -0,0 +1,262 @@
+/**
+ *  nxbelld, a fork of xbelld, the bell daemon for computers w/o a PC speaker.
+ *
+ *  Copyright (C) 2016  Marek Benc <dusxmt@gmx.com>
+ *
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but HAVEOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#ifndef HAVE_XCB
+
+#include "display.h"
+
+#include <time.h>
+
+#include <X11/XKBlib.h>
+
+/* Bells with names beyond the first BELL_NAMES ones go nameless. */
+#define BELL_NAMES 16
+
+struct bell_display
+{
+  Display         *display;
+  int              event_code;
+  bool             lost;        /* The connection to the server was lost. */
+
+  /**
+   * Only a handful of names are ever used, so each is fetched from the
+   * server once, and kept as long as the connection.
+   */
+  Atom             atoms[BELL_NAMES];
+  char            *names[BELL_NAMES];
+  unsigned int     name_count;
+};
+
+
+#ifdef HAVE_XSETIOERROREXITHANDLER
+/**
+ * Keeps Xlib from exiting when the connection is lost, so that the other
+ * displays can still be served.
+ */
+static void
+connection_lost (Display *x_display, void *data)
+{
+  bell_display_t *display = data;
+
+  display->lost = true;
+}
+#endif
+
+bell_display_t *
+open_bell_display (const char *name)
+{
+  bell_display_t *display;
+  int             major;
+  int             minor;
+  int             xkb_error;
+
+  display = malloc (sizeof (bell_display_t));
+  if (display == NULL)
+    {
+      fprintf (stderr, "%s: Failed to allocate the display: %s.\n",
+               progname, strerror (errno));
+
+      return NULL;
+    }
+  display->name_count = 0;
+  display->lost       = false;
+
+  major = XkbMajorVersion;
+  minor = XkbMinorVersion;
+  display->display = XkbOpenDisplay ((char *) name, &(display->event_code),
+                                     NULL, &major, &minor, &xkb_error);
+  if (display->display == NULL)
+    {
+      switch (xkb_error)
+        {
+          case XkbOD_BadLibraryVersion:
+            fprintf (stderr, "%s: Xkb version %d.%02d is required (got library "
+                             "%d.%02d).\n",
+                     progname, XkbMajorVersion, XkbMinorVersion, major, minor);
+            break;
+          case XkbOD_ConnectionRefused:
+            fprintf (stderr, "%s: Cannot open the display: connection refused.\n",
+                     progname);
+            break;
+          case XkbOD_NonXkbServer:
+            fprintf (stderr, "%s: XKB extension not present.\n", progname);
+            break;
+          case XkbOD_BadServerVersion:
+            fprintf (stderr, "%s: Xkb version %d.%02d is required (got server "
+                             "%d.%02d).\n",
+                     progname, XkbMajorVersion, XkbMinorVersion, major, minor);
+            break;
+          default:
+            fprintf (stderr, "%s: Unknown error %d from XkbOpenDisplay",
+                     progname, xkb_error);
+            break;
+        }
+
+      free (display);
+      return NULL;
+    }
+#ifdef HAVE_XSETIOERROREXITHANDLER
+  XSetIOErrorExitHandler (display->display, connection_lost, display);
+#endif
+
+  return display;
+}
+
+void
+close_bell_display (bell_display_t *display)
+{
+  unsigned int iter;
+
+  if (display == NULL)
+    return;
+
+  for (iter = 0; iter < display->name_count; iter++)
+    {
+      if (display->names[iter] != NULL)
+        XFree (display->names[iter]);
+    }
+  XCloseDisplay (display->display);
+  free (display);
+}
+
+int
+bell_display_fd (bell_display_t *display)
+{
+  return ConnectionNumber (display->display);
+}
+
+bool
+get_bell_defaults (bell_display_t *display, unsigned int *percent,
+                   unsigned int *pitch, unsigned int *duration)
+{
+  XKeyboardState kbd_state;
+
+  if (! XGetKeyboardControl (display->display, &kbd_state))
+    return false;
+
+  *percent  = kbd_state.bell_percent;
+  *pitch    = kbd_state.bell_pitch;
+  *duration = kbd_state.bell_duration;
+
+  return true;
+}
+
+bool
+select_bell_events (bell_display_t *display)
+{
+  if (! XkbSelectEvents (display->display, XkbUseCoreKbd, XkbBellNotifyMask,
+                        XkbBellNotifyMask))
+    return false;
+
+  XFlush (display->display);
+  return true;
+}
+
+bool
+audible_bell_enabled (bell_display_t *display)
+{
+  XkbDescPtr xkb;
+  bool       enabled;
+
+  xkb = XkbAllocKeyboard ();
+  if (xkb == NULL)
+    return true;
+
+  enabled = XkbGetControls (display->display, XkbControlsEnabledMask, xkb)
+              != Success
+            || (xkb->ctrls->enabled_ctrls & XkbAudibleBellMask) != 0;
+  XkbFreeKeyboard (xkb, 0, True);
+
+  return enabled;
+}
+
+bool
+set_audible_bell (bell_display_t *display, bool enabled)
+{
+  if (! XkbChangeEnabledControls (display->display, XkbUseCoreKbd,
+                                  XkbAudibleBellMask,
+                                  enabled ? XkbAudibleBellMask : 0))
+    return false;
+
+  XFlush (display->display);
+  return true;
+}
+
+static const char *
+bell_name (bell_display_t *display, Atom atom)
+{
+  unsigned int iter;
+
+  if (atom == None)
+    return NULL;
+
+  for (iter = 0; iter < display->name_count; iter++)
+    {
+      if (display->atoms[iter] == atom)
+        return display->names[iter];
+    }
+  if (display->name_count == BELL_NAMES)
+    return NULL;
+
+  display->atoms[display->name_count] = atom;
+  display->names[display->name_count] = XGetAtomName (display->display, atom);
+
+  return display->names[display->name_count++];
+}
+
+bool
+read_display_bells (bell_display_t *display, bell_handler_t handler,
+                    void *data)
+{
+  XkbEvent     event;
+  bell_event_t bell;
+  const char  *name;
+
+  /**
+   * Xlib may have read several events off the connection at once.  Unless
+   * XSetIOErrorExitHandler () is available, a lost connection never returns
+   * here: Xlib exits.
+   */
+  while (! display->lost && XPending (display->display) > 0)
+    {
+      XNextEvent (display->display, &event.core);
+      if (event.type != display->event_code
+          || event.any.xkb_type != XkbBellNotify)
+        continue;
+
+      clock_gettime (CLOCK_MONOTONIC, &(bell.received));
+      bell.server_time = event.bell.time;
+      bell.window      = event.bell.window;
+      name             = bell_name (display, event.bell.name);
+      snprintf (bell.name, sizeof (bell.name), "%s",
+                (name != NULL) ? name : "");
+      bell.pitch       = (event.bell.pitch    > 0) ? event.bell.pitch    : 0;
+      bell.duration    = (event.bell.duration > 0) ? event.bell.duration : 0;
+      bell.percent     = (event.bell.percent  > 0) ? event.bell.percent  : 0;
+
+      handler (&bell, data);
+    }
+
+  return ! display->lost;
+}
+
+#endif /* ! HAVE_XCB */